@@ -0,0 +1,298 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bitset.h"
+
+// NOTES
+//
+// * A genome (plan draft) is one bit per knob.  It used to be a single
+//   unsigned long long, which capped the search space at 64 knobs.
+//
+// * Everything operates a word (64 knobs) at a time.  Weighted sums walk
+//   only the set bits of each word.
+//
+// * Unused high bits of the last word are kept clear by every operation
+//   that could set them, so whole word compares & counts are exact.
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+
+// mask of the valid bits in the last word
+static unsigned long long
+tail_mask (const cuzmem_bitset* b)
+{
+    unsigned int r = b->nbits % BITSET_WORD_BITS;
+    return r ? (1ULL << r) - 1 : ~0ULL;
+}
+
+static void
+clear_tail (cuzmem_bitset* b)
+{
+    if (b->nwords) {
+        b->w[b->nwords - 1] &= tail_mask (b);
+    }
+}
+
+// 64 random bits (rand() only promises 15, glibc gives 31)
+static unsigned long long
+rand_word ()
+{
+    unsigned long long r;
+
+    r = (unsigned long long)rand();
+    r = (r << 31) ^ (unsigned long long)rand();
+    r = (r << 31) ^ (unsigned long long)rand();
+
+    return r;
+}
+
+
+//------------------------------------------------------------------------------
+// BITSET INTERFACE
+//------------------------------------------------------------------------------
+cuzmem_bitset*
+bitset_create (unsigned int nbits)
+{
+    cuzmem_bitset* b = (cuzmem_bitset*)malloc (sizeof(cuzmem_bitset));
+
+    b->nbits = nbits;
+    b->nwords = (nbits + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+    b->w = (unsigned long long*)calloc (b->nwords ? b->nwords : 1,
+                                        sizeof(unsigned long long));
+    if (b->w == NULL) {
+        fprintf (stderr, "libcuzmem: unable to allocate %u bit genome!\n", nbits);
+        exit (1);
+    }
+
+    return b;
+}
+
+
+void
+bitset_destroy (cuzmem_bitset* b)
+{
+    if (b) {
+        free (b->w);
+        free (b);
+    }
+}
+
+
+cuzmem_bitset*
+bitset_clone (const cuzmem_bitset* b)
+{
+    cuzmem_bitset* c = bitset_create (b->nbits);
+    bitset_copy (c, b);
+    return c;
+}
+
+
+// dst and src must be the same width
+void
+bitset_copy (cuzmem_bitset* dst, const cuzmem_bitset* src)
+{
+    memcpy (dst->w, src->w, src->nwords * sizeof(unsigned long long));
+}
+
+
+void
+bitset_zero (cuzmem_bitset* b)
+{
+    memset (b->w, 0, b->nwords * sizeof(unsigned long long));
+}
+
+
+int
+bitset_get (const cuzmem_bitset* b, unsigned int i)
+{
+    if (i >= b->nbits) {
+        return 0;
+    }
+    return (int)((b->w[i / BITSET_WORD_BITS] >> (i % BITSET_WORD_BITS)) & 0x0001);
+}
+
+
+void
+bitset_set (cuzmem_bitset* b, unsigned int i, int v)
+{
+    unsigned long long bit;
+
+    if (i >= b->nbits) {
+        return;
+    }
+
+    bit = 1ULL << (i % BITSET_WORD_BITS);
+    if (v) {
+        b->w[i / BITSET_WORD_BITS] |= bit;
+    } else {
+        b->w[i / BITSET_WORD_BITS] &= ~bit;
+    }
+}
+
+
+void
+bitset_flip (cuzmem_bitset* b, unsigned int i)
+{
+    if (i < b->nbits) {
+        b->w[i / BITSET_WORD_BITS] ^= 1ULL << (i % BITSET_WORD_BITS);
+    }
+}
+
+
+void
+bitset_random (cuzmem_bitset* b)
+{
+    unsigned int i;
+
+    for (i=0; i<b->nwords; i++) {
+        b->w[i] = rand_word ();
+    }
+    clear_tail (b);
+}
+
+
+// same, from a seeded generator
+void
+bitset_random_prng (cuzmem_bitset* b, cuzmem_prng* p)
+{
+    unsigned int i;
+
+    for (i=0; i<b->nwords; i++) {
+        b->w[i] = prng_next (p);
+    }
+    clear_tail (b);
+}
+
+
+void
+bitset_xor (cuzmem_bitset* dst, const cuzmem_bitset* src)
+{
+    unsigned int i;
+
+    for (i=0; i<dst->nwords; i++) {
+        dst->w[i] ^= src->w[i];
+    }
+}
+
+
+// uniform crossover: child takes mom's bits where mix is set
+// and dad's bits elsewhere
+void
+bitset_crossover (cuzmem_bitset* child, const cuzmem_bitset* mom,
+                  const cuzmem_bitset* dad, const cuzmem_bitset* mix)
+{
+    unsigned int i;
+
+    for (i=0; i<child->nwords; i++) {
+        child->w[i] = (mom->w[i] & mix->w[i]) | (dad->w[i] & ~mix->w[i]);
+    }
+}
+
+
+// treats the bitset as one big counter and adds 1
+// returns 1 if it wrapped around to 0
+int
+bitset_increment (cuzmem_bitset* b)
+{
+    unsigned int i;
+
+    for (i=0; i<b->nwords; i++) {
+        if (++b->w[i] != 0) {
+            break;
+        }
+    }
+
+    if (i == b->nwords) {
+        return 1;
+    }
+    if (i == b->nwords - 1 && (b->w[i] & ~tail_mask (b))) {
+        b->w[i] = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int
+bitset_equal (const cuzmem_bitset* a, const cuzmem_bitset* b)
+{
+    return (a->nbits == b->nbits) &&
+           !memcmp (a->w, b->w, a->nwords * sizeof(unsigned long long));
+}
+
+
+unsigned int
+bitset_count (const cuzmem_bitset* b)
+{
+    unsigned int i, n = 0;
+
+    for (i=0; i<b->nwords; i++) {
+        n += __builtin_popcountll (b->w[i]);
+    }
+
+    return n;
+}
+
+
+// sum of weight[i] over the bits i set in both b and mask
+// (mask may be NULL)
+size_t
+bitset_weighted_sum (const cuzmem_bitset* b, const cuzmem_bitset* mask, const size_t* weight)
+{
+    unsigned int i;
+    unsigned long long w;
+    size_t sum = 0;
+
+    for (i=0; i<b->nwords; i++) {
+        w = b->w[i];
+        if (mask) {
+            w &= mask->w[i];
+        }
+        while (w) {
+            sum += weight[i * BITSET_WORD_BITS + __builtin_ctzll (w)];
+            w &= w - 1;
+        }
+    }
+
+    return sum;
+}
+
+
+// hex, most significant knob first
+void
+bitset_fprint (FILE* fp, const cuzmem_bitset* b)
+{
+    int i;
+
+    fprintf (fp, "0x");
+    if (b->nwords == 0) {
+        fprintf (fp, "0");
+    }
+    for (i=(int)b->nwords-1; i>=0; i--) {
+        if (i == (int)b->nwords-1) {
+            fprintf (fp, "%llx", b->w[i]);
+        } else {
+            fprintf (fp, "%016llx", b->w[i]);
+        }
+    }
+}
@@ -0,0 +1,100 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _bitset_h_
+#define _bitset_h_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "prng.h"
+
+#define BITSET_WORD_BITS 64
+
+// -- Bitset structure ---------------------------
+// one bit per knob (0: pinned cpu, 1: gpu global).  Bits past nbits
+// in the last word are always kept clear.
+typedef struct cuzmem_bitset_struct cuzmem_bitset;
+struct cuzmem_bitset_struct
+{
+    unsigned int nbits;
+    unsigned int nwords;
+    unsigned long long* w;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+cuzmem_bitset*
+bitset_create (unsigned int nbits);
+
+void
+bitset_destroy (cuzmem_bitset* b);
+
+cuzmem_bitset*
+bitset_clone (const cuzmem_bitset* b);
+
+void
+bitset_copy (cuzmem_bitset* dst, const cuzmem_bitset* src);
+
+void
+bitset_zero (cuzmem_bitset* b);
+
+int
+bitset_get (const cuzmem_bitset* b, unsigned int i);
+
+void
+bitset_set (cuzmem_bitset* b, unsigned int i, int v);
+
+void
+bitset_flip (cuzmem_bitset* b, unsigned int i);
+
+void
+bitset_random (cuzmem_bitset* b);
+
+void
+bitset_random_prng (cuzmem_bitset* b, cuzmem_prng* p);
+
+void
+bitset_xor (cuzmem_bitset* dst, const cuzmem_bitset* src);
+
+void
+bitset_crossover (cuzmem_bitset* child, const cuzmem_bitset* mom,
+                  const cuzmem_bitset* dad, const cuzmem_bitset* mix);
+
+int
+bitset_increment (cuzmem_bitset* b);
+
+int
+bitset_equal (const cuzmem_bitset* a, const cuzmem_bitset* b);
+
+unsigned int
+bitset_count (const cuzmem_bitset* b);
+
+size_t
+bitset_weighted_sum (const cuzmem_bitset* b, const cuzmem_bitset* mask, const size_t* weight);
+
+void
+bitset_fprint (FILE* fp, const cuzmem_bitset* b);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "callsite.h"
+
+// NOTES
+//
+// * A call site is identified by the return address of cudaMalloc().
+//   Raw addresses change from run to run (ASLR, shared libraries loaded
+//   in a different order), so the address is made relative to the base
+//   of the object it lives in and hashed together with the object's
+//   file name.
+//
+// * dladdr() is far too slow to call on every cudaMalloc(), so each
+//   thread keeps a small direct mapped cache of address -> hash.
+//
+// * 0 is never returned (it means "no call site" in a plan).
+
+typedef struct callsite_cache_entry_struct callsite_cache_entry;
+struct callsite_cache_entry_struct
+{
+    void* ret_addr;
+    unsigned long long hash;
+};
+
+static __thread callsite_cache_entry callsite_cache[CALLSITE_CACHE_SIZE];
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static unsigned long long
+fnv1a (const char* s, unsigned long long h)
+{
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+
+static unsigned long long
+callsite_normalize (void* ret_addr)
+{
+    Dl_info info;
+    const char* name;
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    unsigned long long offset;
+
+    if (dladdr (ret_addr, &info) && info.dli_fbase != NULL) {
+        // just the file name: install locations differ between machines
+        name = info.dli_fname ? strrchr (info.dli_fname, '/') : NULL;
+        name = name ? name + 1 : (info.dli_fname ? info.dli_fname : "");
+        h = fnv1a (name, h);
+        offset = (uintptr_t)ret_addr - (uintptr_t)info.dli_fbase;
+    } else {
+        offset = (uintptr_t)ret_addr;
+    }
+
+    h ^= offset;
+    h *= 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+
+    return h ? h : 1;
+}
+
+
+//------------------------------------------------------------------------------
+// CALL SITE INTERFACE
+//------------------------------------------------------------------------------
+
+// position independent hash of a call site
+unsigned long long
+callsite_hash (void* ret_addr)
+{
+    unsigned int i;
+    callsite_cache_entry* c;
+
+    i = (unsigned int)((((uintptr_t)ret_addr) * 0x9E3779B97F4A7C15ULL) >> 58)
+        & (CALLSITE_CACHE_SIZE - 1);
+    c = &callsite_cache[i];
+
+    if (c->ret_addr != ret_addr || c->hash == 0) {
+        c->hash = callsite_normalize (ret_addr);
+        c->ret_addr = ret_addr;
+    }
+
+    return c->hash;
+}
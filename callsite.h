@@ -0,0 +1,34 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _callsite_h_
+#define _callsite_h_
+
+#define CALLSITE_CACHE_SIZE 64      // per thread, must be a power of 2
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+unsigned long long
+callsite_hash (void* ret_addr);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
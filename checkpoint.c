@@ -0,0 +1,420 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "context.h"
+#include "plans.h"
+#include "memo.h"
+#include "checkpoint.h"
+
+// NOTES
+//
+// * After every tuning iteration cuzmem_end() writes the whole tuning
+//   session to ~/.project/plan.ckpt: the 0th iteration's plan draft,
+//   the search space (genes, gold members), best plan so far, fitness
+//   racing state, the measurement memo and, through CUZMEM_TUNER_SAVE,
+//   the tuner's own state.  It is written to a temporary file that is
+//   then renamed over the old one, so a process killed mid-write
+//   leaves the previous checkpoint intact.
+//
+// * A process that starts tuning the same project & plan with the same
+//   tuner on the same device picks up at the iteration that was about
+//   to run (CUZMEM_TUNER_LOAD) instead of starting with a new trace.
+//   The application must of course make the same allocations again.
+//
+// * The file is removed once tuning finishes and the plan is written.
+//
+// * Native byte order & struct layout: a checkpoint is only meant to be
+//   read back by the same build of libcuzmem on the same machine.
+//
+// * CUZMEM_CHECKPOINT=0 (or cuzmem_set_checkpoint (0)) turns it off.
+
+// a plan draft entry, as much of it as outlives the process
+typedef struct ckpt_entry_struct ckpt_entry;
+struct ckpt_entry_struct
+{
+    unsigned long long size;
+    unsigned long long site;
+    int id;
+    int gene;
+    unsigned int ordinal;
+    unsigned char loc;
+    unsigned char inloop;
+    unsigned char gold_member;
+    unsigned char pad;
+};
+
+typedef struct ckpt_header_struct ckpt_header;
+struct ckpt_header_struct
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int tuner;             // enum cuzmem_tuner
+    unsigned int tune_iter;         // iteration to run next
+    unsigned long long tune_iter_max;
+    unsigned long long num_knobs;
+    unsigned long long num_genes;
+    unsigned long long num_entries;
+    unsigned int grouping;
+    unsigned int gpu_mem_percent;
+    unsigned int fitness_size;      // sizeof(cuzmem_fitness)
+    unsigned int pad;
+    double best_time;
+    cuzmem_device_fp device;
+};
+
+
+//------------------------------------------------------------------------------
+// CHECKPOINT STREAM
+//------------------------------------------------------------------------------
+void
+ckpt_put (cuzmem_ckpt* ck, const void* data, size_t len)
+{
+    if (ck->ok && len > 0 && fwrite (data, len, 1, ck->fp) != 1) {
+        ck->ok = 0;
+    }
+}
+
+
+void
+ckpt_get (cuzmem_ckpt* ck, void* data, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    if (!ck->ok || fread (data, len, 1, ck->fp) != 1) {
+        ck->ok = 0;
+        memset (data, 0, len);
+    }
+}
+
+
+void
+ckpt_put_bitset (cuzmem_ckpt* ck, const cuzmem_bitset* b)
+{
+    ckpt_put (ck, &b->nbits, sizeof(b->nbits));
+    ckpt_put (ck, b->w, b->nwords * sizeof(unsigned long long));
+}
+
+
+// reads into b, which must be as wide as the bitset that was saved
+void
+ckpt_get_bitset (cuzmem_ckpt* ck, cuzmem_bitset* b)
+{
+    unsigned int nbits;
+
+    ckpt_get (ck, &nbits, sizeof(nbits));
+    if (nbits != b->nbits) {
+        ck->ok = 0;
+    }
+    ckpt_get (ck, b->w, b->nwords * sizeof(unsigned long long));
+}
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static void
+save_memo (cuzmem_ckpt* ck, const cuzmem_memo* m)
+{
+    unsigned int i;
+    unsigned char kind;
+    int pending = (m->pending != NULL);
+
+    ckpt_put (ck, &m->count, sizeof(m->count));
+    for (i=0; i<m->capacity; i++) {
+        if (m->keys[i] != NULL) {
+            ckpt_put (ck, &m->time[i], sizeof(double));
+            kind = m->kind[i];
+            ckpt_put (ck, &kind, sizeof(kind));
+            ckpt_put_bitset (ck, m->keys[i]);
+        }
+    }
+    ckpt_put (ck, &m->hits, sizeof(m->hits));
+    ckpt_put (ck, &m->misses, sizeof(m->misses));
+
+    ckpt_put (ck, &pending, sizeof(pending));
+    if (pending) {
+        ckpt_put_bitset (ck, m->pending);
+    }
+}
+
+
+static void
+load_memo (cuzmem_ckpt* ck, cuzmem_memo* m, unsigned int num_genes)
+{
+    unsigned int i, count;
+    unsigned char kind;
+    int pending;
+    double time;
+    cuzmem_bitset* b = bitset_create (num_genes);
+
+    memo_destroy (m);
+    memo_init (m);
+
+    ckpt_get (ck, &count, sizeof(count));
+    for (i=0; i<count && ck->ok; i++) {
+        ckpt_get (ck, &time, sizeof(time));
+        ckpt_get (ck, &kind, sizeof(kind));
+        ckpt_get_bitset (ck, b);
+        if (ck->ok) {
+            memo_insert (m, b, time, kind);
+        }
+    }
+    ckpt_get (ck, &m->hits, sizeof(m->hits));
+    ckpt_get (ck, &m->misses, sizeof(m->misses));
+
+    ckpt_get (ck, &pending, sizeof(pending));
+    if (pending) {
+        m->pending = bitset_create (num_genes);
+        ckpt_get_bitset (ck, m->pending);
+    }
+
+    bitset_destroy (b);
+}
+
+
+static void
+free_plan (cuzmem_plan* plan)
+{
+    cuzmem_plan* next;
+
+    while (plan != NULL) {
+        next = plan->next;
+        free (plan);
+        plan = next;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// CHECKPOINT INTERFACE
+//------------------------------------------------------------------------------
+void
+checkpoint_save (CUZMEM_CONTEXT ctx)
+{
+    char filename[FILENAME_MAX];
+    char tmpname[FILENAME_MAX + 16];
+    unsigned int trailer = CKPT_MAGIC;
+    ckpt_header h;
+    ckpt_entry e;
+    cuzmem_ckpt ck;
+    cuzmem_plan* entry;
+
+    make_project_directory (ctx->project_name);
+    if (plan_filename (filename, ctx->project_name, ctx->plan_name, CKPT_EXT)) {
+        return;
+    }
+    snprintf (tmpname, sizeof(tmpname), "%s.%d", filename, (int)getpid ());
+
+    ck.fp = fopen (tmpname, "wb");
+    ck.ok = (ck.fp != NULL);
+    if (!ck.ok) {
+        fprintf (stderr, "libcuzmem: unable to write checkpoint %s\n", tmpname);
+        return;
+    }
+
+    memset (&h, 0, sizeof(h));
+    h.magic = CKPT_MAGIC;
+    h.version = CKPT_VERSION;
+    h.tuner = ctx->tuner;
+    h.tune_iter = ctx->tune_iter;
+    h.tune_iter_max = ctx->tune_iter_max;
+    h.num_knobs = ctx->num_knobs;
+    h.num_genes = ctx->num_genes;
+    for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+        h.num_entries++;
+    }
+    h.grouping = ctx->grouping;
+    h.gpu_mem_percent = ctx->gpu_mem_percent;
+    h.fitness_size = sizeof(cuzmem_fitness);
+    h.best_time = ctx->best_time;
+    h.device = ctx->device;
+    ckpt_put (&ck, &h, sizeof(h));
+
+    // the 0th iteration's plan draft (in list order)
+    for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+        memset (&e, 0, sizeof(e));
+        e.size = entry->size;
+        e.site = entry->site;
+        e.id = entry->id;
+        e.gene = entry->gene;
+        e.ordinal = entry->ordinal;
+        e.loc = (unsigned char)entry->loc;
+        e.inloop = (unsigned char)entry->inloop;
+        e.gold_member = (unsigned char)entry->gold_member;
+        ckpt_put (&ck, &e, sizeof(e));
+    }
+
+    // search space & search progress
+    ckpt_put_bitset (&ck, ctx->gold_mask);
+    ckpt_put_bitset (&ck, ctx->best_plan);
+    ckpt_put (&ck, ctx->gene_size, ctx->num_genes * sizeof(size_t));
+    ckpt_put (&ck, &ctx->fitness, sizeof(cuzmem_fitness));
+    save_memo (&ck, &ctx->memo);
+    ctx->call_tuner (CUZMEM_TUNER_SAVE, &ck);
+    ckpt_put (&ck, &trailer, sizeof(trailer));
+
+    if (fclose (ck.fp) != 0) {
+        ck.ok = 0;
+    }
+    if (!ck.ok || rename (tmpname, filename) != 0) {
+        fprintf (stderr, "libcuzmem: unable to write checkpoint %s\n", filename);
+        unlink (tmpname);
+    }
+}
+
+
+// resumes the tuning session saved for ctx's project & plan.
+// returns 1 if it did (ctx->tune_iter is then the iteration to run)
+int
+checkpoint_load (CUZMEM_CONTEXT ctx)
+{
+    char filename[FILENAME_MAX];
+    unsigned long long i;
+    unsigned int trailer = 0;
+    ckpt_header h;
+    ckpt_entry e;
+    cuzmem_ckpt ck;
+    cuzmem_plan *entry, **tail;
+    cuzmem_fitness fitness;
+    enum cuzmem_grouping grouping;
+    unsigned int gpu_mem_percent;
+    double best_time;
+
+    if (plan_filename (filename, ctx->project_name, ctx->plan_name, CKPT_EXT)) {
+        return 0;
+    }
+    ck.fp = fopen (filename, "rb");
+    if (ck.fp == NULL) {
+        return 0;
+    }
+    ck.ok = 1;
+
+    ckpt_get (&ck, &h, sizeof(h));
+    if (!ck.ok || h.magic != CKPT_MAGIC || h.version != CKPT_VERSION ||
+        h.fitness_size != sizeof(cuzmem_fitness) || h.num_genes == 0) {
+        fprintf (stderr, "libcuzmem: ignoring unreadable checkpoint %s\n", filename);
+        fclose (ck.fp);
+        return 0;
+    }
+    if (h.tuner != (unsigned int)ctx->tuner) {
+        fprintf (stderr, "libcuzmem: checkpoint %s is for another tuner, starting over\n", filename);
+        fclose (ck.fp);
+        return 0;
+    }
+    if (ctx->device.total_mem && memcmp (&h.device, &ctx->device, sizeof(cuzmem_device_fp))) {
+        fprintf (stderr, "libcuzmem: checkpoint %s is for another device, starting over\n", filename);
+        fclose (ck.fp);
+        return 0;
+    }
+
+    // what the checkpoint overwrites, options included (for a damaged
+    // checkpoint to give back)
+    fitness = ctx->fitness;
+    grouping = ctx->grouping;
+    gpu_mem_percent = ctx->gpu_mem_percent;
+    best_time = ctx->best_time;
+
+    // the 0th iteration's plan draft
+    free_plan (ctx->plan);
+    ctx->plan = NULL;
+    tail = &ctx->plan;
+    for (i=0; i<h.num_entries && ck.ok; i++) {
+        ckpt_get (&ck, &e, sizeof(e));
+        entry = (cuzmem_plan*)calloc (1, sizeof(cuzmem_plan));
+        entry->id = e.id;
+        entry->gene = e.gene;
+        entry->site = e.site;
+        entry->ordinal = e.ordinal;
+        entry->size = (size_t)e.size;
+        entry->loc = e.loc;
+        entry->inloop = e.inloop;
+        entry->first_hit = 1;
+        entry->gold_member = e.gold_member;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    // search space & search progress
+    ctx->tune_iter = h.tune_iter;
+    ctx->tune_iter_max = h.tune_iter_max;
+    ctx->num_knobs = h.num_knobs;
+    ctx->num_genes = h.num_genes;
+    ctx->grouping = (enum cuzmem_grouping)h.grouping;
+    ctx->gpu_mem_percent = h.gpu_mem_percent;
+    ctx->best_time = h.best_time;
+
+    bitset_destroy (ctx->gold_mask);
+    bitset_destroy (ctx->best_plan);
+    free (ctx->gene_size);
+    ctx->gold_mask = bitset_create (ctx->num_genes);
+    ctx->best_plan = bitset_create (ctx->num_genes);
+    ctx->gene_size = (size_t*)calloc (ctx->num_genes, sizeof(size_t));
+    ckpt_get_bitset (&ck, ctx->gold_mask);
+    ckpt_get_bitset (&ck, ctx->best_plan);
+    ckpt_get (&ck, ctx->gene_size, ctx->num_genes * sizeof(size_t));
+    ckpt_get (&ck, &ctx->fitness, sizeof(cuzmem_fitness));
+    load_memo (&ck, &ctx->memo, (unsigned int)ctx->num_genes);
+    ctx->call_tuner (CUZMEM_TUNER_LOAD, &ck);
+    ckpt_get (&ck, &trailer, sizeof(trailer));
+    fclose (ck.fp);
+
+    if (!ck.ok || trailer != CKPT_MAGIC) {
+        fprintf (stderr, "libcuzmem: checkpoint %s is damaged, starting over\n", filename);
+        ctx->call_tuner (CUZMEM_TUNER_DROP, NULL);
+        free_plan (ctx->plan);
+        ctx->plan = NULL;
+        ctx->tune_iter = 0;
+        ctx->tune_iter_max = 0;
+        ctx->num_knobs = 0;
+        ctx->num_genes = 0;
+        ctx->grouping = grouping;
+        ctx->gpu_mem_percent = gpu_mem_percent;
+        ctx->best_time = best_time;
+        memo_destroy (&ctx->memo);
+        memo_init (&ctx->memo);
+        ctx->fitness = fitness;
+        return 0;
+    }
+
+    fprintf (stderr, "libcuzmem: resuming tuning at iteration %u of %llu from %s\n",
+            ctx->tune_iter, ctx->tune_iter_max, filename);
+
+    // the allocation trace isn't saved again: it was written at the end
+    // of the session's 0th iteration
+    if (ctx->trace.enabled &&
+        !plan_filename (filename, ctx->project_name, ctx->plan_name, TRACE_EXT)) {
+        trace_read (&ctx->trace, filename);
+    }
+    return 1;
+}
+
+
+// the tuning session is over: its checkpoint is of no more use
+void
+checkpoint_remove (CUZMEM_CONTEXT ctx)
+{
+    char filename[FILENAME_MAX];
+
+    if (!plan_filename (filename, ctx->project_name, ctx->plan_name, CKPT_EXT)) {
+        unlink (filename);
+    }
+}
@@ -0,0 +1,71 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _checkpoint_h_
+#define _checkpoint_h_
+
+#include <stdio.h>
+#include "bitset.h"
+#include "context.h"
+
+#define CKPT_EXT        "ckpt"
+#define CKPT_MAGIC      0x4b5a5543      // "CUZK"
+#define CKPT_VERSION    1
+
+// -- Checkpoint stream --------------------------
+// handed to a tuner's CUZMEM_TUNER_SAVE / CUZMEM_TUNER_LOAD.  Once a
+// read or write fails ok is 0 and further reads return zeros, so
+// tuners only need to check ok (if at all) at the end.
+typedef struct cuzmem_ckpt_struct cuzmem_ckpt;
+struct cuzmem_ckpt_struct
+{
+    FILE* fp;
+    int ok;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+ckpt_put (cuzmem_ckpt* ck, const void* data, size_t len);
+
+void
+ckpt_get (cuzmem_ckpt* ck, void* data, size_t len);
+
+void
+ckpt_put_bitset (cuzmem_ckpt* ck, const cuzmem_bitset* b);
+
+void
+ckpt_get_bitset (cuzmem_ckpt* ck, cuzmem_bitset* b);
+
+void
+checkpoint_save (CUZMEM_CONTEXT ctx);
+
+int
+checkpoint_load (CUZMEM_CONTEXT ctx);
+
+void
+checkpoint_remove (CUZMEM_CONTEXT ctx);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
@@ -15,30 +15,121 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-// TODO: Make these functions thread safe
-
 #include <stdlib.h>
+#include <float.h>
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include "context.h"
 #include "tuner_exhaust.h"
 #include "tuner_genetic.h"
 
+// NOTES
+//
+// * A context belongs to a process: every host thread of the process that
+//   calls into libcuzmem shares it (project, plan, tuner, etc).
+//
+// * Each thread caches a pointer to the context in thread local storage,
+//   so after the first call get_context() is a single TLS load plus a
+//   generation check.  The generation is bumped whenever a context is
+//   destroyed (or we fork) so that a thread calling in afterwards binds
+//   again instead of using its cached pointer.  This does not protect a
+//   thread that is inside libcuzmem while the context is destroyed:
+//   destroy_context() must not run concurrently with other threads
+//   calling in (the application tears libcuzmem down from one thread
+//   once the others are done with it).
+//
+// * context[] and context_lut[] are only ever touched with context_lock
+//   held.  The state inside a context has its own finer grained locking
+//   (see libcuzmem.c, ptrmap.c and the plan index in plans.c).
+
 //------------------------------------------------------------------------------
 // CUZMEM CONTEXT STATE
 //------------------------------------------------------------------------------
 cuzmem_context* context[MAX_CONTEXTS] = { NULL };
 pid_t context_lut[MAX_CONTEXTS] = { 0 };
 
+static pthread_mutex_t context_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t context_once = PTHREAD_ONCE_INIT;
+static volatile unsigned int context_generation = 1;
+
+static __thread cuzmem_context* thread_context = NULL;
+static __thread unsigned int thread_generation = 0;
+
 //------------------------------------------------------------------------------
-// CUZMEM CONTEXT MANAGEMENT FUNCTIONS
+// HELPERS
 //------------------------------------------------------------------------------
 
-// create a context id for calling thread
-cuzmem_context*
-create_context ()
+// the child of a fork() gets its own context
+static void
+context_atfork_child (void)
+{
+    pthread_mutex_init (&context_lock, NULL);
+    context_generation++;
+    thread_context = NULL;
+}
+
+
+static void
+context_setup (void)
+{
+    pthread_atfork (NULL, NULL, context_atfork_child);
+}
+
+
+// find the calling process's context (context_lock must be held)
+static cuzmem_context*
+context_find (pid_t pid)
+{
+    int i;
+
+    for (i=0; i<MAX_CONTEXTS; i++) {
+        if (context_lut[i] == pid && context[i] != NULL) {
+            return context[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+// knob grouping mode from CUZMEM_GROUPING (site, size or none)
+static enum cuzmem_grouping
+grouping_from_env (void)
+{
+    char* env = getenv ("CUZMEM_GROUPING");
+
+    if (env == NULL || !strcmp (env, "none")) {
+        return CUZMEM_GROUP_NONE;
+    }
+    else if (!strcmp (env, "site")) {
+        return CUZMEM_GROUP_SITE;
+    }
+    else if (!strcmp (env, "size")) {
+        return CUZMEM_GROUP_SIZE;
+    }
+
+    fprintf (stderr, "libcuzmem: unknown CUZMEM_GROUPING \"%s\" (ignored)\n", env);
+    return CUZMEM_GROUP_NONE;
+}
+
+
+// tuning checkpoints are on unless CUZMEM_CHECKPOINT=0
+static int
+checkpoint_from_env (void)
+{
+    char* env = getenv ("CUZMEM_CHECKPOINT");
+
+    return (env == NULL || atoi (env) != 0);
+}
+
+
+// create a context for the calling process (context_lock must be held)
+static cuzmem_context*
+context_new (pid_t pid)
 {
     unsigned int i=0;
 
@@ -50,7 +141,10 @@ create_context ()
 
     // create context
     context[i] = (cuzmem_context*)malloc(sizeof(cuzmem_context));
-    context_lut[i] = getpid();
+    if (context[i] == NULL) {
+        return NULL;
+    }
+    context_lut[i] = pid;
 
     // populate context with default values
     strcpy (context[i]->plan_name, "phantom_plan");
@@ -58,73 +152,146 @@ create_context ()
     context[i]->id = i;
     context[i]->current_knob = 0;
     context[i]->num_knobs = 0;
+    context[i]->num_genes = 0;
+    context[i]->grouping = grouping_from_env ();
+    context[i]->alloc_site = 0;
+    context[i]->num_stray = 0;
     context[i]->tune_iter = 0;
     context[i]->tune_iter_max = 0;
     context[i]->op_mode = CUZMEM_RUN;
     context[i]->plan = NULL;
+    plan_index_init (&context[i]->plan_index);
+    plan_index_init (&context[i]->trace_free);
     context[i]->start_time = 0;
-    context[i]->best_time = ULONG_MAX;
-    context[i]->best_plan = 0;
+    context[i]->alloc_ns = 0;
+    context[i]->best_time = DBL_MAX;
+    context[i]->best_plan = NULL;
+    context[i]->gold_mask = NULL;
+    context[i]->gene_size = NULL;
     context[i]->gpu_mem_percent = 90;
     context[i]->allocated_mem = 0;
     context[i]->most_mem_allocated = 0;
+    context[i]->clock = 0;
+    context[i]->peak_clock = 0;
+    ptrmap_init (&context[i]->ptr_map);
+    devcache_init (&context[i]->dev_cache);
+    pinarena_init (&context[i]->pin_arena);
+    online_init (&context[i]->online);
+    fitness_init (&context[i]->fitness);
+    timer_init (&context[i]->timer);
+    memo_init (&context[i]->memo);
+    genetic_parms_init (&context[i]->genetic);
+    queue_init (&context[i]->queue);
+    trace_init (&context[i]->trace);
+    sim_model_init (&context[i]->sim);
+    context[i]->sim.alloc = (context[i]->fitness.profile != CUZMEM_PROFILE_SERVICE);
+    context[i]->retain = (getenv ("CUZMEM_RETAIN") != NULL);
+    context[i]->kept_dev_bytes = 0;
     context[i]->cuda_context = NULL;
     context[i]->tuner_state = NULL;
+    context[i]->tuner = CUZMEM_GENETIC;
+    context[i]->checkpoint = checkpoint_from_env ();
     context[i]->call_tuner = cuzmem_tuner_genetic;
+    pthread_mutex_init (&context[i]->tune_lock, NULL);
 
     return context[i];
 }
 
 
-// get context id for current thread
-cuzmem_context*
-get_context ()
+// slow path of get_context(): bind the calling thread to its
+// process's context, creating the context if necessary
+static cuzmem_context*
+context_bind ()
 {
-    int i;
     pid_t pid = getpid();
+    cuzmem_context* ctx;
 
-    for (i=0; i<MAX_CONTEXTS; i++) {
-        if (context_lut[i] == pid) {
-            return context[i];
-        }
+    pthread_once (&context_once, context_setup);
+
+    pthread_mutex_lock (&context_lock);
+    ctx = context_find (pid);
+    if (ctx == NULL) {
+        ctx = context_new (pid);
     }
+    if (ctx != NULL) {
+        thread_context = ctx;
+        thread_generation = context_generation;
+    }
+    pthread_mutex_unlock (&context_lock);
 
-    // no context, so create one
-    return create_context();
+    if (ctx == NULL) {
+        fprintf (stderr, "libcuzmem: unable to create context!\n");
+        exit (1);
+    }
+    return ctx;
 }
 
+//------------------------------------------------------------------------------
+// CUZMEM CONTEXT MANAGEMENT FUNCTIONS
+//------------------------------------------------------------------------------
+
+// create a context for the calling process (and bind calling thread)
+cuzmem_context*
+create_context ()
+{
+    return context_bind ();
+}
 
-// destroy context for current thread
+
+// get context for current thread
+cuzmem_context*
+get_context ()
+{
+    if (thread_context != NULL && thread_generation == context_generation) {
+        return thread_context;
+    }
+
+    // no context yet (or it was destroyed), so bind one
+    return context_bind();
+}
+
+
+// destroy context for current process
 void
 destroy_context ()
 {
     int i;
     pid_t pid = getpid();
 
+    pthread_once (&context_once, context_setup);
+
+    pthread_mutex_lock (&context_lock);
     for (i=0; i<MAX_CONTEXTS; i++) {
-        if (context_lut[i] == pid) {
+        if (context_lut[i] == pid && context[i] != NULL) {
+            ptrmap_destroy (&context[i]->ptr_map);
+            devcache_destroy (&context[i]->dev_cache);
+            pinarena_destroy (&context[i]->pin_arena);
+            online_destroy (&context[i]->online);
+            memo_destroy (&context[i]->memo);
+            queue_destroy (&context[i]->queue);
+            trace_destroy (&context[i]->trace);
+            plan_index_destroy (&context[i]->plan_index);
+            plan_index_destroy (&context[i]->trace_free);
+            bitset_destroy (context[i]->best_plan);
+            bitset_destroy (context[i]->gold_mask);
+            free (context[i]->gene_size);
+            pthread_mutex_destroy (&context[i]->tune_lock);
             free (context[i]);
+            context[i] = NULL;
+            context_lut[i] = 0;
         }
     }
+
+    // invalidate every thread's cached context pointer
+    context_generation++;
+    thread_context = NULL;
+    pthread_mutex_unlock (&context_lock);
 }
 
 
 // returns the context's id
-// get context id for current thread
 unsigned int
 get_context_id ()
 {
-    int i;
-    cuzmem_context* ctx;
-    pid_t pid = getpid();
-
-    for (i=0; i<MAX_CONTEXTS; i++) {
-        if (context_lut[i] == pid) {
-            return context[i]->id;
-        }
-    }
-
-    // no context, so create one and return its id
-    ctx = create_context();
-    return ctx->id;
+    return get_context()->id;
 }
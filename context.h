@@ -20,14 +20,28 @@
 
 #include <stdio.h>
 #include <cuda.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include "libcuzmem.h"
 #include "plans.h"
+#include "bitset.h"
+#include "ptrmap.h"
+#include "devcache.h"
+#include "pinarena.h"
+#include "online.h"
+#include "fitness.h"
+#include "timer.h"
+#include "memo.h"
+#include "queue.h"
+#include "trace.h"
+#include "sim.h"
+#include "tuner_genetic.h"
 
 #define MAX_CONTEXTS  256
 
 // -- Context structure --------------------------
-// NOTE: a libcuzmem context is bound to thread id
+// NOTE: a libcuzmem context is bound to process id
+//       (each thread caches a pointer to it, see context.c)
 typedef struct cuzmem_context_instance cuzmem_context;
 struct cuzmem_context_instance
 {
@@ -36,19 +50,47 @@ struct cuzmem_context_instance
     char project_name[MAX_CONTEXTS];
     unsigned int tune_iter;
     unsigned long long num_knobs;
+    unsigned long long num_genes;   // knob groups the tuners search over
+    enum cuzmem_grouping grouping;
+    unsigned long long alloc_site;  // call site of the cudaMalloc() being tuned
+    unsigned int num_stray;     // RUN mode allocations not found in the plan
     unsigned long long current_knob;
     unsigned long long tune_iter_max;
     enum cuzmem_op_mode op_mode;
     cuzmem_plan *plan;
+    cuzmem_plan_index plan_index;   // RUN mode lookups into plan
+    cuzmem_plan_index trace_free;   // 0th cycle: freed entries by size
     double start_time;
-    unsigned long best_time;
-    unsigned long long best_plan;
+    unsigned long long alloc_ns;    // time spent in cudaMalloc()/cudaFree() this iteration
+    double best_time;
+    cuzmem_bitset* best_plan;   // placement of the fastest plan so far
+    cuzmem_bitset* gold_mask;   // knobs live at the 0th cycle's peak
+    size_t* gene_size;          // gene -> gold bytes in that gene
     unsigned int gpu_mem_percent;
     size_t allocated_mem;       // only valid 0th cycle tune
     size_t most_mem_allocated;
+    unsigned long long clock;   // alloc/free event counter (0th cycle)
+    unsigned long long peak_clock;
+    cuzmem_ptrmap ptr_map;      // gpu pointer -> live plan entry
+    cuzmem_devcache dev_cache;  // free gpu global blocks kept for reuse
+    cuzmem_pinarena pin_arena;  // pinned regions zero-copy blocks come from
+    cuzmem_online online;       // RUN mode bandit tuning
+    cuzmem_fitness fitness;     // run times of the candidate being tuned
+    cuzmem_timer timer;         // times each iteration (device events)
+    cuzmem_memo memo;           // fitness of placements already run
+    cuzmem_genetic_parms genetic;   // genetic tuner parameters
+    cuzmem_queue queue;         // coordinated tuning with other processes
+    cuzmem_trace trace;         // the 0th cycle's allocations & frees
+    cuzmem_sim_model sim;       // cost model the trace is replayed with
+    int retain;                 // keep knob backing between tune iterations
+    size_t kept_dev_bytes;      // gpu global bytes kept by retain mode
     CUcontext cuda_context;
+    cuzmem_device_fp device;    // GPU plans are tuned on/loaded for
+    enum cuzmem_tuner tuner;    // which tuner call_tuner is
+    int checkpoint;             // save tuning state every iteration
     cuzmem_plan* (*call_tuner)(enum cuzmem_tuner_action, void*);
     void* tuner_state;
+    pthread_mutex_t tune_lock;  // serializes tuner calls (TUNE mode only)
 };
 typedef cuzmem_context* CUZMEM_CONTEXT;
 // -----------------------------------------------
@@ -81,6 +123,18 @@ get_context_id ();
 CUresult
 alloc_mem (cuzmem_plan* entry, size_t size);
 
+CUresult
+get_gpu_mem_info (unsigned int* free, unsigned int* total);
+
+CUresult
+get_device_fingerprint (cuzmem_device_fp* fp, CUdevice dev);
+
+void
+keep_mem (cuzmem_plan* entry);
+
+size_t
+release_kept_mem (CUZMEM_CONTEXT ctx, int loc);
+
 double
 get_time ();
 
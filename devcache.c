@@ -0,0 +1,270 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cuda.h>
+#include "devcache.h"
+
+//#define DEBUG
+
+// NOTES
+//
+// * cuMemAlloc()/cuMemFree() are slow and frequently synchronize the
+//   device.  Instead of giving freed device memory back to the driver we
+//   keep the block in a per size class stack and hand it out again to the
+//   next request from that class that it is large enough for.
+//
+// * Misses allocate exactly the requested size (no rounding), so the
+//   cache never costs GPU memory when it isn't hitting.  A hit may hand
+//   out a block up to 12.5% larger than requested; that overshoot is
+//   reported as internal fragmentation.
+//
+// * The cache holds at most cache->limit bytes of free blocks.  When
+//   cuMemAlloc() runs out of memory, everything cached is released and
+//   the allocation is retried before anybody falls back to pinned memory.
+//
+// * Each class has its own lock.  Statistics are updated atomically.
+//
+// * Limit comes from CUZMEM_CACHE_LIMIT (bytes, 0 disables caching).
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+
+// size class for an allocation of size bytes
+static unsigned int
+devcache_class (size_t size)
+{
+    unsigned int k, sub, c;
+    unsigned long long n;
+
+    if (size <= DEVCACHE_MIN_SIZE) {
+        return 0;
+    }
+
+    // 2^k < size <= 2^(k+1)
+    n = (unsigned long long)(size - 1);
+    k = 63 - __builtin_clzll (n);
+    sub = (unsigned int)(n >> (k - 3)) & 0x7;
+    c = 1 + (k - 9) * 8 + sub;
+
+    return (c < DEVCACHE_CLASSES) ? c : DEVCACHE_CLASSES - 1;
+}
+
+
+static void
+stat_add (size_t* stat, size_t n)
+{
+    __sync_add_and_fetch (stat, n);
+}
+
+static void
+stat_sub (size_t* stat, size_t n)
+{
+    __sync_sub_and_fetch (stat, n);
+}
+
+
+//------------------------------------------------------------------------------
+// DEVICE CACHE INTERFACE
+//------------------------------------------------------------------------------
+void
+devcache_init (cuzmem_devcache* cache)
+{
+    unsigned int c;
+    char* env;
+
+    for (c=0; c<DEVCACHE_CLASSES; c++) {
+        cache->cls[c].blocks = NULL;
+        cache->cls[c].num_blocks = 0;
+        cache->cls[c].max_blocks = 0;
+        pthread_mutex_init (&cache->cls[c].lock, NULL);
+    }
+
+    env = getenv ("CUZMEM_CACHE_LIMIT");
+    if (env) {
+        cache->limit = (size_t)strtoull (env, NULL, 10);
+    } else {
+        cache->limit = (size_t)-1;
+    }
+
+    memset (&cache->stats, 0, sizeof(cache->stats));
+}
+
+
+void
+devcache_destroy (cuzmem_devcache* cache)
+{
+    unsigned int c;
+
+    devcache_trim (cache, 0);
+    for (c=0; c<DEVCACHE_CLASSES; c++) {
+        free (cache->cls[c].blocks);
+        pthread_mutex_destroy (&cache->cls[c].lock);
+    }
+}
+
+
+// allocate device memory, from the cache if possible
+// (block_size receives the size of the block actually handed out)
+CUresult
+devcache_alloc (cuzmem_devcache* cache, CUdeviceptr* dptr, size_t* block_size, size_t size)
+{
+    CUresult ret;
+    unsigned int i, lo;
+    cuzmem_devclass* cls = &cache->cls[devcache_class (size)];
+    cuzmem_devblock* b;
+
+    // look through the most recently cached blocks of this class
+    pthread_mutex_lock (&cls->lock);
+    lo = (cls->num_blocks > DEVCACHE_SCAN) ? cls->num_blocks - DEVCACHE_SCAN : 0;
+    for (i=cls->num_blocks; i>lo; i--) {
+        b = &cls->blocks[i-1];
+        if (b->size >= size) {
+            *dptr = b->dptr;
+            *block_size = b->size;
+            *b = cls->blocks[--cls->num_blocks];
+            pthread_mutex_unlock (&cls->lock);
+
+            __sync_add_and_fetch (&cache->stats.hits, 1);
+            stat_sub (&cache->stats.cached_bytes, *block_size);
+            stat_add (&cache->stats.live_bytes, size);
+            stat_add (&cache->stats.live_block_bytes, *block_size);
+#if defined (DEBUG)
+            fprintf (stderr, "libcuzmem: cache hit %i B (block %i B)\n", (int)size, (int)*block_size);
+#endif
+            return CUDA_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock (&cls->lock);
+
+    // miss: go to the driver
+    __sync_add_and_fetch (&cache->stats.misses, 1);
+    ret = cuMemAlloc (dptr, (unsigned int)size);
+
+    // out of memory? give back what we are hoarding and try again
+    if (ret != CUDA_SUCCESS && devcache_trim (cache, 0) > 0) {
+        ret = cuMemAlloc (dptr, (unsigned int)size);
+    }
+
+    if (ret == CUDA_SUCCESS) {
+        *block_size = size;
+        stat_add (&cache->stats.live_bytes, size);
+        stat_add (&cache->stats.live_block_bytes, size);
+    }
+
+    return ret;
+}
+
+
+// return a device block to the cache (or to the driver if the
+// cache is full)
+CUresult
+devcache_free (cuzmem_devcache* cache, CUdeviceptr dptr, size_t block_size, size_t size)
+{
+    size_t cached, peak;
+    cuzmem_devclass* cls = &cache->cls[devcache_class (block_size)];
+
+    stat_sub (&cache->stats.live_bytes, size);
+    stat_sub (&cache->stats.live_block_bytes, block_size);
+
+    // would this put us over the limit?
+    cached = __sync_add_and_fetch (&cache->stats.cached_bytes, block_size);
+    if (cached > cache->limit) {
+        stat_sub (&cache->stats.cached_bytes, block_size);
+        return cuMemFree (dptr);
+    }
+
+    pthread_mutex_lock (&cls->lock);
+    if (cls->num_blocks == cls->max_blocks) {
+        unsigned int max_blocks = cls->max_blocks ? 2 * cls->max_blocks : 16;
+        cuzmem_devblock* blocks = (cuzmem_devblock*)realloc (cls->blocks,
+                max_blocks * sizeof(cuzmem_devblock));
+        if (blocks == NULL) {
+            // can't track it, so just let it go
+            pthread_mutex_unlock (&cls->lock);
+            stat_sub (&cache->stats.cached_bytes, block_size);
+            return cuMemFree (dptr);
+        }
+        cls->blocks = blocks;
+        cls->max_blocks = max_blocks;
+    }
+    cls->blocks[cls->num_blocks].dptr = dptr;
+    cls->blocks[cls->num_blocks].size = block_size;
+    cls->num_blocks++;
+    pthread_mutex_unlock (&cls->lock);
+
+    // keep track of the high water mark
+    do {
+        peak = cache->stats.peak_cached_bytes;
+    } while (cached > peak &&
+             !__sync_bool_compare_and_swap (&cache->stats.peak_cached_bytes, peak, cached));
+
+    return CUDA_SUCCESS;
+}
+
+
+// give cached blocks back to the driver (largest classes first) until
+// no more than keep bytes remain cached.  returns # of bytes released.
+size_t
+devcache_trim (cuzmem_devcache* cache, size_t keep)
+{
+    int c;
+    size_t released = 0;
+    cuzmem_devclass* cls;
+    cuzmem_devblock b;
+
+    for (c=DEVCACHE_CLASSES-1; c>=0; c--) {
+        cls = &cache->cls[c];
+        pthread_mutex_lock (&cls->lock);
+        while (cls->num_blocks > 0 && cache->stats.cached_bytes > keep) {
+            b = cls->blocks[--cls->num_blocks];
+            stat_sub (&cache->stats.cached_bytes, b.size);
+            __sync_add_and_fetch (&cache->stats.trimmed, 1);
+            cuMemFree (b.dptr);
+            released += b.size;
+        }
+        pthread_mutex_unlock (&cls->lock);
+
+        if (cache->stats.cached_bytes <= keep) {
+            break;
+        }
+    }
+
+    return released;
+}
+
+
+// print hit rate & fragmentation
+void
+devcache_report (cuzmem_devcache* cache, FILE* fp)
+{
+    struct cuzmem_cache_stats* st = &cache->stats;
+    unsigned long long lookups = st->hits + st->misses;
+
+    fprintf (fp, "libcuzmem: device cache\n");
+    fprintf (fp, "  hit rate      : %.1f%% (%llu of %llu)\n",
+            lookups ? 100.0 * st->hits / lookups : 0.0, st->hits, lookups);
+    fprintf (fp, "  internal frag : %.1f%% (%lu B requested, %lu B backing)\n",
+            st->live_block_bytes ? 100.0 * (1.0 - (double)st->live_bytes / st->live_block_bytes) : 0.0,
+            (unsigned long)st->live_bytes, (unsigned long)st->live_block_bytes);
+    fprintf (fp, "  cached        : %lu B (peak %lu B, %llu blocks trimmed)\n",
+            (unsigned long)st->cached_bytes, (unsigned long)st->peak_cached_bytes, st->trimmed);
+}
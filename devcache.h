@@ -0,0 +1,86 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _devcache_h_
+#define _devcache_h_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <cuda.h>
+#include "libcuzmem.h"
+
+// size classes: everything up to 512 B shares class 0, above that
+// each power of 2 is split into 8 classes (blocks in one class are
+// never more than 12.5% apart in size)
+#define DEVCACHE_MIN_SIZE     512
+#define DEVCACHE_CLASSES      384
+#define DEVCACHE_SCAN         8       // blocks looked at per lookup
+
+// -- Device Block Cache structures --------------
+typedef struct cuzmem_devblock_struct cuzmem_devblock;
+struct cuzmem_devblock_struct
+{
+    CUdeviceptr dptr;
+    size_t size;
+};
+
+typedef struct cuzmem_devclass_struct cuzmem_devclass;
+struct cuzmem_devclass_struct
+{
+    cuzmem_devblock* blocks;    // stack of cached (free) blocks
+    unsigned int num_blocks;
+    unsigned int max_blocks;
+    pthread_mutex_t lock;
+};
+
+typedef struct cuzmem_devcache_struct cuzmem_devcache;
+struct cuzmem_devcache_struct
+{
+    cuzmem_devclass cls[DEVCACHE_CLASSES];
+    size_t limit;               // max bytes held in the cache
+    struct cuzmem_cache_stats stats;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+devcache_init (cuzmem_devcache* cache);
+
+void
+devcache_destroy (cuzmem_devcache* cache);
+
+CUresult
+devcache_alloc (cuzmem_devcache* cache, CUdeviceptr* dptr, size_t* block_size, size_t size);
+
+CUresult
+devcache_free (cuzmem_devcache* cache, CUdeviceptr dptr, size_t block_size, size_t size);
+
+size_t
+devcache_trim (cuzmem_devcache* cache, size_t keep);
+
+void
+devcache_report (cuzmem_devcache* cache, FILE* fp);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,311 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "fitness.h"
+
+// NOTES
+//
+// * A tuning iteration used to be one run of the application, and its
+//   time (one gettimeofday() difference) was the candidate's fitness.
+//   On a noisy machine the best plan was often just the luckiest run.
+//
+// * Now cuzmem_end() may run the same candidate several times before
+//   the tuner's END is called.  The tuner then reads the aggregate
+//   (median by default) through fitness_time().
+//
+// * Racing: the 1st candidate gets all of its runs, so we have a best
+//   and a noise estimate.  After that, a candidate is dropped as soon as
+//   its confidence interval lies entirely above the best's.  Clear
+//   losers cost 1 run; close contenders get up to repeats runs.
+//
+// * The noise of one run, relative to the candidate's time, is pooled
+//   over every candidate run more than once.  It stands in for the
+//   spread of candidates that only have 1 sample.
+//
+// * The 0th (trace) iteration is a single run and never repeated.
+//
+// * Time spent getting and giving back the memory behind cudaMalloc()
+//   and cudaFree() (device allocations, pinning pages) is measured
+//   separately.  With the SERVICE profile it is taken out of the
+//   fitness: a long running job allocates once, so a pinned-heavy plan
+//   shouldn't be judged by its page pinning.  With ONESHOT (the default)
+//   it counts.
+//
+// * Environment:
+//     CUZMEM_FITNESS_WARMUP   runs thrown away before the 1st measurement
+//     CUZMEM_FITNESS_REPEATS  most runs per candidate (default 1: no racing)
+//     CUZMEM_FITNESS_AGG      median (default), trimmed or mean
+//     CUZMEM_PROFILE          oneshot (default) or service
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static int
+cmp_double (const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+static double
+sample_mean (const double* s, unsigned int n)
+{
+    unsigned int i;
+    double sum = 0.0;
+
+    for (i=0; i<n; i++) {
+        sum += s[i];
+    }
+    return n ? sum / n : 0.0;
+}
+
+
+static double
+sample_var (const double* s, unsigned int n)
+{
+    unsigned int i;
+    double mean = sample_mean (s, n), sum = 0.0;
+
+    if (n < 2) {
+        return 0.0;
+    }
+    for (i=0; i<n; i++) {
+        sum += (s[i] - mean) * (s[i] - mean);
+    }
+    return sum / (n - 1);
+}
+
+
+//------------------------------------------------------------------------------
+// FITNESS INTERFACE
+//------------------------------------------------------------------------------
+void
+fitness_init (cuzmem_fitness* f)
+{
+    char* env;
+
+    memset (f, 0, sizeof(cuzmem_fitness));
+
+    env = getenv ("CUZMEM_FITNESS_WARMUP");
+    f->warmup = env ? (unsigned int)atoi (env) : 0;
+    f->warmup_left = f->warmup;
+
+    env = getenv ("CUZMEM_FITNESS_REPEATS");
+    f->repeats = env ? (unsigned int)atoi (env) : 1;
+    if (f->repeats < 1) {
+        f->repeats = 1;
+    }
+    if (f->repeats > FITNESS_MAX_SAMPLES) {
+        f->repeats = FITNESS_MAX_SAMPLES;
+    }
+
+    f->agg = FITNESS_MEDIAN;
+    env = getenv ("CUZMEM_FITNESS_AGG");
+    if (env != NULL) {
+        if (!strcmp (env, "trimmed")) {
+            f->agg = FITNESS_TRIMMED;
+        }
+        else if (!strcmp (env, "mean")) {
+            f->agg = FITNESS_MEAN;
+        }
+        else if (strcmp (env, "median")) {
+            fprintf (stderr, "libcuzmem: unknown CUZMEM_FITNESS_AGG \"%s\" (using median)\n", env);
+        }
+    }
+
+    f->profile = CUZMEM_PROFILE_ONESHOT;
+    env = getenv ("CUZMEM_PROFILE");
+    if (env != NULL) {
+        if (!strcmp (env, "service")) {
+            f->profile = CUZMEM_PROFILE_SERVICE;
+        }
+        else if (strcmp (env, "oneshot")) {
+            fprintf (stderr, "libcuzmem: unknown CUZMEM_PROFILE \"%s\" (using oneshot)\n", env);
+        }
+    }
+}
+
+
+// records the time of one run of the current candidate, alloc of which
+// was spent in allocation calls.
+// returns 1 if the candidate should be run again before it is judged
+int
+fitness_sample (cuzmem_fitness* f, double t, double alloc, int repeatable)
+{
+    double lo, hi;
+
+    f->repeatable = repeatable;
+    f->repeat = 0;
+
+    if (f->profile == CUZMEM_PROFILE_SERVICE) {
+        t = (t > alloc) ? t - alloc : 0.0;
+    }
+
+    if (!repeatable) {
+        f->sample[0] = t;
+        f->alloc[0] = alloc;
+        f->n = 1;
+        return 0;
+    }
+
+    // cold caches, lazy driver init, ...
+    if (f->warmup_left > 0) {
+        f->warmup_left--;
+        f->repeat = 1;
+        return 1;
+    }
+
+    if (f->n < FITNESS_MAX_SAMPLES) {
+        f->sample[f->n] = t;
+        f->alloc[f->n] = alloc;
+        f->n++;
+    }
+    f->runs++;
+
+    if (f->n >= f->repeats) {
+        return 0;
+    }
+
+    // race against the best so far
+    if (f->have_best) {
+        fitness_ci (f, &lo, &hi);
+        if (lo > f->best_hi) {
+            f->dropped++;
+            return 0;
+        }
+    }
+
+    f->repeat = 1;
+    return 1;
+}
+
+
+// aggregate run time of the current candidate
+double
+fitness_time (const cuzmem_fitness* f)
+{
+    unsigned int k;
+    double s[FITNESS_MAX_SAMPLES];
+
+    if (f->n == 0) {
+        return 0.0;
+    }
+    if (f->agg == FITNESS_MEAN || f->n < 3) {
+        // (median & trimmed mean of 1 or 2 runs are just the mean)
+        return sample_mean (f->sample, f->n);
+    }
+
+    memcpy (s, f->sample, f->n * sizeof(double));
+    qsort (s, f->n, sizeof(double), cmp_double);
+
+    if (f->agg == FITNESS_MEDIAN) {
+        return (f->n % 2) ? s[f->n / 2] : 0.5 * (s[f->n/2 - 1] + s[f->n/2]);
+    }
+
+    // trimmed mean
+    k = (unsigned int)(f->n * FITNESS_TRIM);
+    return sample_mean (s + k, f->n - 2*k);
+}
+
+
+// mean time the current candidate's runs spent in allocation calls
+double
+fitness_alloc_time (const cuzmem_fitness* f)
+{
+    return sample_mean (f->alloc, f->n);
+}
+
+
+// confidence interval of the current candidate's aggregate time
+void
+fitness_ci (const cuzmem_fitness* f, double* lo, double* hi)
+{
+    double t = fitness_time (f);
+    double var, se;
+
+    if (f->n >= 2) {
+        var = sample_var (f->sample, f->n);
+    } else {
+        var = f->noise * t * t;
+    }
+    se = sqrt (var / (f->n ? f->n : 1));
+    if (f->agg == FITNESS_MEDIAN) {
+        // asymptotic efficiency of the median
+        se *= 1.2533;
+    }
+
+    *lo = t - FITNESS_Z * se;
+    *hi = t + FITNESS_Z * se;
+}
+
+
+// done with the current candidate (call after the tuner has read it)
+void
+fitness_commit (cuzmem_fitness* f)
+{
+    double t, lo, hi;
+
+    if (f->repeatable && f->n > 0) {
+        t = fitness_time (f);
+        fitness_ci (f, &lo, &hi);
+
+        if (f->n >= 2 && t > 0.0) {
+            f->noise = (f->noise * f->noise_dof + sample_var (f->sample, f->n) / (t*t) * (f->n - 1))
+                     / (f->noise_dof + f->n - 1);
+            f->noise_dof += f->n - 1;
+        }
+
+        if (!f->have_best || t < f->best) {
+            f->have_best = 1;
+            f->best = t;
+            f->best_lo = lo;
+            f->best_hi = hi;
+            f->best_alloc = fitness_alloc_time (f);
+            f->best_n = f->n;
+        }
+        f->candidates++;
+    }
+
+    f->n = 0;
+    f->repeat = 0;
+}
+
+
+void
+fitness_report (const cuzmem_fitness* f, FILE* fp)
+{
+    if (!f->have_best) {
+        return;
+    }
+    fprintf (fp, "libcuzmem: fastest candidate %f s (95%% CI %f - %f s, %u runs)\n",
+            f->best, f->best_lo, f->best_hi, f->best_n);
+    fprintf (fp, "libcuzmem:   %f s in allocation calls (%s by the %s profile)\n",
+            f->best_alloc,
+            (f->profile == CUZMEM_PROFILE_SERVICE) ? "excluded" : "included",
+            (f->profile == CUZMEM_PROFILE_SERVICE) ? "service" : "oneshot");
+    if (f->repeats > 1) {
+        fprintf (fp, "libcuzmem: %llu runs over %llu candidates, %llu raced out early, run noise %.1f%%\n",
+                f->runs, f->candidates, f->dropped, 100.0 * sqrt (f->noise));
+    }
+}
@@ -0,0 +1,97 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _fitness_h_
+#define _fitness_h_
+
+#include <stdio.h>
+#include "libcuzmem.h"
+
+#define FITNESS_MAX_SAMPLES 64      // most runs of one candidate
+#define FITNESS_TRIM        0.2     // trimmed from each end by FITNESS_TRIMMED
+#define FITNESS_Z           1.96    // 95% confidence intervals
+
+enum cuzmem_fitness_agg {
+    FITNESS_MEDIAN,
+    FITNESS_TRIMMED,
+    FITNESS_MEAN
+};
+
+// -- Fitness measurement structure --------------
+// the run times of the candidate being measured, and what racing
+// needs to know about the best candidate measured so far
+typedef struct cuzmem_fitness_struct cuzmem_fitness;
+struct cuzmem_fitness_struct
+{
+    unsigned int warmup;        // runs thrown away before measuring
+    unsigned int repeats;       // most runs per candidate
+    enum cuzmem_fitness_agg agg;
+    enum cuzmem_profile profile;    // SERVICE: allocation time doesn't count
+
+    unsigned int warmup_left;
+    double sample[FITNESS_MAX_SAMPLES];     // fitness of each run
+    double alloc[FITNESS_MAX_SAMPLES];      // time in allocation calls
+    unsigned int n;
+    int repeatable;             // current candidate can be run again
+    int repeat;                 // next run is the same candidate again
+
+    int have_best;
+    double best;                // fastest aggregate time measured
+    double best_lo, best_hi;    // ...and its confidence interval
+    double best_alloc;
+    unsigned int best_n;
+
+    double noise;               // pooled relative variance of a run
+    unsigned long long noise_dof;
+
+    unsigned long long runs;
+    unsigned long long candidates;
+    unsigned long long dropped; // candidates raced out early
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+fitness_init (cuzmem_fitness* f);
+
+int
+fitness_sample (cuzmem_fitness* f, double t, double alloc, int repeatable);
+
+double
+fitness_time (const cuzmem_fitness* f);
+
+double
+fitness_alloc_time (const cuzmem_fitness* f);
+
+void
+fitness_ci (const cuzmem_fitness* f, double* lo, double* hi);
+
+void
+fitness_commit (cuzmem_fitness* f);
+
+void
+fitness_report (const cuzmem_fitness* f, FILE* fp);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
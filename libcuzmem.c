@@ -19,24 +19,81 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 #include <cuda.h>
 #include <driver_types.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/types.h>
 
 #include "libcuzmem.h"
 #include "context.h"
 #include "plans.h"
+#include "callsite.h"
+#include "ptrmap.h"
+#include "devcache.h"
+#include "pinarena.h"
+#include "tuner_util.h"
+#include "checkpoint.h"
+#include "queue.h"
+#include "tuner_anneal.h"
 #include "tuner_exhaust.h"
 #include "tuner_genetic.h"
+#include "tuner_greedy.h"
 #include "tuner_notune.h"
+#include "tuner_surrogate.h"
+#include "tuner_worker.h"
 
 //#define DEBUG
 
 // some non-API function declarations I wanted to keep out of libcuzmem.h
 CUresult alloc_mem (cuzmem_plan* entry, size_t size);
+void release_entry_kept_mem (CUZMEM_CONTEXT ctx, cuzmem_plan* entry);
 double get_time();
 
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+
+// charges the time since t0 to this iteration's allocation overhead
+static void
+add_alloc_time (CUZMEM_CONTEXT ctx, double t0)
+{
+    double dt = get_time() - t0;
+
+    if (dt > 0.0) {
+        __sync_fetch_and_add (&ctx->alloc_ns, (unsigned long long)(dt * 1e9));
+    }
+}
+
+
+// RUN mode: an entry for an allocation the plan knows nothing about
+// (freed by cudaFree())
+static cuzmem_plan*
+stray_entry (CUZMEM_CONTEXT ctx, size_t size)
+{
+    cuzmem_plan* entry = (cuzmem_plan*)calloc (1, sizeof(cuzmem_plan));
+
+    if (entry == NULL) {
+        fprintf (stderr, "libcuzmem: unable to allocate plan entry!\n");
+        exit (1);
+    }
+    entry->id = -1;
+    entry->gene = -1;
+    entry->size = size;
+    entry->loc = 1;
+    entry->first_hit = 1;
+
+    if (__sync_fetch_and_add (&ctx->num_stray, 1) == 0) {
+        fprintf (stderr, "libcuzmem: allocation of %lu B not in plan \"%s\" "
+                 "(placing in gpu global memory; consider retuning)\n",
+                 (unsigned long)size, ctx->plan_name);
+    }
+
+    return entry;
+}
+
+
 //------------------------------------------------------------------------------
 // CUDA RUNTIME REPLACEMENTS
 //------------------------------------------------------------------------------
@@ -44,80 +101,115 @@ double get_time();
 cudaError_t
 cudaMalloc (void **devPtr, size_t size)
 {
-    CUresult ret;
+    CUresult ret = CUDA_ERROR_NOT_INITIALIZED;
     cuzmem_plan *entry = NULL;
+    void* ret_addr = __builtin_return_address (0);
     CUZMEM_CONTEXT ctx = get_context();
 
     *devPtr = NULL;
 
     // Decide what to do with current knob
     if (CUZMEM_RUN == ctx->op_mode) {
-        // 1) Load plan for this project
-        entry = ctx->plan;
-
-        // 2) Lookup malloc type for this knob & allocate
-        while (entry != NULL) {
-            if (entry->id == ctx->current_knob &&
-                entry->size == size
-                )
-            {
-                ret = alloc_mem (entry, size);
-                *devPtr = entry->gpu_pointer;
-                break;
+        unsigned long long knob;
+
+        // 1) Lookup malloc type for this knob in the plan index.
+        if (ctx->plan_index.site_capacity != 0) {
+            // by call site, size & # of earlier allocations of that size
+            // from that site, so reordered allocations still find their
+            // own entries
+            entry = plan_index_lookup_site (&ctx->plan_index,
+                        callsite_hash (ret_addr), size);
+        } else {
+            // plan without call sites: by allocation order alone.  The
+            // knob is claimed with a CAS so that concurrent host threads
+            // never walk away with the same one.
+            do {
+                knob = ctx->current_knob;
+                entry = plan_index_lookup (&ctx->plan_index, knob);
+                if (entry == NULL || entry->size != size) {
+                    entry = NULL;
+                    break;
+                }
+            } while (!__sync_bool_compare_and_swap (&ctx->current_knob, knob, knob+1));
+        }
+
+        // 2) make sure nobody else is already using the entry
+        //    (inloop entries may have been handed out by size)
+        if (entry != NULL) {
+            if (entry->inloop) {
+                if (!plan_index_unlink_inloop (&ctx->plan_index, entry)) {
+                    entry = NULL;
+                }
+            }
+            else if (entry->gpu_pointer != NULL) {
+                entry = NULL;
             }
-            entry = entry->next;
         }
 
-        // If we enter this loop, either:
-        //  1) ctx->current_knob exceeded the maximum entry ID in the plan
+        // 3) allocate
+        // (we don't increment current_knob for inloop allocations below,
+        //  they are knobs that we have already counted!)
+        if (entry != NULL) {
+            ret = alloc_mem (entry, size);
+            if (ret != CUDA_SUCCESS && entry->inloop) {
+                plan_index_push_inloop (&ctx->plan_index, entry);
+            }
+            *devPtr = entry->gpu_pointer;
+        }
+
+        // If we get here, either:
+        //  1) the plan has no more entries for this call site & size (or
+        //     ctx->current_knob exceeded the maximum entry ID in the plan)
         //  2) ctx->current_knob is less than the maximum entry ID, but the
         //     size requested by current_knob does not match the size in the
         //     entry with the same ID
         // Both of these situations indicate that the allocation must be
-        // associated with a previous entry... so we search through previous
-        // entries marked as inloop for one that is the correct size and
-        // currently unallocated.
-        if (*devPtr == NULL) {
-            // Look for a free()ed "inloop" marked plan entry 
-            entry = ctx->plan;
-            while (1) {
-                if (entry == NULL) {
-                    fprintf (stderr,"libcuzmem: unable to deduce inloop allocation from plan!\n");
-                    exit (1);
-                }
-                if ((entry->inloop == 1)         &&
-                    (entry->gpu_pointer == NULL) &&
-                    (entry->size == size))
-                {
-                        ret = alloc_mem (entry, size);
-                        if (ret != CUDA_SUCCESS) {
-                            fprintf (stderr, "libcuzmem: inloop alloc_mem() failed [%i]\n", ret);
-                        }
-                        *devPtr = entry->gpu_pointer;
-                        break;
-                }
-                entry = entry->next;
+        // associated with a previous entry... so we take a previous entry
+        // marked as inloop that is the correct size and currently
+        // unallocated.
+        else {
+            entry = plan_index_pop_inloop (&ctx->plan_index, size);
+            if (entry == NULL) {
+                // not in the plan at all (the application has changed
+                // since it was tuned): default to gpu global memory
+                entry = stray_entry (ctx, size);
+            }
+            ret = alloc_mem (entry, size);
+            if (ret == CUDA_SUCCESS) {
+                *devPtr = entry->gpu_pointer;
+            }
+            else if (entry->id < 0) {
+                // a stray entry is nobody's to reuse
+                fprintf (stderr, "libcuzmem: stray alloc_mem() failed [%i]\n", ret);
+                free (entry);
+            }
+            else {
+                fprintf (stderr, "libcuzmem: inloop alloc_mem() failed [%i]\n", ret);
+                plan_index_push_inloop (&ctx->plan_index, entry);
             }
-        } else {
-            // Don't increment current_knob for inloop allocations,
-            // they are knobs that we have already counted!
-            ctx->current_knob++;
         }
     }
     else if (CUZMEM_TUNE == ctx->op_mode) {
         // Lookup current_knob in plan draft.
         // An entry is returned describing the malloc action taken
         // NOTE: NULL is returned if no malloc occured
+        // NOTE: tuners are sequential state machines, so we only ever
+        //       let one host thread into the tuner at a time
+        pthread_mutex_lock (&ctx->tune_lock);
+        ctx->alloc_site = callsite_hash (ret_addr);
         entry = ctx->call_tuner (CUZMEM_TUNER_LOOKUP, &size);
         if (entry == NULL) {
             ret = CUDA_ERROR_NOT_INITIALIZED;
         } else {
+            ret = CUDA_SUCCESS;
             *devPtr = entry->gpu_pointer;
 
             if (ctx->tune_iter == 0) {
                 ctx->allocated_mem += size;
+                trace_event (&ctx->trace, entry, TRACE_ALLOC, get_time () - ctx->start_time);
             }
         }
+        pthread_mutex_unlock (&ctx->tune_lock);
     }
 
     // Morph CUDA Driver return codes into CUDA Runtime codes
@@ -142,67 +234,83 @@ cudaFree (void *devPtr)
     CUresult ret;
     CUZMEM_CONTEXT ctx = get_context();
     cuzmem_plan *entry = NULL;
+    int tuning = (CUZMEM_TUNE == ctx->op_mode);
+    double t0;
+
+    // Lookup plan entry for this gpu pointer (and drop it from the index)
+    entry = ptrmap_remove (&ctx->ptr_map, devPtr);
+    if (entry == NULL) {
+        fprintf (stderr, "libcuzmem: attempt to free invalid pointer (%p).\n", devPtr);
+        exit (1);
+    }
 
     // -------------------------------------------------------------------------
     // if tuning, determine the largest aggregate allocation during 0th cycle
-    if (CUZMEM_TUNE == ctx->op_mode) {
+    //
+    // Rather than marking up every live entry each time a new peak is hit,
+    // we just remember *when* the peak happened.  An entry was live at the
+    // peak if it was allocated before it and is only now being freed.
+    // zeroth_end_handler() settles the gold members for entries that are
+    // never freed.
+    //
+    // While tuning, the tuner walks the plan draft looking at which entries
+    // are allocated, so the rest of the free happens under the tune lock.
+    if (tuning) {
+        pthread_mutex_lock (&ctx->tune_lock);
         if (ctx->tune_iter == 0) {
-            // candidate largest alloc set, mark'em up as gold members
+            // candidate largest alloc set
             if (ctx->allocated_mem > ctx->most_mem_allocated) {
                 ctx->most_mem_allocated = ctx->allocated_mem;
-                entry = ctx->plan;
-                while (entry != NULL) {
-                    if (entry->gpu_pointer != NULL) {
-                        entry->gold_member = 1;
-                    } else {
-                        entry->gold_member = 0;
-                    }
-                    if (entry->gpu_pointer == devPtr) {
-                        ctx->allocated_mem -= entry->size;
-                    }
-                    entry = entry->next;
-                }
+                ctx->peak_clock = ++ctx->clock;
             }
-            // just another free during the 0th iteration
-            else {
-                entry = ctx->plan;
-                while (entry != NULL) {
-                    if (entry->gpu_pointer == devPtr) {
-                        ctx->allocated_mem -= entry->size;
-                        break;
-                    }
-                    entry = entry->next;
-                }
+            if (entry->alloc_stamp <= ctx->peak_clock) {
+                entry->gold_stamp = ctx->peak_clock;
             }
+            ctx->allocated_mem -= entry->size;
+            trace_event (&ctx->trace, entry, TRACE_FREE, get_time () - ctx->start_time);
+
+            // a later allocation of the same size reuses the entry
+            plan_index_add_size (&ctx->trace_free, entry->size);
+            plan_index_push_inloop (&ctx->trace_free, entry);
         }
     }
     // -------------------------------------------------------------------------
 
-    // Lookup plan entry for this gpu pointer
-    entry = ctx->plan;
-    while (1) {
-        if (entry == NULL) {
-            fprintf (stderr, "libcuzmem: attempt to free invalid pointer (%p).\n", devPtr);
-            exit (1);
-        }
-        if (entry->gpu_pointer == devPtr) {
-            break;
-        }
-        entry = entry->next;
+    // Retain mode: while tuning, hang on to the backing.  If the next
+    // iteration places this knob in the same spot it gets it right back.
+    t0 = tuning ? get_time () : 0.0;
+    if (tuning && ctx->retain) {
+        keep_mem (entry);
+        ret = CUDA_SUCCESS;
     }
-
     // Was it pinned cpu memory or real gpu memory?
-    if (entry->cpu_pointer == NULL) {
-        // real gpu memory
-        ret = cuMemFree (entry->gpu_dptr);
+    else if (entry->cpu_pointer == NULL) {
+        // real gpu memory (goes back to the device cache)
+        ret = devcache_free (&ctx->dev_cache, entry->gpu_dptr,
+                             entry->block_size, entry->size);
         entry->gpu_pointer = NULL;
     } else {
-        // pinned cpu memory
-        ret = cuMemFreeHost (entry->cpu_pointer);
+        // pinned cpu memory (goes back to the pinned arena)
+        ret = pinarena_free (&ctx->pin_arena, entry->cpu_pointer, entry->block_size);
         entry->gpu_pointer = NULL;
         entry->cpu_pointer = NULL;
     }
 
+    if (tuning) {
+        // only a plan draft being tuned is charged for its allocations
+        add_alloc_time (ctx, t0);
+        pthread_mutex_unlock (&ctx->tune_lock);
+    }
+    // inloop entries from the loaded plan can now be reused
+    else if (entry->inloop &&
+             plan_index_lookup (&ctx->plan_index, entry->id) == entry) {
+        plan_index_push_inloop (&ctx->plan_index, entry);
+    }
+    // allocations that weren't in the plan are done with
+    else if (entry->id < 0) {
+        free (entry);
+    }
+
     // Morph CUDA Driver return codes into CUDA Runtime codes
     switch (ret)
     {
@@ -211,9 +319,10 @@ cudaFree (void *devPtr)
     case CUDA_ERROR_DEINITIALIZED:
     case CUDA_ERROR_NOT_INITIALIZED:
         return (cudaErrorInitializationError);
+    case CUDA_ERROR_OUT_OF_MEMORY:
+        return (cudaErrorMemoryAllocation);
     case CUDA_ERROR_INVALID_CONTEXT:
     case CUDA_ERROR_INVALID_VALUE:
-    case CUDA_ERROR_OUT_OF_MEMORY:
     default:
         return (cudaErrorInvalidDevicePointer);
     }
@@ -232,26 +341,19 @@ alloc_mem_host (cuzmem_plan* entry, size_t size)
     CUresult ret;
     CUdeviceptr dev_mem;
     void* host_mem = NULL;
+    CUZMEM_CONTEXT ctx = get_context();
 
-    // allocate pinned host memory
-    ret = cuMemHostAlloc ((void **)&host_mem, size,
-            CU_MEMHOSTALLOC_PORTABLE |
-            CU_MEMHOSTALLOC_DEVICEMAP |
-            CU_MEMHOSTALLOC_WRITECOMBINED);
+    // carve mapped pinned host memory out of the pinned arena
+    ret = pinarena_alloc (&ctx->pin_arena, &host_mem, &dev_mem, &entry->block_size, size);
     if (ret != CUDA_SUCCESS) {
         fprintf (stderr, "libcuzmem: failed to pin cpu memory [%i]\n", ret);
         return CUDA_ERROR_INVALID_VALUE;
     };
-    ret = cuMemHostGetDevicePointer (&dev_mem, host_mem, 0);
 
     // record in entry for cudaFree() later on
-    if (ret == CUDA_SUCCESS) {
-        entry->cpu_pointer = (void *)host_mem;
-        entry->gpu_pointer = (void *)dev_mem;
-        entry->gpu_dptr = dev_mem;
-    } else {
-        fprintf (stderr, "libcuzmem: failed to map pinned cpu memory\n");
-    }
+    entry->cpu_pointer = (void *)host_mem;
+    entry->gpu_pointer = (void *)dev_mem;
+    entry->gpu_dptr = dev_mem;
 
 #if defined (DEBUG)
         fprintf (stderr, "libcuzmem: alloc %i B (pinned) [%p]\n", (int)size, entry->gpu_pointer);
@@ -261,15 +363,80 @@ alloc_mem_host (cuzmem_plan* entry, size_t size)
 }
 
 
+// hand an entry's kept backing back to the device cache / pinned arena
+void
+release_entry_kept_mem (CUZMEM_CONTEXT ctx, cuzmem_plan* entry)
+{
+    if (entry->kept_loc == 1) {
+        __sync_sub_and_fetch (&ctx->kept_dev_bytes, entry->kept_block_size);
+        devcache_free (&ctx->dev_cache, (CUdeviceptr)entry->kept_gpu_pointer,
+                       entry->kept_block_size, entry->size);
+    } else {
+        pinarena_free (&ctx->pin_arena, entry->kept_cpu_pointer,
+                       entry->kept_block_size);
+    }
+    entry->kept_gpu_pointer = NULL;
+    entry->kept_cpu_pointer = NULL;
+}
+
+
+// retain mode: entry is being cudaFree()ed, but hang on to its backing
+void
+keep_mem (cuzmem_plan* entry)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    entry->kept_gpu_pointer = entry->gpu_pointer;
+    entry->kept_cpu_pointer = entry->cpu_pointer;
+    entry->kept_block_size = entry->block_size;
+    entry->kept_loc = (entry->cpu_pointer == NULL) ? 1 : 0;
+    if (entry->kept_loc == 1) {
+        // the cache books this block as live; keep it that way
+        __sync_add_and_fetch (&ctx->kept_dev_bytes, entry->block_size);
+    }
+
+    entry->gpu_pointer = NULL;
+    entry->cpu_pointer = NULL;
+}
+
+
+// release every kept backing of the plan draft in location loc
+// (-1 for all locations).  returns # of bytes released.
+size_t
+release_kept_mem (CUZMEM_CONTEXT ctx, int loc)
+{
+    size_t released = 0;
+    cuzmem_plan* entry;
+
+    for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+        if (entry->kept_gpu_pointer != NULL &&
+            (loc == -1 || entry->kept_loc == loc)) {
+            released += entry->kept_block_size;
+            release_entry_kept_mem (ctx, entry);
+        }
+    }
+
+    return released;
+}
+
+
 // handles actual process of device memory allocation
 CUresult
 alloc_mem_device (cuzmem_plan* entry, size_t size)
 {
     CUresult ret;
     CUdeviceptr dev_mem;
+    CUZMEM_CONTEXT ctx = get_context();
 
-    // allocate gpu global memory
-    ret = cuMemAlloc (&dev_mem, (unsigned int)size);
+    // allocate gpu global memory (reusing a cached block if we can)
+    ret = devcache_alloc (&ctx->dev_cache, &dev_mem, &entry->block_size, size);
+
+    // retain mode: device blocks kept for knobs that haven't come around
+    // yet this iteration may be what is in the way
+    if (ret != CUDA_SUCCESS && ctx->kept_dev_bytes > 0 &&
+        release_kept_mem (ctx, 1) > 0) {
+        ret = devcache_alloc (&ctx->dev_cache, &dev_mem, &entry->block_size, size);
+    }
 
     // record in entry entry for cudaFree() later on
     if (ret == CUDA_SUCCESS) {
@@ -287,12 +454,35 @@ alloc_mem_device (cuzmem_plan* entry, size_t size)
 }
 
 
-// wrapper for memory allocation handlers
-CUresult
-alloc_mem (cuzmem_plan* entry, size_t size)
+// places an entry's allocation (see alloc_mem())
+static CUresult
+place_mem (CUZMEM_CONTEXT ctx, cuzmem_plan* entry, size_t size)
 {
     CUresult ret;
 
+    // did this entry keep its backing from the last tuning iteration?
+    if (entry->kept_gpu_pointer != NULL) {
+        if (entry->kept_loc == entry->loc && entry->kept_block_size >= size) {
+            // same placement: just hand it back out
+            entry->gpu_pointer = entry->kept_gpu_pointer;
+            entry->cpu_pointer = entry->kept_cpu_pointer;
+            entry->gpu_dptr = (CUdeviceptr)entry->kept_gpu_pointer;
+            entry->block_size = entry->kept_block_size;
+            entry->kept_gpu_pointer = NULL;
+            entry->kept_cpu_pointer = NULL;
+            if (entry->loc == 1) {
+                __sync_sub_and_fetch (&ctx->kept_dev_bytes, entry->block_size);
+            }
+            entry->alloc_stamp = __sync_add_and_fetch (&ctx->clock, 1);
+            ptrmap_insert (&ctx->ptr_map, entry->gpu_pointer, entry);
+#if defined (DEBUG)
+            fprintf (stderr, "libcuzmem: alloc %i B (kept) [%p]\n", (int)size, entry->gpu_pointer);
+#endif
+            return CUDA_SUCCESS;
+        }
+        release_entry_kept_mem (ctx, entry);
+    }
+
     if (entry->loc == 1) {
         ret = alloc_mem_device (entry, size);
     }
@@ -305,6 +495,81 @@ alloc_mem (cuzmem_plan* entry, size_t size)
         exit (1);
     }
 
+    // index the new pointer so cudaFree() can find its entry
+    if (ret == CUDA_SUCCESS) {
+        entry->alloc_stamp = __sync_add_and_fetch (&ctx->clock, 1);
+        ptrmap_insert (&ctx->ptr_map, entry->gpu_pointer, entry);
+    }
+
+    return ret;
+}
+
+
+// wrapper for memory allocation handlers
+CUresult
+alloc_mem (cuzmem_plan* entry, size_t size)
+{
+    CUresult ret;
+    CUZMEM_CONTEXT ctx = get_context();
+    int tuning = (CUZMEM_TUNE == ctx->op_mode);
+    double t0 = tuning ? get_time () : 0.0;
+
+    ret = place_mem (ctx, entry, size);
+
+    // only a plan draft being tuned is charged for its allocations (not
+    // for waiting on the tune lock or the tuner's own walks)
+    if (tuning) {
+        add_alloc_time (ctx, t0);
+    }
+
+    return ret;
+}
+
+
+// GPU memory info as the tuners should see it: blocks sitting in the
+// device cache are free as far as any plan is concerned
+CUresult
+get_gpu_mem_info (unsigned int* free, unsigned int* total)
+{
+    CUresult ret;
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ret = cuMemGetInfo (free, total);
+    if (ret == CUDA_SUCCESS) {
+        *free += (unsigned int)ctx->dev_cache.stats.cached_bytes;
+        *free += (unsigned int)ctx->kept_dev_bytes;
+    }
+
+    return ret;
+}
+
+
+// describes device dev (for picking plans)
+CUresult
+get_device_fingerprint (cuzmem_device_fp* fp, CUdevice dev)
+{
+    CUresult ret;
+    size_t total_mem;
+
+    memset (fp, 0, sizeof(cuzmem_device_fp));
+
+    ret = cuDeviceGetName (fp->name, sizeof(fp->name), dev);
+    if (ret == CUDA_SUCCESS) {
+        // (_v2: the original call wraps above 4 GB)
+        ret = cuDeviceTotalMem_v2 (&total_mem, dev);
+        fp->total_mem = total_mem;
+    }
+    if (ret == CUDA_SUCCESS) {
+        ret = cuDeviceComputeCapability (&fp->cc_major, &fp->cc_minor, dev);
+    }
+    if (ret == CUDA_SUCCESS) {
+        ret = cuDriverGetVersion (&fp->driver_version);
+    }
+    if (ret != CUDA_SUCCESS) {
+        // unknown device: plans will not be matched to it
+        memset (fp, 0, sizeof(cuzmem_device_fp));
+    }
+
     return ret;
 }
 
@@ -328,6 +593,7 @@ void
 cuzmem_start (enum cuzmem_op_mode m, CUdevice cuda_dev)
 {
     CUZMEM_CONTEXT ctx = get_context();
+    size_t gpu_mem_min, gpu_mem_max;
 
     // we handle CUDA context stuff here
     if (ctx->tune_iter == 0) {
@@ -342,20 +608,64 @@ cuzmem_start (enum cuzmem_op_mode m, CUdevice cuda_dev)
         if (ret != CUDA_SUCCESS) {
             // 2nd: if a CUDA runtime generated context does not
             //      exist, we will simply create one
-            cuCtxCreate (&(ctx->cuda_context), CU_CTX_SCHED_AUTO | CU_CTX_MAP_HOST, cuda_dev);
+            //      (on this process's own gpu in a coordinated tuning session)
+            cuCtxCreate (&(ctx->cuda_context), CU_CTX_SCHED_AUTO | CU_CTX_MAP_HOST,
+                         queue_device (&ctx->queue, cuda_dev));
+        }
+
+        // plans are read & written for the device we ended up on
+        if (cuCtxGetDevice (&cuda_dev) == CUDA_SUCCESS) {
+            get_device_fingerprint (&ctx->device, cuda_dev);
         }
     }
 
     // This state info is modified for all tuners.
     ctx->current_knob = 0;
     ctx->op_mode = m;
+    ctx->alloc_ns = 0;
 
     if (CUZMEM_RUN == ctx->op_mode) {
-        ctx->plan = read_plan (ctx->project_name, ctx->plan_name);
+        ctx->plan = read_plan (ctx->project_name, ctx->plan_name, &ctx->device);
+        plan_index_build (&ctx->plan_index, ctx->plan);
+        ctx->num_stray = 0;
+
+        // online tuning: maybe try a perturbed placement this time
+        // (one that fits in what gpu memory is free now)
+        gpu_mem_max = 0;
+        if (ctx->online.budget > 0.0f && ctx->plan != NULL) {
+            gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
+        }
+        online_start (&ctx->online, ctx->plan, gpu_mem_max);
+        ctx->start_time = get_time ();
+        timer_start (&ctx->timer);
     }
     // Invoke Tuner's "Start of Plan" routine.
+    // (unless we are just running the same plan draft again to get
+    //  another measurement of it)
     else if (CUZMEM_TUNE == ctx->op_mode) {
-        ctx->call_tuner (CUZMEM_TUNER_START, NULL);
+        pthread_mutex_lock (&ctx->tune_lock);
+
+        if (ctx->tune_iter == 0) {
+            // coordinated tuning: a worker runs what the leader offers
+            queue_open (&ctx->queue, ctx->project_name, ctx->plan_name);
+            if (ctx->queue.role == QUEUE_WORKER) {
+                ctx->call_tuner = cuzmem_tuner_worker;
+                ctx->checkpoint = 0;
+            }
+
+            // pick up an interrupted tuning session where it stopped
+            if (ctx->checkpoint && checkpoint_load (ctx)) {
+                queue_publish (&ctx->queue, ctx->plan, ctx->num_genes);
+            }
+        }
+
+        if (ctx->fitness.repeat) {
+            ctx->start_time = get_time ();
+        } else {
+            ctx->call_tuner (CUZMEM_TUNER_START, NULL);
+        }
+        timer_start (&ctx->timer);
+        pthread_mutex_unlock (&ctx->tune_lock);
     }
     else {
         fprintf (stderr, "libcuzmem: unknown operation mode specified!\n");
@@ -368,14 +678,103 @@ enum cuzmem_op_mode
 cuzmem_end ()
 {
     CUZMEM_CONTEXT ctx = get_context();
+    double elapsed, alloc;
+
+    // wait for the iteration's device work to finish & time it
+    elapsed = timer_stop (&ctx->timer, ctx->start_time);
+    alloc = (double)ctx->alloc_ns / 1e9;
 
     // Ask the selected Tuner Engine what to do.
     if (CUZMEM_TUNE == ctx->op_mode) {
+        pthread_mutex_lock (&ctx->tune_lock);
+
+        // does the plan draft need another run before it is judged?
+        if (fitness_sample (&ctx->fitness, elapsed, alloc, ctx->tune_iter > 0)) {
+            cuzmem_plan* entry;
+            for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+                entry->first_hit = 1;
+            }
+            ctx->current_knob = 0;
+            pthread_mutex_unlock (&ctx->tune_lock);
+            return ctx->op_mode;
+        }
+
+        fprintf (stderr, "libcuzmem: tune iteration %u: %f s (%f s of it allocating, %u run%s)\n",
+                ctx->tune_iter,
+                fitness_time (&ctx->fitness) + ((ctx->fitness.profile == CUZMEM_PROFILE_SERVICE) ?
+                                                fitness_alloc_time (&ctx->fitness) : 0.0),
+                fitness_alloc_time (&ctx->fitness),
+                ctx->fitness.n, (ctx->fitness.n == 1) ? "" : "s");
+
+        // the 0th cycle's free lists are done with
+        if (ctx->tune_iter == 0) {
+            plan_index_destroy (&ctx->trace_free);
+            plan_index_init (&ctx->trace_free);
+        }
+
+        // remember what the placement that really ran measured
+        if (ctx->tune_iter > 0) {
+            cuzmem_bitset* realized = bitset_create (ctx->num_genes);
+            memo_store (&ctx->memo, genome_from_plan (ctx, realized) ? NULL : realized,
+                        fitness_time (&ctx->fitness));
+            bitset_destroy (realized);
+        }
+
         ctx->call_tuner (CUZMEM_TUNER_END, NULL);
+        fitness_commit (&ctx->fitness);
         ctx->tune_iter++;
+
+        // the search space is known: workers may join now
+        if (CUZMEM_TUNE == ctx->op_mode) {
+            queue_publish (&ctx->queue, ctx->plan, ctx->num_genes);
+        }
+
+        if (ctx->checkpoint) {
+            if (CUZMEM_TUNE == ctx->op_mode) {
+                checkpoint_save (ctx);
+            } else {
+                checkpoint_remove (ctx);
+            }
+        }
+
+        // tuning is over: nothing left to keep backing around for
+        if (CUZMEM_RUN == ctx->op_mode) {
+            cuzmem_bitset* final_genome = NULL;
+
+            // ...or to coordinate
+            if (ctx->num_genes > 0) {
+                final_genome = bitset_create (ctx->num_genes);
+                genome_from_plan (ctx, final_genome);
+            }
+            queue_finish (&ctx->queue, ctx->plan, final_genome);
+            bitset_destroy (final_genome);
+
+            fitness_report (&ctx->fitness, stderr);
+            memo_report (&ctx->memo, stderr);
+            queue_report (&ctx->queue, stderr);
+            release_kept_mem (ctx, -1);
+        }
+        pthread_mutex_unlock (&ctx->tune_lock);
     }
 
     if (CUZMEM_RUN == ctx->op_mode) {
+        // online tuning: score the placement this run used
+        if (online_end (&ctx->online, ctx->plan, elapsed)) {
+            write_plan (ctx->plan, ctx->project_name, ctx->plan_name, &ctx->device);
+        }
+
+        if (getenv ("CUZMEM_CACHE_STATS")) {
+            devcache_report (&ctx->dev_cache, stderr);
+            pinarena_report (&ctx->pin_arena, stderr);
+        }
+
+        // cached blocks belong to the CUDA context, so they go first
+        devcache_trim (&ctx->dev_cache, 0);
+        pinarena_trim (&ctx->pin_arena);
+
+        // so do the timing events
+        timer_destroy (&ctx->timer);
+
         // we are done with the CUDA context.  if it
         // was created by us, we need to destry it.
         if (ctx->cuda_context != NULL) {
@@ -429,17 +828,200 @@ cuzmem_set_tuner (enum cuzmem_tuner t)
     case CUZMEM_EXHAUSTIVE:
         ctx->call_tuner = cuzmem_tuner_exhaust;
         break;
+    case CUZMEM_GREEDY:
+        ctx->call_tuner = cuzmem_tuner_greedy;
+        break;
+    case CUZMEM_ANNEALING:
+        ctx->call_tuner = cuzmem_tuner_anneal;
+        break;
+    case CUZMEM_SURROGATE:
+        ctx->call_tuner = cuzmem_tuner_surrogate;
+        break;
     case CUZMEM_GENETIC:
     default:
+        t = CUZMEM_GENETIC;
         ctx->call_tuner = cuzmem_tuner_genetic;
     }
+    ctx->tuner = t;
+}
+
+// Used to cap the amount of free GPU memory held for reuse
+// (0 disables the device cache)
+void
+cuzmem_set_cache_limit (size_t bytes)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->dev_cache.limit = bytes;
+    devcache_trim (&ctx->dev_cache, bytes);
+}
+
+// Used to give cached GPU memory back to the CUDA driver
+void
+cuzmem_trim_cache (size_t keep)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    devcache_trim (&ctx->dev_cache, keep);
+}
+
+// Used to retrieve device cache hit rate & fragmentation
+void
+cuzmem_get_cache_stats (struct cuzmem_cache_stats* stats)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    *stats = ctx->dev_cache.stats;
+}
+
+// Used to keep each knob's memory between tuning iterations, so
+// that only knobs whose placement changes are reallocated
+void
+cuzmem_set_retain (int retain)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->retain = retain;
+}
+
+// Selects how knobs are grouped into genes for tuning (must be set
+// before the 0th tuning iteration ends)
+void
+cuzmem_set_grouping (enum cuzmem_grouping g)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->grouping = g;
 }
 
-// Used to see if a specific plan exists for a given project
+// Used to see if a specific plan suitable for this machine's GPU
+// exists for a given project.  The GPU is that of the current CUDA
+// context if there is one, device 0 otherwise.
 int
 cuzmem_check_plan (const char* project, const char* plan)
 {
-    return check_plan (project, plan);
+    CUdevice dev;
+    cuzmem_device_fp fp;
+
+    cuInit (0);
+    if (cuCtxGetDevice (&dev) != CUDA_SUCCESS &&
+        cuDeviceGet (&dev, 0) != CUDA_SUCCESS) {
+        return check_plan (project, plan, NULL);
+    }
+    get_device_fingerprint (&fp, dev);
+
+    return check_plan (project, plan, &fp);
+}
+
+// Used to say how the tuned plan will be deployed: as a one-shot job
+// (time spent allocating counts against a plan) or as a long running
+// service (it is left out)
+void
+cuzmem_set_profile (enum cuzmem_profile p)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->fitness.profile = p;
+    ctx->sim.alloc = (p != CUZMEM_PROFILE_SERVICE);
+}
+
+// Used to set the genetic tuner's search parameters (before tuning
+// starts): # of generations, candidates per generation, fraction of
+// them carried over, chance an offspring is mutated, and the fraction
+// of free gpu memory the 1st generation must use
+void
+cuzmem_set_genetic (unsigned int generations, unsigned int population,
+                    float elite, float mutation, float min_gpu_mem)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->genetic.generations = generations;
+    ctx->genetic.population = population;
+    ctx->genetic.elite = elite;
+    ctx->genetic.mutation = mutation;
+    ctx->genetic.min_gpu_mem = min_gpu_mem;
+}
+
+// Used to stop the genetic tuner early once this many generations in a
+// row haven't improved on the best candidate (0: never stop early)
+void
+cuzmem_set_genetic_stall (unsigned int generations)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->genetic.stall = generations;
+}
+
+// Used to seed the genetic tuner's random numbers (for repeatable runs)
+void
+cuzmem_set_genetic_seed (unsigned long long seed)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->genetic.seed = seed;
+}
+
+// Used to have the genetic tuner simulate this many drafts (replaying
+// the 0th iteration's allocation trace) for every candidate it runs,
+// and run the one predicted to be fastest (1: no screening)
+void
+cuzmem_set_genetic_screen (unsigned int drafts)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->genetic.screen = drafts;
+}
+
+// Used to turn saving the tuning state after every iteration on or off
+// (on by default).  An interrupted tuning session then resumes where
+// it stopped when the application is run again.
+void
+cuzmem_set_checkpoint (int checkpoint)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->checkpoint = checkpoint;
+}
+
+// Used to turn writing the 0th tuning iteration's allocations to
+// ~/.project/plan.trace on or off (on by default).  cuzmem-sim replays
+// the trace to rank placements without a gpu.
+void
+cuzmem_set_trace (int trace)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->trace.enabled = trace;
+}
+
+// Used to take part in a coordinated tuning session: rank 0 leads
+// (runs the tuner), ranks 1.. run the candidates it offers, each on
+// gpu (rank % # of gpus).  A negative rank tunes alone (the default).
+// Every process must run the same application, project & plan.
+void
+cuzmem_set_queue (int rank)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    if (rank < 0) {
+        ctx->queue.role = QUEUE_OFF;
+        ctx->queue.rank = 0;
+    } else {
+        ctx->queue.role = rank ? QUEUE_WORKER : QUEUE_LEADER;
+        ctx->queue.rank = (unsigned int)rank;
+    }
+}
+
+// Used to let RUN mode spend up to a fraction of invocations trying
+// perturbed placements, keeping (and saving) ones that are faster
+// (0 disables online tuning)
+void
+cuzmem_set_online (float budget)
+{
+    CUZMEM_CONTEXT ctx = get_context();
+
+    ctx->online.budget = budget;
+    ctx->online.rate = budget;
 }
 
 // Used to set the mimimum GPU global memory utilization
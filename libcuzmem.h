@@ -26,13 +26,49 @@
 enum cuzmem_tuner_action {
     CUZMEM_TUNER_START,
     CUZMEM_TUNER_LOOKUP,
-    CUZMEM_TUNER_END
+    CUZMEM_TUNER_END,
+    CUZMEM_TUNER_SAVE,          // parm: cuzmem_ckpt* to write tuner state to
+    CUZMEM_TUNER_LOAD,          // parm: cuzmem_ckpt* to read it back from
+    CUZMEM_TUNER_DROP           // forget what a damaged checkpoint loaded
 };
 
 enum cuzmem_tuner {
     CUZMEM_NOTUNE,
     CUZMEM_GENETIC,
-    CUZMEM_EXHAUSTIVE
+    CUZMEM_EXHAUSTIVE,
+    CUZMEM_GREEDY,          // sensitivity sweep + knapsack
+    CUZMEM_ANNEALING,       // simulated annealing from the trace plan
+    CUZMEM_SURROGATE        // model guided (expected improvement)
+};
+
+// which knobs share a gene (are always placed together)
+enum cuzmem_grouping {
+    CUZMEM_GROUP_NONE,      // every allocation is its own knob
+    CUZMEM_GROUP_SITE,      // allocations from the same call site
+    CUZMEM_GROUP_SIZE       // allocations in the same size class
+};
+
+// what the tuned plan will be deployed as (decides whether the time
+// libcuzmem spends allocating counts against a plan while tuning)
+enum cuzmem_profile {
+    CUZMEM_PROFILE_ONESHOT,     // runs once: allocation cost is part of the job
+    CUZMEM_PROFILE_SERVICE      // long running: allocation cost amortizes away
+};
+// -----------------------------------------------
+
+
+// -- Device memory cache statistics -------------
+// hit rate      = hits / (hits + misses)
+// internal frag = 1 - live_bytes / live_block_bytes
+// idle memory   = cached_bytes (free blocks held for reuse)
+struct cuzmem_cache_stats {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long trimmed;     // cached blocks given back to the driver
+    size_t cached_bytes;
+    size_t peak_cached_bytes;
+    size_t live_bytes;              // bytes requested by live allocations
+    size_t live_block_bytes;        // bytes actually backing them
 };
 // -----------------------------------------------
 
@@ -83,6 +119,66 @@ extern "C" {
         void cuzmem_set_tuner,
             enum cuzmem_tuner t
     );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_grouping,
+            enum cuzmem_grouping g
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_profile,
+            enum cuzmem_profile p
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_genetic,
+            unsigned int generations,
+            unsigned int population,
+            float elite,
+            float mutation,
+            float min_gpu_mem
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_genetic_stall,
+            unsigned int generations
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_genetic_seed,
+            unsigned long long seed
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_genetic_screen,
+            unsigned int drafts
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_checkpoint,
+            int checkpoint
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_trace,
+            int trace
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_queue,
+            int rank
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_online,
+            float budget
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_retain,
+            int retain
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_set_cache_limit,
+            size_t bytes
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_trim_cache,
+            size_t keep
+    );
+    MAKE_CUZMEM_API (
+        void cuzmem_get_cache_stats,
+            struct cuzmem_cache_stats* stats
+    );
 #if defined __cplusplus
 };
 #endif
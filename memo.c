@@ -0,0 +1,251 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "memo.h"
+
+// NOTES
+//
+// * Tuners often draft a placement that has already been measured: the
+//   genetic tuner carries its elites over and breeds offspring equal to
+//   a parent, and alloc_mem() falling back to pinned memory turns drafts
+//   into placements run before.  Before a tuner spends an application
+//   run on a draft it asks memo_lookup(); on a hit it takes the stored
+//   fitness and moves on to its next draft.
+//
+// * cuzmem_end() stores every measured candidate under the placement
+//   that was actually realized (after any fallback), and, if that
+//   differs, under the draft that was last looked up and missed (the
+//   one just run) too.  Such a draft will fall back the same way if it
+//   is run again, so its hit is the realized placement's fitness; it
+//   comes back as MEMO_DRAFTED so a tuner can tell.
+//
+// * A fallback can move only some members of a grouped gene.  No genome
+//   describes that placement (see genome_from_plan()), so only the draft
+//   is stored.
+//
+// * The 0th (trace) iteration is never stored.  A memo hit still uses up
+//   a tuning iteration, which keeps every search bounded by
+//   tune_iter_max even when it keeps drafting the same placements.
+//
+// * Linear probing, no removal.  Only used under the context's tune_lock.
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static unsigned long long
+genome_hash (const cuzmem_bitset* b)
+{
+    unsigned int i;
+    unsigned long long h = 0xCBF29CE484222325ULL ^ b->nbits;
+
+    for (i=0; i<b->nwords; i++) {
+        h = (h ^ b->w[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+
+// slot holding genome, or the empty slot it would go in
+static unsigned int
+memo_slot (const cuzmem_memo* m, const cuzmem_bitset* genome, unsigned long long h)
+{
+    unsigned int i = (unsigned int)(h >> 32) & (m->capacity - 1);
+
+    while (m->keys[i] != NULL) {
+        if (m->hash[i] == h && bitset_equal (m->keys[i], genome)) {
+            break;
+        }
+        i = (i + 1) & (m->capacity - 1);
+    }
+    return i;
+}
+
+
+static void
+memo_rebuild (cuzmem_memo* m, unsigned int capacity)
+{
+    unsigned int i, j;
+    cuzmem_bitset** old_keys = m->keys;
+    unsigned long long* old_hash = m->hash;
+    double* old_time = m->time;
+    unsigned char* old_kind = m->kind;
+    unsigned int old_capacity = m->capacity;
+
+    m->keys = (cuzmem_bitset**)calloc (capacity, sizeof(cuzmem_bitset*));
+    m->hash = (unsigned long long*)calloc (capacity, sizeof(unsigned long long));
+    m->time = (double*)calloc (capacity, sizeof(double));
+    m->kind = (unsigned char*)calloc (capacity, sizeof(unsigned char));
+    if (!m->keys || !m->hash || !m->time || !m->kind) {
+        fprintf (stderr, "libcuzmem: unable to grow measurement memo!\n");
+        exit (1);
+    }
+    m->capacity = capacity;
+
+    for (i=0; i<old_capacity; i++) {
+        if (old_keys[i] == NULL) {
+            continue;
+        }
+        j = memo_slot (m, old_keys[i], old_hash[i]);
+        m->keys[j] = old_keys[i];
+        m->hash[j] = old_hash[i];
+        m->time[j] = old_time[i];
+        m->kind[j] = old_kind[i];
+    }
+
+    free (old_keys);
+    free (old_hash);
+    free (old_time);
+    free (old_kind);
+}
+
+
+// stores a fitness under genome (a DRAFTED one never replaces a REALIZED)
+void
+memo_insert (cuzmem_memo* m, const cuzmem_bitset* genome, double time, int kind)
+{
+    unsigned int i;
+    unsigned long long h = genome_hash (genome);
+
+    if ((m->count + 1) * 4 > m->capacity * 3) {
+        memo_rebuild (m, m->capacity ? 2 * m->capacity : MEMO_MIN_CAPACITY);
+    }
+
+    i = memo_slot (m, genome, h);
+    if (m->keys[i] == NULL) {
+        m->keys[i] = bitset_clone (genome);
+        m->hash[i] = h;
+        m->count++;
+    }
+    else if (kind == MEMO_DRAFTED && m->kind[i] == MEMO_REALIZED) {
+        // what was really run beats what a draft turned into
+        return;
+    }
+    m->time[i] = time;
+    m->kind[i] = (unsigned char)kind;
+}
+
+
+//------------------------------------------------------------------------------
+// MEASUREMENT MEMO INTERFACE
+//------------------------------------------------------------------------------
+void
+memo_init (cuzmem_memo* m)
+{
+    memset (m, 0, sizeof(cuzmem_memo));
+}
+
+
+void
+memo_destroy (cuzmem_memo* m)
+{
+    unsigned int i;
+
+    for (i=0; i<m->capacity; i++) {
+        if (m->keys[i] != NULL) {
+            bitset_destroy (m->keys[i]);
+        }
+    }
+    free (m->keys);
+    free (m->hash);
+    free (m->time);
+    free (m->kind);
+    if (m->pending != NULL) {
+        bitset_destroy (m->pending);
+    }
+    memset (m, 0, sizeof(cuzmem_memo));
+}
+
+
+// what the memo knows about genome, without counting it as a lookup
+int
+memo_find (const cuzmem_memo* m, const cuzmem_bitset* genome, double* time)
+{
+    unsigned int i;
+
+    if (m->capacity != 0) {
+        i = memo_slot (m, genome, genome_hash (genome));
+        if (m->keys[i] != NULL) {
+            *time = m->time[i];
+            return m->kind[i];
+        }
+    }
+    return MEMO_MISS;
+}
+
+
+// looks up the fitness measured for a draft.  returns MEMO_MISS if the
+// draft has to be run (and remembers it as the one about to be)
+int
+memo_lookup (cuzmem_memo* m, const cuzmem_bitset* genome, double* time)
+{
+    int hit = memo_find (m, genome, time);
+
+    if (hit != MEMO_MISS) {
+        m->hits++;
+        return hit;
+    }
+
+    m->misses++;
+    if (m->pending != NULL && m->pending->nbits != genome->nbits) {
+        bitset_destroy (m->pending);
+        m->pending = NULL;
+    }
+    if (m->pending == NULL) {
+        m->pending = bitset_clone (genome);
+    } else {
+        bitset_copy (m->pending, genome);
+    }
+    return MEMO_MISS;
+}
+
+
+// records the fitness of the placement that was just run (realized is
+// NULL if no genome describes it: only the draft is recorded then)
+void
+memo_store (cuzmem_memo* m, const cuzmem_bitset* realized, double time)
+{
+    if (realized != NULL) {
+        memo_insert (m, realized, time, MEMO_REALIZED);
+    }
+
+    if (m->pending != NULL) {
+        if (realized == NULL ||
+            (m->pending->nbits == realized->nbits && !bitset_equal (m->pending, realized))) {
+            memo_insert (m, m->pending, time, MEMO_DRAFTED);
+        }
+        bitset_destroy (m->pending);
+        m->pending = NULL;
+    }
+}
+
+
+void
+memo_report (const cuzmem_memo* m, FILE* fp)
+{
+    unsigned long long n = m->hits + m->misses;
+
+    if (n == 0) {
+        return;
+    }
+    fprintf (fp, "libcuzmem: measurement memo: %llu hits, %llu misses (%.1f%% of runs saved), %u placements\n",
+            m->hits, m->misses, 100.0 * m->hits / n, m->count);
+}
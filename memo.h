@@ -0,0 +1,82 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _memo_h_
+#define _memo_h_
+
+#include <stdio.h>
+#include "bitset.h"
+
+#define MEMO_MIN_CAPACITY 64
+
+// what memo_lookup() found
+enum cuzmem_memo_hit {
+    MEMO_MISS,
+    MEMO_REALIZED,              // a placement that was actually run
+    MEMO_DRAFTED                // a draft that ran as another placement
+};
+
+// -- Measurement Memo structure -----------------
+// open addressed hash table: placement genome -> measured fitness
+typedef struct cuzmem_memo_struct cuzmem_memo;
+struct cuzmem_memo_struct
+{
+    cuzmem_bitset** keys;
+    unsigned long long* hash;
+    double* time;
+    unsigned char* kind;        // enum cuzmem_memo_hit
+    unsigned int capacity;      // always a power of 2
+    unsigned int count;
+
+    cuzmem_bitset* pending;     // draft last looked up & not found
+
+    unsigned long long hits;
+    unsigned long long misses;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+memo_init (cuzmem_memo* m);
+
+void
+memo_destroy (cuzmem_memo* m);
+
+int
+memo_find (const cuzmem_memo* m, const cuzmem_bitset* genome, double* time);
+
+int
+memo_lookup (cuzmem_memo* m, const cuzmem_bitset* genome, double* time);
+
+void
+memo_store (cuzmem_memo* m, const cuzmem_bitset* realized, double time);
+
+void
+memo_insert (cuzmem_memo* m, const cuzmem_bitset* genome, double time, int kind);
+
+void
+memo_report (const cuzmem_memo* m, FILE* fp);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,355 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "online.h"
+
+//#define DEBUG
+
+// NOTES
+//
+// * Online tuning for applications that never get a separate tuning
+//   phase.  Each RUN mode invocation (cuzmem_start() to cuzmem_end())
+//   is one pull of a two armed bandit: the incumbent (the stored plan)
+//   or a challenger (the incumbent with 1 or 2 genes flipped).
+//
+// * At most budget of the runs explore.  A challenger gets
+//   ONLINE_TRIALS runs and is then promoted if it beats the incumbent's
+//   mean by more than ONLINE_MARGIN and 2 standard errors.  A promoted
+//   challenger is written out as the plan, so the next process starts
+//   from it.
+//
+// * Each losing challenger halves the exploration rate (down to
+//   budget/ONLINE_MIN_RATE), and a winner restores it.  Once no nearby
+//   placement is better the cost of exploring shrinks geometrically,
+//   which keeps the regret bounded while still noticing if the
+//   workload drifts.
+//
+// * A challenger may not move a gene onto the GPU if that would need
+//   more global memory than is free at cuzmem_start(); such flips are
+//   dropped.  Plans don't record gold members, so a gene is charged
+//   for all of its entries.  A challenger that still had allocations
+//   fall back to pinned memory did not run as drawn, and is thrown out
+//   rather than judged.
+//
+// * Budget comes from cuzmem_set_online() or CUZMEM_ONLINE (e.g. 0.05).
+//   Challengers are drawn from a prng seeded by CUZMEM_ONLINE_SEED
+//   (default 1).  Stats live in memory only.
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static void
+arm_reset (cuzmem_online_arm* a)
+{
+    a->n = 0;
+    a->mean = 0.0;
+    a->m2 = 0.0;
+}
+
+
+static void
+arm_add (cuzmem_online_arm* a, double x)
+{
+    double d = x - a->mean;
+
+    a->n++;
+    a->mean += d / a->n;
+    a->m2 += d * (x - a->mean);
+}
+
+
+// variance of the arm's mean
+static double
+arm_var_mean (const cuzmem_online_arm* a)
+{
+    if (a->n < 2) {
+        return 0.0;
+    }
+    return a->m2 / (a->n - 1) / a->n;
+}
+
+
+static void
+apply_genome (const cuzmem_bitset* genome, cuzmem_plan* plan)
+{
+    cuzmem_plan* entry;
+
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->gene >= 0) {
+            entry->loc = bitset_get (genome, entry->gene);
+        }
+    }
+}
+
+
+// (re)starts from the placement of a freshly loaded plan
+static void
+online_reset (cuzmem_online* o, cuzmem_plan* plan, unsigned int num_genes)
+{
+    cuzmem_plan* entry;
+
+    bitset_destroy (o->incumbent);
+    bitset_destroy (o->challenger);
+    free (o->gene_size);
+    o->num_genes = num_genes;
+    o->incumbent = bitset_create (num_genes);
+    o->challenger = NULL;
+    o->gene_size = (size_t*)calloc (num_genes, sizeof(size_t));
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->gene >= 0) {
+            bitset_set (o->incumbent, entry->gene, entry->loc);
+            o->gene_size[entry->gene] += entry->size;
+        }
+    }
+    arm_reset (&o->inc);
+    arm_reset (&o->chal);
+    o->rate = o->budget;
+}
+
+
+// GPU global memory a placement would use at most
+static size_t
+genome_gpu_bytes (const cuzmem_online* o, const cuzmem_bitset* genome)
+{
+    unsigned int g;
+    size_t bytes = 0;
+
+    for (g=0; g<o->num_genes; g++) {
+        if (bitset_get (genome, g)) {
+            bytes += o->gene_size[g];
+        }
+    }
+    return bytes;
+}
+
+
+// flips gene g of the challenger, unless that moves it onto the GPU
+// past max.  returns 1 if flipped
+static int
+flip_within (cuzmem_online* o, unsigned int g, size_t* bytes, size_t max)
+{
+    if (bitset_get (o->challenger, g)) {
+        *bytes -= o->gene_size[g];
+    }
+    else if (*bytes + o->gene_size[g] < max) {
+        *bytes += o->gene_size[g];
+    }
+    else {
+        return 0;
+    }
+    bitset_flip (o->challenger, g);
+    return 1;
+}
+
+
+// draws a challenger whose moves onto the GPU fit in max bytes of GPU
+// global memory.  returns 0 if none was found
+static int
+new_challenger (cuzmem_online* o, size_t max)
+{
+    unsigned int g, tries;
+    size_t bytes, inc_bytes = genome_gpu_bytes (o, o->incumbent);
+    int flipped;
+
+    o->challenger = bitset_clone (o->incumbent);
+    for (tries=0; tries<ONLINE_TRIES; tries++) {
+        bytes = inc_bytes;
+        g = prng_below (&o->prng, o->num_genes);
+        flipped = flip_within (o, g, &bytes, max);
+        if (o->num_genes > 1 && prng_uniform (&o->prng) < 0.25) {
+            g = (g + 1 + prng_below (&o->prng, o->num_genes - 1)) % o->num_genes;
+            flipped |= flip_within (o, g, &bytes, max);
+        }
+        if (flipped) {
+            arm_reset (&o->chal);
+            return 1;
+        }
+    }
+
+    bitset_destroy (o->challenger);
+    o->challenger = NULL;
+    return 0;
+}
+
+
+// did every allocation of this run land where the genome put it?
+static int
+ran_as_drawn (const cuzmem_bitset* genome, const cuzmem_plan* plan)
+{
+    const cuzmem_plan* entry;
+
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->gene >= 0 && entry->loc != bitset_get (genome, entry->gene)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// a challenger is done with (it lost or could not be run): explore less
+static void
+drop_challenger (cuzmem_online* o)
+{
+    bitset_destroy (o->challenger);
+    o->challenger = NULL;
+    o->rate *= 0.5f;
+    if (o->rate < o->budget / ONLINE_MIN_RATE) {
+        o->rate = o->budget / ONLINE_MIN_RATE;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// ONLINE TUNING INTERFACE
+//------------------------------------------------------------------------------
+void
+online_init (cuzmem_online* o)
+{
+    char* env = getenv ("CUZMEM_ONLINE");
+
+    memset (o, 0, sizeof(cuzmem_online));
+    o->budget = env ? (float)atof (env) : 0.0f;
+    if (o->budget < 0.0f || o->budget > 1.0f) {
+        fprintf (stderr, "libcuzmem: CUZMEM_ONLINE must be in [0, 1] (online tuning disabled)\n");
+        o->budget = 0.0f;
+    }
+    o->rate = o->budget;
+
+    env = getenv ("CUZMEM_ONLINE_SEED");
+    prng_seed (&o->prng, env ? strtoull (env, NULL, 10) : ONLINE_SEED);
+}
+
+
+void
+online_destroy (cuzmem_online* o)
+{
+    bitset_destroy (o->incumbent);
+    bitset_destroy (o->challenger);
+    free (o->gene_size);
+    o->incumbent = NULL;
+    o->challenger = NULL;
+    o->gene_size = NULL;
+}
+
+
+// picks the arm for this run and sets the plan's locations to match.
+// gpu_mem_max is the GPU global memory a challenger may use
+void
+online_start (cuzmem_online* o, cuzmem_plan* plan, size_t gpu_mem_max)
+{
+    int max_gene = -1;
+    cuzmem_plan* entry;
+
+    o->active = 0;
+    o->exploring = 0;
+    if (o->budget <= 0.0f || plan == NULL) {
+        return;
+    }
+
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->gene > max_gene) {
+            max_gene = entry->gene;
+        }
+    }
+    if (max_gene < 0) {
+        return;
+    }
+    if (o->incumbent == NULL || o->num_genes != (unsigned int)max_gene + 1) {
+        online_reset (o, plan, max_gene + 1);
+    }
+
+    // explore only once the incumbent has a baseline, and only
+    // while within the exploration rate
+    if (o->inc.n >= ONLINE_TRIALS &&
+        (double)o->explore_runs < (double)o->rate * (double)(o->runs + 1)) {
+        if (o->challenger != NULL || new_challenger (o, gpu_mem_max)) {
+            o->exploring = 1;
+        }
+    }
+
+    apply_genome (o->exploring ? o->challenger : o->incumbent, plan);
+    o->active = 1;
+}
+
+
+// records the run time of the arm picked by online_start().  returns 1
+// if the challenger was promoted (the plan's locations are then set to
+// the new incumbent and should be written out)
+int
+online_end (cuzmem_online* o, cuzmem_plan* plan, double time)
+{
+    double diff, se;
+
+    if (!o->active) {
+        return 0;
+    }
+    o->active = 0;
+    o->runs++;
+
+    if (!o->exploring) {
+        arm_add (&o->inc, time);
+        return 0;
+    }
+
+    o->explore_runs++;
+
+    // allocations that fell back to pinned memory ran something else
+    if (!ran_as_drawn (o->challenger, plan)) {
+        fprintf (stderr, "libcuzmem: online: challenger fell back to pinned memory (dropped)\n");
+        drop_challenger (o);
+        return 0;
+    }
+
+    arm_add (&o->chal, time);
+    if (o->chal.n < ONLINE_TRIALS) {
+        return 0;
+    }
+
+    diff = o->inc.mean - o->chal.mean;
+    se = sqrt (arm_var_mean (&o->inc) + arm_var_mean (&o->chal));
+
+#if defined (DEBUG)
+    fprintf (stderr, "libcuzmem: online: challenger %f s vs incumbent %f s (se %f)\n",
+            o->chal.mean, o->inc.mean, se);
+#endif
+
+    if (diff > ONLINE_MARGIN * o->inc.mean && diff > 2.0 * se) {
+        fprintf (stderr, "libcuzmem: online: promoted new plan (%f s -> %f s)\n",
+                o->inc.mean, o->chal.mean);
+
+        bitset_destroy (o->incumbent);
+        o->incumbent = o->challenger;
+        o->challenger = NULL;
+        o->inc = o->chal;
+        o->rate = o->budget;
+        o->promotions++;
+
+        apply_genome (o->incumbent, plan);
+        return 1;
+    }
+
+    // lost: explore less
+    drop_challenger (o);
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _online_h_
+#define _online_h_
+
+#include "plans.h"
+#include "bitset.h"
+#include "prng.h"
+
+#define ONLINE_TRIALS       3       // runs a challenger gets before judgement
+#define ONLINE_MIN_RATE     64      // exploration rate never drops below budget/this
+#define ONLINE_MARGIN       0.02    // least relative speedup a challenger must show
+#define ONLINE_TRIES        8       // draws for a challenger that fits in gpu memory
+#define ONLINE_SEED         1ULL    // default random number seed
+
+// -- Online tuning structures -------------------
+// running mean & variance of one arm's run times (Welford)
+typedef struct cuzmem_online_arm_struct cuzmem_online_arm;
+struct cuzmem_online_arm_struct
+{
+    unsigned long long n;
+    double mean;
+    double m2;
+};
+
+typedef struct cuzmem_online_struct cuzmem_online;
+struct cuzmem_online_struct
+{
+    float budget;               // most runs spent exploring (0: disabled)
+    float rate;                 // current exploration rate (<= budget)
+    unsigned int num_genes;
+    size_t* gene_size;          // bytes of the plan's entries per gene
+    cuzmem_bitset* incumbent;   // best known placement
+    cuzmem_bitset* challenger;  // perturbed placement being tried (or NULL)
+    cuzmem_online_arm inc;
+    cuzmem_online_arm chal;
+    unsigned long long runs;
+    unsigned long long explore_runs;
+    unsigned long long promotions;
+    int active;                 // current run was started by online_start()
+    int exploring;              // current run uses the challenger
+    cuzmem_prng prng;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+online_init (cuzmem_online* o);
+
+void
+online_destroy (cuzmem_online* o);
+
+void
+online_start (cuzmem_online* o, cuzmem_plan* plan, size_t gpu_mem_max);
+
+int
+online_end (cuzmem_online* o, cuzmem_plan* plan, double time);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
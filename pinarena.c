@@ -0,0 +1,382 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cuda.h>
+#include "pinarena.h"
+
+//#define DEBUG
+
+// NOTES
+//
+// * Pinning (and mapping) host pages is one of the most expensive things
+//   you can ask of the CUDA driver.  Rather than pin every zero-copy
+//   allocation separately, we pin a few large regions once and carve
+//   pinned allocations out of them.  The device pointer of a carved out
+//   block is simply the region's mapped device base plus the offset.
+//
+// * Each region keeps a sorted array of free extents.  Allocation is first
+//   fit; freed blocks are merged with their neighbours.
+//
+// * The first region is small (PINARENA_REGION_MIN) and every new one
+//   is twice the size of the last, up to the region size, so a program
+//   with a few pinned allocations doesn't pin 64 MB for them.
+//
+// * Requests larger than the next region's size get a region of their own.
+//
+// * Regions are only given back to the driver by pinarena_trim(), and
+//   only once they are completely free.
+//
+// * If no region can be had (PINARENA_MAX_REGIONS are in use, or the
+//   driver won't pin a whole region) the block is pinned on its own,
+//   like every pinned allocation used to be.  pinarena_free() knows
+//   such a block by it not lying in any region.
+//
+// * The region size comes from CUZMEM_PINNED_REGION (bytes).
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static size_t
+pin_round (size_t size)
+{
+    if (size == 0) {
+        size = 1;
+    }
+    return (size + PINARENA_ALIGN - 1) & ~((size_t)PINARENA_ALIGN - 1);
+}
+
+
+// pin & map a new region (arena->lock must be held)
+static cuzmem_pinregion*
+pinregion_create (cuzmem_pinarena* arena, size_t size)
+{
+    CUresult ret;
+    void* host_mem = NULL;
+    CUdeviceptr dev_mem;
+    cuzmem_pinregion* r;
+
+    if (arena->num_regions >= PINARENA_MAX_REGIONS) {
+        return NULL;
+    }
+
+    ret = cuMemHostAlloc ((void **)&host_mem, size,
+            CU_MEMHOSTALLOC_PORTABLE |
+            CU_MEMHOSTALLOC_DEVICEMAP |
+            CU_MEMHOSTALLOC_WRITECOMBINED);
+    if (ret != CUDA_SUCCESS) {
+        return NULL;
+    }
+
+    ret = cuMemHostGetDevicePointer (&dev_mem, host_mem, 0);
+    if (ret != CUDA_SUCCESS) {
+        cuMemFreeHost (host_mem);
+        return NULL;
+    }
+
+    r = (cuzmem_pinregion*)malloc (sizeof(cuzmem_pinregion));
+    if (r == NULL) {
+        cuMemFreeHost (host_mem);
+        return NULL;
+    }
+    r->host_base = (char*)host_mem;
+    r->dev_base = dev_mem;
+    r->size = size;
+    r->max_free = 16;
+    r->free = (cuzmem_pinextent*)malloc (r->max_free * sizeof(cuzmem_pinextent));
+    if (r->free == NULL) {
+        cuMemFreeHost (host_mem);
+        free (r);
+        return NULL;
+    }
+    r->free[0].offset = 0;
+    r->free[0].size = size;
+    r->num_free = 1;
+    pthread_mutex_init (&r->lock, NULL);
+
+    arena->region[arena->num_regions] = r;
+    arena->pinned_bytes += size;
+    __sync_synchronize ();
+    arena->num_regions++;
+
+#if defined (DEBUG)
+    fprintf (stderr, "libcuzmem: pinned region %i B [%p]\n", (int)size, host_mem);
+#endif
+
+    return r;
+}
+
+
+// pin & map a block of its own (when no region can be had)
+static CUresult
+pin_direct (cuzmem_pinarena* arena, void** host, CUdeviceptr* dptr, size_t need)
+{
+    CUresult ret;
+    void* host_mem = NULL;
+
+    ret = cuMemHostAlloc ((void **)&host_mem, need,
+            CU_MEMHOSTALLOC_PORTABLE |
+            CU_MEMHOSTALLOC_DEVICEMAP |
+            CU_MEMHOSTALLOC_WRITECOMBINED);
+    if (ret != CUDA_SUCCESS) {
+        return ret;
+    }
+
+    ret = cuMemHostGetDevicePointer (dptr, host_mem, 0);
+    if (ret != CUDA_SUCCESS) {
+        cuMemFreeHost (host_mem);
+        return ret;
+    }
+
+    *host = host_mem;
+    __sync_fetch_and_add (&arena->num_direct, 1);
+    __sync_fetch_and_add (&arena->direct_bytes, need);
+    return CUDA_SUCCESS;
+}
+
+
+// first fit within one region.  returns 1 on success
+static int
+pinregion_alloc (cuzmem_pinregion* r, size_t need, size_t* offset)
+{
+    unsigned int i;
+    int found = 0;
+
+    pthread_mutex_lock (&r->lock);
+    for (i=0; i<r->num_free; i++) {
+        if (r->free[i].size >= need) {
+            *offset = r->free[i].offset;
+            r->free[i].offset += need;
+            r->free[i].size -= need;
+            if (r->free[i].size == 0) {
+                memmove (&r->free[i], &r->free[i+1],
+                        (r->num_free - i - 1) * sizeof(cuzmem_pinextent));
+                r->num_free--;
+            }
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&r->lock);
+
+    return found;
+}
+
+
+//------------------------------------------------------------------------------
+// PINNED ARENA INTERFACE
+//------------------------------------------------------------------------------
+void
+pinarena_init (cuzmem_pinarena* arena)
+{
+    char* env = getenv ("CUZMEM_PINNED_REGION");
+
+    memset (arena->region, 0, sizeof(arena->region));
+    arena->num_regions = 0;
+    arena->pinned_bytes = 0;
+    arena->num_direct = 0;
+    arena->direct_bytes = 0;
+    arena->region_size = env ? (size_t)strtoull (env, NULL, 10) : PINARENA_REGION_SIZE;
+    arena->region_size = pin_round (arena->region_size);
+    arena->next_size = (arena->region_size < PINARENA_REGION_MIN) ?
+                        arena->region_size : PINARENA_REGION_MIN;
+    pthread_mutex_init (&arena->lock, NULL);
+}
+
+
+void
+pinarena_destroy (cuzmem_pinarena* arena)
+{
+    pinarena_trim (arena);
+    pthread_mutex_destroy (&arena->lock);
+}
+
+
+// carve a mapped pinned block out of the arena
+CUresult
+pinarena_alloc (cuzmem_pinarena* arena, void** host, CUdeviceptr* dptr, size_t* block_size, size_t size)
+{
+    unsigned int i, n;
+    size_t offset, need = pin_round (size);
+    cuzmem_pinregion* r = NULL;
+
+    // try the regions we already have
+    n = arena->num_regions;
+    for (i=0; i<n; i++) {
+        if (pinregion_alloc (arena->region[i], need, &offset)) {
+            r = arena->region[i];
+            break;
+        }
+    }
+
+    // none had room, so pin another
+    if (r == NULL) {
+        pthread_mutex_lock (&arena->lock);
+        // somebody may have beaten us to it
+        for (i=n; i<arena->num_regions; i++) {
+            if (pinregion_alloc (arena->region[i], need, &offset)) {
+                r = arena->region[i];
+                break;
+            }
+        }
+        if (r == NULL) {
+            r = pinregion_create (arena, need > arena->next_size ? need : arena->next_size);
+            if (r != NULL && arena->next_size < arena->region_size) {
+                arena->next_size *= 2;
+                if (arena->next_size > arena->region_size) {
+                    arena->next_size = arena->region_size;
+                }
+            }
+            if (r == NULL || !pinregion_alloc (r, need, &offset)) {
+                pthread_mutex_unlock (&arena->lock);
+                *block_size = need;
+                return pin_direct (arena, host, dptr, need);
+            }
+        }
+        pthread_mutex_unlock (&arena->lock);
+    }
+
+    *host = r->host_base + offset;
+    *dptr = r->dev_base + offset;
+    *block_size = need;
+
+    return CUDA_SUCCESS;
+}
+
+
+// give a block back to the region it came from
+CUresult
+pinarena_free (cuzmem_pinarena* arena, void* host, size_t block_size)
+{
+    unsigned int i, n = arena->num_regions;
+    unsigned int lo, hi, mid;
+    size_t offset;
+    cuzmem_pinregion* r = NULL;
+
+    for (i=0; i<n; i++) {
+        r = arena->region[i];
+        if ((char*)host >= r->host_base && (char*)host < r->host_base + r->size) {
+            break;
+        }
+    }
+    // not from a region: pinned on its own
+    if (i == n) {
+        __sync_fetch_and_sub (&arena->num_direct, 1);
+        __sync_fetch_and_sub (&arena->direct_bytes, block_size);
+        return cuMemFreeHost (host);
+    }
+    offset = (char*)host - r->host_base;
+
+    pthread_mutex_lock (&r->lock);
+
+    // binary search for the first free extent after the block
+    lo = 0;
+    hi = r->num_free;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (r->free[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // merge with the extent before and/or after
+    if (lo > 0 && r->free[lo-1].offset + r->free[lo-1].size == offset) {
+        r->free[lo-1].size += block_size;
+        if (lo < r->num_free && offset + block_size == r->free[lo].offset) {
+            r->free[lo-1].size += r->free[lo].size;
+            memmove (&r->free[lo], &r->free[lo+1],
+                    (r->num_free - lo - 1) * sizeof(cuzmem_pinextent));
+            r->num_free--;
+        }
+    }
+    else if (lo < r->num_free && offset + block_size == r->free[lo].offset) {
+        r->free[lo].offset = offset;
+        r->free[lo].size += block_size;
+    }
+    else {
+        if (r->num_free == r->max_free) {
+            cuzmem_pinextent* grown = (cuzmem_pinextent*)realloc (r->free,
+                    2 * r->max_free * sizeof(cuzmem_pinextent));
+            if (grown == NULL) {
+                // (the block is lost to the region until it is trimmed)
+                pthread_mutex_unlock (&r->lock);
+                return CUDA_ERROR_OUT_OF_MEMORY;
+            }
+            r->free = grown;
+            r->max_free *= 2;
+        }
+        memmove (&r->free[lo+1], &r->free[lo],
+                (r->num_free - lo) * sizeof(cuzmem_pinextent));
+        r->free[lo].offset = offset;
+        r->free[lo].size = block_size;
+        r->num_free++;
+    }
+
+    pthread_mutex_unlock (&r->lock);
+
+    return CUDA_SUCCESS;
+}
+
+
+// unpin regions that have nothing allocated in them.
+// returns # of bytes unpinned
+// NOTE: must not race with pinarena_alloc()/pinarena_free()
+size_t
+pinarena_trim (cuzmem_pinarena* arena)
+{
+    unsigned int i, j;
+    size_t released = 0;
+    cuzmem_pinregion* r;
+
+    pthread_mutex_lock (&arena->lock);
+    for (i=0, j=0; i<arena->num_regions; i++) {
+        r = arena->region[i];
+        if (r->num_free == 1 && r->free[0].size == r->size) {
+            cuMemFreeHost (r->host_base);
+            arena->pinned_bytes -= r->size;
+            released += r->size;
+            pthread_mutex_destroy (&r->lock);
+            free (r->free);
+            free (r);
+        } else {
+            arena->region[j++] = r;
+        }
+    }
+    for (i=j; i<arena->num_regions; i++) {
+        arena->region[i] = NULL;
+    }
+    arena->num_regions = j;
+    pthread_mutex_unlock (&arena->lock);
+
+    return released;
+}
+
+
+void
+pinarena_report (cuzmem_pinarena* arena, FILE* fp)
+{
+    fprintf (fp, "libcuzmem: pinned arena\n");
+    fprintf (fp, "  regions       : %u (%lu B pinned)\n",
+            arena->num_regions, (unsigned long)arena->pinned_bytes);
+    fprintf (fp, "  pinned alone  : %u (%lu B)\n",
+            arena->num_direct, (unsigned long)arena->direct_bytes);
+}
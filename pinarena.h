@@ -0,0 +1,92 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _pinarena_h_
+#define _pinarena_h_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <cuda.h>
+
+#define PINARENA_REGION_MIN   (1024*1024)
+#define PINARENA_REGION_SIZE  (64*1024*1024)
+#define PINARENA_MAX_REGIONS  64
+#define PINARENA_ALIGN        256
+
+// -- Pinned Arena structures --------------------
+typedef struct cuzmem_pinextent_struct cuzmem_pinextent;
+struct cuzmem_pinextent_struct
+{
+    size_t offset;
+    size_t size;
+};
+
+// one large mapped & pinned host allocation
+typedef struct cuzmem_pinregion_struct cuzmem_pinregion;
+struct cuzmem_pinregion_struct
+{
+    char* host_base;
+    CUdeviceptr dev_base;
+    size_t size;
+    cuzmem_pinextent* free;     // free extents, sorted by offset
+    unsigned int num_free;
+    unsigned int max_free;
+    pthread_mutex_t lock;
+};
+
+typedef struct cuzmem_pinarena_struct cuzmem_pinarena;
+struct cuzmem_pinarena_struct
+{
+    cuzmem_pinregion* region[PINARENA_MAX_REGIONS];
+    unsigned int num_regions;
+    size_t region_size;         // largest region pinned for small blocks
+    size_t next_size;           // size of the next region (grows to region_size)
+    size_t pinned_bytes;        // total pinned by all regions
+    unsigned int num_direct;    // blocks pinned on their own (no region)
+    size_t direct_bytes;
+    pthread_mutex_t lock;       // guards adding/removing regions
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+pinarena_init (cuzmem_pinarena* arena);
+
+void
+pinarena_destroy (cuzmem_pinarena* arena);
+
+CUresult
+pinarena_alloc (cuzmem_pinarena* arena, void** host, CUdeviceptr* dptr, size_t* block_size, size_t size);
+
+CUresult
+pinarena_free (cuzmem_pinarena* arena, void* host, size_t block_size);
+
+size_t
+pinarena_trim (cuzmem_pinarena* arena);
+
+void
+pinarena_report (cuzmem_pinarena* arena, FILE* fp);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
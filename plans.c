@@ -18,6 +18,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <string.h>
 
@@ -61,9 +66,8 @@ rm_whitespace (char *str)
 }
 
 
-void
+cuzmem_plan*
 plan_add_entry (
-    cuzmem_plan** plan,
     char** cmd,
     char** parm,
     char* linebuf,
@@ -75,11 +79,23 @@ plan_add_entry (
 
     // populate entry with default values
     entry->id = 0;
+    entry->gene = -1;
+    entry->site = 0;
+    entry->ordinal = 0;
     entry->size = 0;
     entry->loc = 1;
     entry->inloop = 0;
+    entry->first_hit = 1;
+    entry->gold_member = 0;
+    entry->alloc_stamp = 0;
+    entry->gold_stamp = 0;
     entry->cpu_pointer = NULL;
     entry->gpu_pointer = NULL;
+    entry->kept_gpu_pointer = NULL;
+    entry->kept_cpu_pointer = NULL;
+    entry->next = NULL;
+    entry->free_next = NULL;
+    entry->free_prev = NULL;
 
     while (fgets (linebuf, 128, fp)) {
         // Comments start with # (skip to next line)
@@ -95,8 +111,8 @@ plan_add_entry (
             continue;
         }
 
-        *cmd  = (char*) realloc (*cmd, line_len * sizeof(char));
-        *parm = (char*) realloc (*parm, line_len * sizeof(char));
+        *cmd  = (char*) realloc (*cmd, (line_len + 1) * sizeof(char));
+        *parm = (char*) realloc (*parm, (line_len + 1) * sizeof(char));
 
         // Get the command/parameter set
         sscanf (linebuf, "%s %s", *cmd, *parm);
@@ -105,6 +121,15 @@ plan_add_entry (
         if (!strcmp (*cmd, "id")) {
             entry->id = atoi(*parm);
         }
+        else if (!strcmp (*cmd, "gene")) {
+            entry->gene = atoi(*parm);
+        }
+        else if (!strcmp (*cmd, "site")) {
+            entry->site = strtoull (*parm, NULL, 16);
+        }
+        else if (!strcmp (*cmd, "ordinal")) {
+            entry->ordinal = (unsigned int)strtoul (*parm, NULL, 10);
+        }
         else if (!strcmp (*cmd, "size")) {
             entry->size = atoi(*parm);
         }
@@ -141,34 +166,116 @@ plan_add_entry (
         }
     } // while
 
-    // Insert new entry into plan
-    entry->next = *plan;
-    *plan = entry;
+    // ungrouped plan: every knob is its own gene
+    if (entry->gene < 0) {
+        entry->gene = entry->id;
+    }
+
+    return entry;
 }
 
 
-// Reads specified file and returns
+// parses a plan file's device block (the GPU the plan was tuned on)
+void
+plan_add_device (
+    char** cmd,
+    char** parm,
+    char* linebuf,
+    FILE* fp,
+    cuzmem_device_fp* dev
+)
+{
+    int line_len = 0;
+
+    while (fgets (linebuf, 128, fp)) {
+        // Comments start with # (skip to next line)
+        if (linebuf[0] == '#') {
+            continue;
+        }
+
+        // Remove excess whitespace
+        line_len = rm_whitespace (linebuf);
+
+        // Skip empty lines
+        if (line_len == 0) {
+            continue;
+        }
+
+        *cmd  = (char*) realloc (*cmd, (line_len + 1) * sizeof(char));
+        *parm = (char*) realloc (*parm, (line_len + 1) * sizeof(char));
+
+        // Get the command/parameter set
+        sscanf (linebuf, "%s %s", *cmd, *parm);
+
+        if (!strcmp (*cmd, "name")) {
+            // device names contain spaces: take the rest of the line
+            size_t n;
+            strncpy (dev->name, linebuf + strlen ("name "), sizeof(dev->name) - 1);
+            dev->name[sizeof(dev->name) - 1] = '\0';
+            n = strlen (dev->name);
+            while (n > 0 && isspace ((unsigned char)dev->name[n-1])) {
+                dev->name[--n] = '\0';
+            }
+        }
+        else if (!strcmp (*cmd, "mem")) {
+            dev->total_mem = strtoull (*parm, NULL, 10);
+        }
+        else if (!strcmp (*cmd, "cc")) {
+            sscanf (*parm, "%d.%d", &dev->cc_major, &dev->cc_minor);
+        }
+        else if (!strcmp (*cmd, "driver")) {
+            dev->driver_version = atoi (*parm);
+        }
+        else if (!strcmp (*cmd, "end")) {
+            break;
+        }
+        else {
+            // Unknown (just ignore)
+            ;
+        }
+    } // while
+}
+
+
+// full path of a plan file: ~/.project/plan.ext
+// returns 0 on success, 1 if the path is too long (filename is then
+// left empty rather than naming some other file)
+int
+plan_filename (char* filename, const char* project_name, const char* plan_name, const char* ext)
+{
+    int len = snprintf (filename, FILENAME_MAX, "%s/.%s/%s.%s",
+                        getenv ("HOME"), project_name, plan_name, ext);
+
+    if (len < 0 || len >= FILENAME_MAX) {
+        fprintf (stderr, "libcuzmem: path of %s.%s is too long\n", plan_name, ext);
+        filename[0] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+
+// Reads specified text plan file and returns the plan (NULL if the
+// file could not be opened).  If dev is not NULL it receives the
+// fingerprint of the device the plan was tuned on (zeroed if unknown)
 cuzmem_plan*
-read_plan (char *project_name, char *plan_name)
+read_plan_text (const char* filename, cuzmem_device_fp* dev)
 {
-    // TODO: Check valid project_name & plan_name before reading
-    //
     FILE *fp;
-    char filename[FILENAME_MAX];
     char linebuf[128];
-    char *cmd, *parm, *home;
-    unsigned int flen;
-    unsigned int line_number;
+    char *cmd, *parm;
     int line_len;
     cuzmem_plan *plan = NULL;
-
-    sprintf (filename, "%s/.%s/%s.plan", getenv ("HOME"), project_name, plan_name);
+    cuzmem_plan **tail = &plan;
 
     // open the file
     fp = fopen (filename, "r");
     if (!fp) {
-        fprintf (stderr, "libcuzmem: unable to open plan %s\n\n", filename);
-        exit (0);
+        return NULL;
+    }
+
+    if (dev) {
+        memset (dev, 0, sizeof(cuzmem_device_fp));
     }
 
     // Do dummy malloc()s
@@ -189,14 +296,19 @@ read_plan (char *project_name, char *plan_name)
             continue;
         }
 
-        cmd  = (char*) realloc (cmd, line_len * sizeof(char));
-        parm = (char*) realloc (parm, line_len * sizeof(char));
+        cmd  = (char*) realloc (cmd, (line_len + 1) * sizeof(char));
+        parm = (char*) realloc (parm, (line_len + 1) * sizeof(char));
 
         // Get the command/parameter set
         sscanf (linebuf, "%s %s", cmd, parm);
 
+        // append, so the plan stays in the same (id) order as the file
         if (!strcmp (cmd, "begin")) {
-            plan_add_entry (&plan, &cmd, &parm, linebuf, fp);
+            *tail = plan_add_entry (&cmd, &parm, linebuf, fp);
+            tail = &(*tail)->next;
+        }
+        else if (!strcmp (cmd, "device") && dev) {
+            plan_add_device (&cmd, &parm, linebuf, fp, dev);
         }
     }
 
@@ -209,22 +321,546 @@ read_plan (char *project_name, char *plan_name)
 }
 
 
+// FNV-1a over the entry records
+static unsigned int
+plan_checksum (const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    unsigned int h = 2166136261u;
+    size_t i;
+
+    for (i=0; i<len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+// Maps specified binary plan file and returns the plan (NULL if the
+// file could not be opened or is not a valid plan).  If dev is not NULL
+// it receives the fingerprint of the device the plan was tuned on
+// NOTE: the records are read straight out of the mapping and all of the
+//       plan's entries live in one allocation (in id order)
+cuzmem_plan*
+read_plan_bin (const char* filename, cuzmem_device_fp* dev)
+{
+    int fd;
+    struct stat st;
+    void* map;
+    const cuzmem_plan_header* hdr;
+    const cuzmem_plan_record* rec;
+    cuzmem_plan* entries = NULL;
+    unsigned int i;
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat (fd, &st) != 0 || st.st_size < (off_t)sizeof(cuzmem_plan_header)) {
+        close (fd);
+        return NULL;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    hdr = (const cuzmem_plan_header*)map;
+    rec = (const cuzmem_plan_record*)(hdr + 1);
+
+    // validate
+    if (hdr->magic != PLAN_MAGIC) {
+        fprintf (stderr, "libcuzmem: %s is not a binary plan\n", filename);
+        goto done;
+    }
+    if (hdr->version != PLAN_VERSION ||
+        hdr->entry_size != sizeof(cuzmem_plan_record)) {
+        fprintf (stderr, "libcuzmem: %s is plan version %u (expected %u)\n",
+                filename, hdr->version, PLAN_VERSION);
+        goto done;
+    }
+    if ((size_t)st.st_size != sizeof(cuzmem_plan_header) +
+                              (size_t)hdr->num_entries * sizeof(cuzmem_plan_record) ||
+        hdr->checksum != plan_checksum (rec, hdr->num_entries * sizeof(cuzmem_plan_record))) {
+        fprintf (stderr, "libcuzmem: plan %s is corrupt\n", filename);
+        goto done;
+    }
+    if (dev) {
+        *dev = hdr->device;
+    }
+    if (hdr->num_entries == 0) {
+        goto done;
+    }
+
+    entries = (cuzmem_plan*)calloc (hdr->num_entries, sizeof(cuzmem_plan));
+    if (entries == NULL) {
+        goto done;
+    }
+    for (i=0; i<hdr->num_entries; i++) {
+        entries[i].id = rec[i].id;
+        entries[i].gene = rec[i].gene;
+        entries[i].site = rec[i].site;
+        entries[i].ordinal = rec[i].ordinal;
+        entries[i].size = (size_t)rec[i].size;
+        entries[i].loc = rec[i].loc;
+        entries[i].inloop = rec[i].inloop;
+        entries[i].first_hit = 1;
+        entries[i].next = (i+1 < hdr->num_entries) ? &entries[i+1] : NULL;
+    }
+
+done:
+    munmap (map, st.st_size);
+    return entries;
+}
+
+
+// is filename a binary plan?
+int
+plan_is_binary (const char* filename)
+{
+    FILE* fp;
+    unsigned int magic = 0;
 
+    fp = fopen (filename, "rb");
+    if (!fp) {
+        return 0;
+    }
+    if (fread (&magic, sizeof(magic), 1, fp) != 1) {
+        magic = 0;
+    }
+    fclose (fp);
+
+    return (magic == PLAN_MAGIC);
+}
+
+
+// reads just the device fingerprint of a plan file (either format)
+// returns 0 on success
+static int
+read_plan_device (const char* filename, cuzmem_device_fp* dev)
+{
+    FILE* fp;
+    cuzmem_plan* plan;
+    cuzmem_plan_header hdr;
+    size_t n;
+
+    fp = fopen (filename, "rb");
+    if (!fp) {
+        return 1;
+    }
+    n = fread (&hdr, 1, sizeof(hdr), fp);
+    fclose (fp);
+
+    if (n >= sizeof(hdr.magic) && hdr.magic == PLAN_MAGIC) {
+        if (n != sizeof(hdr) || hdr.version != PLAN_VERSION) {
+            return 1;
+        }
+        *dev = hdr.device;
+        return 0;
+    }
+
+    // text plan: the device block comes first, but there is no cheap
+    // way to know there isn't one, so parse it all
+    plan = read_plan_text (filename, dev);
+    while (plan) {
+        cuzmem_plan* next = plan->next;
+        free (plan);
+        plan = next;
+    }
+    return 0;
+}
+
+
+// file name friendly description of a device fingerprint, e.g.
+//   GeForce_GTX_480-1535MB-sm20-drv4000
 void
-write_plan (cuzmem_plan* plan, char *project_name, char *plan_name)
+plan_device_tag (const cuzmem_device_fp* dev, char* tag, size_t len)
+{
+    char name[sizeof(dev->name)];
+    unsigned int i;
+
+    for (i=0; i<sizeof(name)-1 && dev->name[i] != '\0'; i++) {
+        name[i] = isalnum ((unsigned char)dev->name[i]) ? dev->name[i] : '_';
+    }
+    name[i] = '\0';
+
+    snprintf (tag, len, "%s-%lluMB-sm%i%i-drv%i", name,
+            dev->total_mem >> 20, dev->cc_major, dev->cc_minor, dev->driver_version);
+}
+
+
+// how well suited is a plan tuned on device "tuned" for device "dev"?
+// returns -1 if unsuitable; bigger is better
+// NOTES
+// * A plan tuned on a card with more memory than this one places more
+//   in global memory than will fit.  alloc_mem_device() would silently
+//   spill those knobs to pinned memory, so such plans are unsuitable.
+// * Otherwise prefer the same card, then the same compute capability,
+//   then the same driver, then the card with the most memory.
+// * Plans without a fingerprint (hand written or tuned before plans
+//   were fingerprinted) are a last resort.
+// * If we don't know which device we are on, anything goes.
+static long long
+plan_device_score (const cuzmem_device_fp* dev, const cuzmem_device_fp* tuned)
+{
+    long long score;
+
+    if (dev->total_mem == 0) {
+        return 1;
+    }
+    if (tuned->total_mem == 0) {
+        return 0;
+    }
+    if (tuned->total_mem > dev->total_mem) {
+        return -1;
+    }
+    if (!memcmp (dev, tuned, sizeof(cuzmem_device_fp))) {
+        return LLONG_MAX;
+    }
+
+    score = 1;
+    if (!strcmp (dev->name, tuned->name)) {
+        score += 4LL << 48;
+    }
+    if (dev->cc_major == tuned->cc_major && dev->cc_minor == tuned->cc_minor) {
+        score += 2LL << 48;
+    }
+    if (dev->driver_version == tuned->driver_version) {
+        score += 1LL << 48;
+    }
+    score += (long long)(tuned->total_mem >> 20);
+
+    return score;
+}
+
+
+// is tag[0..len) a device tag, as plan_device_tag() writes them?
+static int
+plan_tag_parses (const char* tag, size_t len)
+{
+    char buf[128];
+    const char *p, *dash;
+    unsigned long long mb;
+    int cc, drv, n = 0;
+
+    if (len == 0 || len >= sizeof(buf)) {
+        return 0;
+    }
+    memcpy (buf, tag, len);
+    buf[len] = '\0';
+
+    dash = strchr (buf, '-');
+    if (dash == NULL || dash == buf) {
+        return 0;
+    }
+    for (p = buf; p < dash; p++) {
+        if (!isalnum ((unsigned char)*p) && *p != '_') {
+            return 0;
+        }
+    }
+    if (sscanf (dash, "-%lluMB-sm%d-drv%d%n", &mb, &cc, &drv, &n) != 3) {
+        return 0;
+    }
+    return (n > 0 && dash[n] == '\0');
+}
+
+
+// finds the plan file best suited for device dev
+// returns 0: exact match, 1: nearest compatible, 2: none suitable
+//         (filename receives the chosen plan)
+// NOTE: plan files are named ~/.project/plan[.device tag].{planb,plan}
+static int
+find_plan (const char* project_name, const char* plan_name,
+           const cuzmem_device_fp* dev, char* filename, int verbose)
+{
+    DIR* dir;
+    struct dirent* de;
+    char dirname[FILENAME_MAX];
+    char candidate[FILENAME_MAX];
+    char tag[128];
+    size_t plen = strlen (plan_name);
+    const char* ext;
+    cuzmem_device_fp tuned;
+    long long score, best = -1;
+    int len, found = 0;
+    static const cuzmem_device_fp unknown;
+
+    if (dev == NULL) {
+        dev = &unknown;
+    }
+
+    len = snprintf (dirname, FILENAME_MAX, "%s/.%s", getenv ("HOME"), project_name);
+    if (len < 0 || len >= FILENAME_MAX) {
+        return 2;
+    }
+    dir = opendir (dirname);
+    if (dir == NULL) {
+        return 2;
+    }
+
+    while ((de = readdir (dir)) != NULL) {
+        // plan.planb, plan.plan, plan.<tag>.planb, plan.<tag>.plan
+        // (and not, say, plan.other.planb: that is plan "plan.other")
+        if (strncmp (de->d_name, plan_name, plen) || de->d_name[plen] != '.') {
+            continue;
+        }
+        ext = strrchr (de->d_name, '.');
+        if (strcmp (ext+1, PLAN_EXT_BIN) && strcmp (ext+1, PLAN_EXT_TEXT)) {
+            continue;
+        }
+        if (ext != &de->d_name[plen] &&
+            !plan_tag_parses (&de->d_name[plen+1], ext - &de->d_name[plen+1])) {
+            continue;
+        }
+        // (a path that doesn't fit would name some other file)
+        len = snprintf (candidate, FILENAME_MAX, "%s/%s", dirname, de->d_name);
+        if (len < 0 || len >= FILENAME_MAX || read_plan_device (candidate, &tuned)) {
+            continue;
+        }
+        found++;
+
+        score = plan_device_score (dev, &tuned);
+        if (verbose && score < 0) {
+            plan_device_tag (&tuned, tag, sizeof(tag));
+            fprintf (stderr, "libcuzmem:   %s (tuned on %s) needs more GPU memory\n",
+                    de->d_name, tag);
+        }
+        // binary beats text on a tie
+        if (score > best || (score == best && !strcmp (ext+1, PLAN_EXT_BIN))) {
+            best = score;
+            strcpy (filename, candidate);
+        }
+    }
+    closedir (dir);
+
+    if (best < 0) {
+        if (verbose && found) {
+            plan_device_tag (dev, tag, sizeof(tag));
+            fprintf (stderr, "libcuzmem: no plan \"%s\" suitable for %s (%i found)\n",
+                    plan_name, tag, found);
+        }
+        return 2;
+    }
+    if (best == LLONG_MAX) {
+        return 0;
+    }
+    if (verbose) {
+        plan_device_tag (dev, tag, sizeof(tag));
+        fprintf (stderr, "libcuzmem: no plan \"%s\" tuned for %s, using nearest: %s\n",
+                plan_name, tag, filename);
+    }
+    return 1;
+}
+
+
+// Reads the plan for a project best suited to device dev (see
+// find_plan()).  Exits if there is none.
+cuzmem_plan*
+read_plan (char *project_name, char *plan_name, const cuzmem_device_fp* dev)
+{
+    // TODO: Check valid project_name & plan_name before reading
+    //
+    char filename[FILENAME_MAX];
+    cuzmem_plan *plan = NULL;
+
+    if (find_plan (project_name, plan_name, dev, filename, 1) < 2) {
+        if (plan_is_binary (filename)) {
+            plan = read_plan_bin (filename, NULL);
+        } else {
+            plan = read_plan_text (filename, NULL);
+        }
+    }
+
+    if (plan == NULL) {
+        fprintf (stderr, "libcuzmem: unable to open plan %s/.%s/%s\n\n",
+                getenv ("HOME"), project_name, plan_name);
+        exit (0);
+    }
+
+    return plan;
+}
+
+
+// puts the plan's entries into an array in id order: O(n) when the ids
+// are 0..n-1 (as the tuners make them), sorted otherwise
+// returns # of entries (array must be free()ed by caller)
+static int
+plan_entry_cmp (const void* a, const void* b)
+{
+    const cuzmem_plan* x = *(const cuzmem_plan**)a;
+    const cuzmem_plan* y = *(const cuzmem_plan**)b;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static unsigned int
+plan_sorted (cuzmem_plan* plan, cuzmem_plan*** sorted)
+{
+    unsigned int i, n = 0;
+    int dense = 1;
+    cuzmem_plan* curr;
+    cuzmem_plan** s;
+
+    for (curr = plan; curr != NULL; curr = curr->next) {
+        n++;
+    }
+
+    s = (cuzmem_plan**)calloc (n + 1, sizeof(cuzmem_plan*));
+    for (curr = plan; curr != NULL; curr = curr->next) {
+        if (curr->id < 0 || curr->id >= (int)n || s[curr->id] != NULL) {
+            dense = 0;
+            break;
+        }
+        s[curr->id] = curr;
+    }
+
+    if (!dense) {
+        for (i=0, curr = plan; curr != NULL; curr = curr->next) {
+            s[i++] = curr;
+        }
+        qsort (s, n, sizeof(cuzmem_plan*), plan_entry_cmp);
+    }
+
+    *sorted = s;
+    return n;
+}
+
+
+// Writes plan (tuned on device dev, may be NULL) to specified file in
+// the text format
+// returns 0 on success
+int
+write_plan_text (cuzmem_plan* plan, const cuzmem_device_fp* dev, const char* filename)
 {
     FILE *fp;
+    unsigned int i, n;
+    cuzmem_plan **sorted, *curr;
+
+    fp = fopen (filename, "w");
+    if (!fp) {
+        return 1;
+    }
+
+    n = plan_sorted (plan, &sorted);
+
+    // Write entries to plan file in order
+    fprintf (fp, "# libcuzmem plan file\n\n");
+    if (dev && dev->total_mem) {
+        fprintf (fp, "device\n");
+        fprintf (fp, "  name %s\n", dev->name);
+        fprintf (fp, "  mem %llu\n", dev->total_mem);
+        fprintf (fp, "  cc %i.%i\n", dev->cc_major, dev->cc_minor);
+        fprintf (fp, "  driver %i\n", dev->driver_version);
+        fprintf (fp, "end\n\n");
+    }
+    for (i=0; i<n; i++) {
+        curr = sorted[i];
+        fprintf (fp, "begin\n");
+        fprintf (fp, "  id %i\n", curr->id);
+        if (curr->gene != curr->id) {
+            fprintf (fp, "  gene %i\n", curr->gene);
+        }
+        fprintf (fp, "  size %lu\n", (unsigned long)curr->size);
+        if (curr->site != 0) {
+            fprintf (fp, "  site %016llx\n", curr->site);
+            fprintf (fp, "  ordinal %u\n", curr->ordinal);
+        }
+        if (curr->loc == 0) {
+            fprintf (fp, "  loc pinned\n");
+        }
+        else if (curr->loc == 1) {
+            fprintf (fp, "  loc global\n");
+        }
+        else {
+            fprintf (stderr, "libcuzmem: attempted to write invalid memory spec to plan!\n");
+            exit (1);
+        }
+        if (curr->inloop == 1) {
+            fprintf (fp, "  inloop true\n");
+        }
+        fprintf (fp, "end\n\n");
+    }
+
+    free (sorted);
+    fclose (fp);
+
+    return 0;
+}
+
+
+// Writes plan (tuned on device dev, may be NULL) to specified file in
+// the binary format.  The plan is written to a temporary file that is
+// then renamed over the old plan, so readers never see half a plan.
+// returns 0 on success
+int
+write_plan_bin (cuzmem_plan* plan, const cuzmem_device_fp* dev, const char* filename)
+{
+    FILE *fp;
+    char tmpname[FILENAME_MAX];
+    unsigned int i, n;
+    cuzmem_plan **sorted;
+    cuzmem_plan_header hdr;
+    cuzmem_plan_record* rec;
+
+    n = plan_sorted (plan, &sorted);
+    rec = (cuzmem_plan_record*)calloc (n + 1, sizeof(cuzmem_plan_record));
+    for (i=0; i<n; i++) {
+        if (sorted[i]->loc != 0 && sorted[i]->loc != 1) {
+            fprintf (stderr, "libcuzmem: attempted to write invalid memory spec to plan!\n");
+            exit (1);
+        }
+        rec[i].size = sorted[i]->size;
+        rec[i].id = sorted[i]->id;
+        rec[i].gene = sorted[i]->gene;
+        rec[i].site = sorted[i]->site;
+        rec[i].ordinal = sorted[i]->ordinal;
+        rec[i].loc = (unsigned char)sorted[i]->loc;
+        rec[i].inloop = (unsigned char)sorted[i]->inloop;
+    }
+    free (sorted);
+
+    memset (&hdr, 0, sizeof(hdr));
+    hdr.magic = PLAN_MAGIC;
+    hdr.version = PLAN_VERSION;
+    hdr.num_entries = n;
+    hdr.entry_size = sizeof(cuzmem_plan_record);
+    hdr.checksum = plan_checksum (rec, n * sizeof(cuzmem_plan_record));
+    if (dev) {
+        hdr.device = *dev;
+    }
+
+    snprintf (tmpname, FILENAME_MAX, "%s.%i", filename, (int)getpid());
+    fp = fopen (tmpname, "wb");
+    if (!fp) {
+        free (rec);
+        return 1;
+    }
+    if (fwrite (&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite (rec, sizeof(cuzmem_plan_record), n, fp) != n) {
+        fclose (fp);
+        unlink (tmpname);
+        free (rec);
+        return 1;
+    }
+    fclose (fp);
+    free (rec);
+
+    return rename (tmpname, filename);
+}
+
+
+// makes sure ~/.project (which may be nested) exists
+void
+make_project_directory (char *project_name)
+{
     char *home;
     char filename[FILENAME_MAX];
     char dirname[FILENAME_MAX];
     char *dir_ptr;
-    unsigned int i;
-
     struct stat st;
 
-    unsigned int num_entries = 0;
-    cuzmem_plan* curr = plan;
-
     strcpy (filename, "");
 
     home = getenv ("HOME");
@@ -253,68 +889,406 @@ write_plan (cuzmem_plan* plan, char *project_name, char *plan_name)
             }
         }
     }
+}
 
-    strcat (filename, "/");
-    strcat (filename, plan_name);
-    strcat (filename, ".plan");
 
-    fp = fopen (filename, "w");
-    if (!fp) {
-        fprintf (stderr, "libcuzmem: unable to open plan %s\n\n", filename);
+// Writes plan as ~/.project/plan.<device tag>.planb
+void
+write_plan (cuzmem_plan* plan, char *project_name, char *plan_name, const cuzmem_device_fp* dev)
+{
+    char filename[FILENAME_MAX];
+    char name[FILENAME_MAX];
+    char tag[128];
+
+    make_project_directory (project_name);
+
+    if (dev && dev->total_mem) {
+        plan_device_tag (dev, tag, sizeof(tag));
+        snprintf (name, FILENAME_MAX, "%s.%s", plan_name, tag);
+    } else {
+        snprintf (name, FILENAME_MAX, "%s", plan_name);
+    }
+
+    if (plan_filename (filename, project_name, name, PLAN_EXT_BIN) ||
+        write_plan_bin (plan, dev, filename)) {
+        fprintf (stderr, "libcuzmem: unable to write plan %s\n\n", filename);
         exit (0);
     }
+}
 
-    // Get # of entries
-    while (curr != NULL) {
-        num_entries++;
-        curr = curr->next;
+// returns 0 if there is a plan suitable for device dev, 1 otherwise
+// (see find_plan())
+int
+check_plan (const char* project_name, const char* plan_name, const cuzmem_device_fp* dev)
+{
+    char filename[FILENAME_MAX];
+
+    if (find_plan (project_name, plan_name, dev, filename, 1) < 2) {
+        // plan does exist
+        return 0;
+    } else {
+        // plan does not exist
+        return 1;
     }
+}
 
-    // Write entries to plan file in order
-    fprintf (fp, "# libcuzmem plan file\n\n");
-    for (i=0; i<num_entries; i++) {
-        curr = plan;
-        while (curr != NULL) {
-            if (curr->id == i) {
-                fprintf (fp, "begin\n");
-                fprintf (fp, "  id %i\n", curr->id);
-                fprintf (fp, "  size %i\n", (int)curr->size);
-                if (curr->loc == 0) {
-                    fprintf (fp, "  loc pinned\n");
-                }
-                else if (curr->loc == 1) {
-                    fprintf (fp, "  loc global\n");
-                }
-                else {
-                    fprintf (stderr, "libcuzmem: attempted to write invalid memory spec to plan!\n");
-                    exit (1);
-                }
-                if (curr->inloop == 1) {
-                    fprintf (fp, "  inloop true\n");
-                }
-                fprintf (fp, "end\n\n");
-                break;
+
+//------------------------------------------------------------------------------
+// PLAN INDEX
+//------------------------------------------------------------------------------
+
+// size -> slot in the inloop table (slot may be empty)
+static unsigned int
+plan_index_slot (cuzmem_plan_index* index, size_t size)
+{
+    unsigned long long h = (unsigned long long)size * 0x9E3779B97F4A7C15ULL;
+    unsigned int i = (unsigned int)(h >> 32) & (index->inloop_capacity - 1);
+
+    while (index->inloop_size[i] != (size_t)-1 &&
+           index->inloop_size[i] != size) {
+        i = (i + 1) & (index->inloop_capacity - 1);
+    }
+
+    return i;
+}
+
+// (site, size) -> slot in the site table (slot may be empty)
+static unsigned int
+plan_index_site_slot (cuzmem_plan_index* index, unsigned long long site, size_t size)
+{
+    unsigned long long h = (site ^ ((unsigned long long)size << 1)) * 0x9E3779B97F4A7C15ULL;
+    unsigned int i = (unsigned int)(h >> 32) & (index->site_capacity - 1);
+
+    while (index->sites[i].site != 0 &&
+           (index->sites[i].site != site || index->sites[i].size != size)) {
+        i = (i + 1) & (index->site_capacity - 1);
+    }
+
+    return i;
+}
+
+#define SLOT_LOCK(index, i)                                              \
+    pthread_mutex_lock (&(index)->inloop_lock[(i) & (PLAN_INDEX_LOCKS-1)])
+
+#define SLOT_UNLOCK(index, i)                                            \
+    pthread_mutex_unlock (&(index)->inloop_lock[(i) & (PLAN_INDEX_LOCKS-1)])
+
+
+static void
+plan_index_clear (cuzmem_plan_index* index)
+{
+    unsigned int i;
+
+    for (i=0; i<index->site_capacity; i++) {
+        free (index->sites[i].by_ordinal);
+    }
+    free (index->sites);
+    index->sites = NULL;
+    index->site_capacity = 0;
+    free (index->by_id);
+    free (index->inloop_size);
+    free (index->inloop_free);
+    index->by_id = NULL;
+    index->num_ids = 0;
+    index->inloop_size = NULL;
+    index->inloop_free = NULL;
+    index->inloop_capacity = 0;
+    index->inloop_sizes = 0;
+}
+
+
+void
+plan_index_init (cuzmem_plan_index* index)
+{
+    unsigned int i;
+
+    index->by_id = NULL;
+    index->sites = NULL;
+    index->site_capacity = 0;
+    index->inloop_size = NULL;
+    index->inloop_free = NULL;
+    plan_index_clear (index);
+
+    for (i=0; i<PLAN_INDEX_LOCKS; i++) {
+        pthread_mutex_init (&index->inloop_lock[i], NULL);
+    }
+}
+
+
+void
+plan_index_destroy (cuzmem_plan_index* index)
+{
+    unsigned int i;
+
+    plan_index_clear (index);
+    for (i=0; i<PLAN_INDEX_LOCKS; i++) {
+        pthread_mutex_destroy (&index->inloop_lock[i]);
+    }
+}
+
+
+// (re)build the index for a freshly loaded plan
+// NOTE: must not race with cudaMalloc()/cudaFree() (called from
+//       cuzmem_start() only)
+void
+plan_index_build (cuzmem_plan_index* index, cuzmem_plan* plan)
+{
+    unsigned int i, num_inloop = 0, num_sited = 0;
+    cuzmem_plan* entry;
+    cuzmem_plan_site* s;
+
+    plan_index_clear (index);
+
+    // size things up
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->id >= 0 && entry->id >= (int)index->num_ids) {
+            index->num_ids = entry->id + 1;
+        }
+        if (entry->inloop) {
+            num_inloop++;
+        }
+        if (entry->site != 0) {
+            num_sited++;
+        }
+    }
+
+    // call site table (plans from before call sites were recorded
+    // don't get one and are matched by id alone)
+    if (num_sited) {
+        index->site_capacity = 8;
+        while (index->site_capacity < 2 * num_sited) {
+            index->site_capacity *= 2;
+        }
+        index->sites = (cuzmem_plan_site*)calloc (index->site_capacity, sizeof(cuzmem_plan_site));
+        if (!index->sites) {
+            fprintf (stderr, "libcuzmem: unable to index plan!\n");
+            exit (1);
+        }
+
+        // keys & # of ordinals per key
+        for (entry = plan; entry != NULL; entry = entry->next) {
+            if (entry->site == 0) {
+                continue;
+            }
+            s = &index->sites[plan_index_site_slot (index, entry->site, entry->size)];
+            s->site = entry->site;
+            s->size = entry->size;
+            if (entry->ordinal + 1 > s->num) {
+                s->num = entry->ordinal + 1;
+            }
+        }
+        for (i=0; i<index->site_capacity; i++) {
+            if (index->sites[i].num) {
+                index->sites[i].by_ordinal = (cuzmem_plan**)calloc (index->sites[i].num, sizeof(cuzmem_plan*));
+            }
+        }
+        for (entry = plan; entry != NULL; entry = entry->next) {
+            if (entry->site == 0) {
+                continue;
+            }
+            s = &index->sites[plan_index_site_slot (index, entry->site, entry->size)];
+            if (s->by_ordinal[entry->ordinal] == NULL) {
+                s->by_ordinal[entry->ordinal] = entry;
             }
-            curr = curr->next;
         }
     }
 
-    fclose (fp);
+    index->by_id = (cuzmem_plan**)calloc (index->num_ids + 1, sizeof(cuzmem_plan*));
+
+    // at most half full, even if every inloop entry has its own size
+    index->inloop_capacity = 8;
+    while (index->inloop_capacity < 2 * num_inloop) {
+        index->inloop_capacity *= 2;
+    }
+    index->inloop_size = (size_t*)malloc (index->inloop_capacity * sizeof(size_t));
+    index->inloop_free = (cuzmem_plan**)calloc (index->inloop_capacity, sizeof(cuzmem_plan*));
+
+    if (!index->by_id || !index->inloop_size || !index->inloop_free) {
+        fprintf (stderr, "libcuzmem: unable to index plan!\n");
+        exit (1);
+    }
+    for (i=0; i<index->inloop_capacity; i++) {
+        index->inloop_size[i] = (size_t)-1;
+    }
+
+    // populate (every inloop size gets a key, even if its entries are
+    // all allocated right now, so the keys never change after this)
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->id >= 0 && index->by_id[entry->id] == NULL) {
+            index->by_id[entry->id] = entry;
+        }
+        entry->free_next = NULL;
+        entry->free_prev = NULL;
+        if (entry->inloop) {
+            i = plan_index_slot (index, entry->size);
+            if (index->inloop_size[i] != entry->size) {
+                index->inloop_size[i] = entry->size;
+                index->inloop_sizes++;
+            }
+            if (entry->gpu_pointer == NULL) {
+                plan_index_push_inloop (index, entry);
+            }
+        }
+    }
 }
 
-int
-check_plan (const char* project_name, const char* plan_name)
+
+cuzmem_plan*
+plan_index_lookup (cuzmem_plan_index* index, unsigned long long id)
 {
-    struct stat st;
-    char filename[FILENAME_MAX];
+    if (id >= index->num_ids) {
+        return NULL;
+    }
+    return index->by_id[id];
+}
 
-    sprintf (filename, "%s/.%s/%s.plan", getenv ("HOME"), project_name, plan_name);
 
-    if (stat (filename, &st) != 0) {
-        // plan does not exist
-        return 1;
-    } else {
-        // plan does exist
-        return 0;
+// entry for the next allocation of size bytes from call site site
+// (NULL if the plan has no more of them)
+cuzmem_plan*
+plan_index_lookup_site (cuzmem_plan_index* index, unsigned long long site, size_t size)
+{
+    unsigned int ordinal;
+    cuzmem_plan_site* s;
+
+    if (index->site_capacity == 0 || site == 0) {
+        return NULL;
+    }
+
+    s = &index->sites[plan_index_site_slot (index, site, size)];
+    if (s->site == 0) {
+        return NULL;
+    }
+
+    ordinal = __sync_fetch_and_add (&s->next_ordinal, 1);
+    if (ordinal >= s->num) {
+        return NULL;
+    }
+
+    return s->by_ordinal[ordinal];
+}
+
+
+// give size a (so far empty) free list, growing the inloop table if it
+// would be more than half full.  This is how the 0th tuning iteration,
+// which doesn't know its sizes up front, keeps the entries it has freed
+// NOTE: must not race with the other plan_index calls (0th iteration:
+//       the tune_lock is held)
+void
+plan_index_add_size (cuzmem_plan_index* index, size_t size)
+{
+    unsigned int i, j, old_capacity = index->inloop_capacity;
+    size_t* old_size = index->inloop_size;
+    cuzmem_plan** old_free = index->inloop_free;
+
+    if (old_capacity != 0) {
+        i = plan_index_slot (index, size);
+        if (index->inloop_size[i] == size) {
+            return;
+        }
+    }
+
+    if (2 * (index->inloop_sizes + 1) > old_capacity) {
+        index->inloop_capacity = old_capacity ? 2 * old_capacity : 8;
+        index->inloop_size = (size_t*)malloc (index->inloop_capacity * sizeof(size_t));
+        index->inloop_free = (cuzmem_plan**)calloc (index->inloop_capacity, sizeof(cuzmem_plan*));
+        if (!index->inloop_size || !index->inloop_free) {
+            fprintf (stderr, "libcuzmem: unable to index plan!\n");
+            exit (1);
+        }
+        for (i=0; i<index->inloop_capacity; i++) {
+            index->inloop_size[i] = (size_t)-1;
+        }
+        for (j=0; j<old_capacity; j++) {
+            if (old_size[j] != (size_t)-1) {
+                i = plan_index_slot (index, old_size[j]);
+                index->inloop_size[i] = old_size[j];
+                index->inloop_free[i] = old_free[j];
+            }
+        }
+        free (old_size);
+        free (old_free);
+    }
+
+    i = plan_index_slot (index, size);
+    index->inloop_size[i] = size;
+    index->inloop_sizes++;
+}
+
+
+// take an unallocated inloop entry of the requested size
+cuzmem_plan*
+plan_index_pop_inloop (cuzmem_plan_index* index, size_t size)
+{
+    unsigned int i;
+    cuzmem_plan* entry;
+
+    if (index->inloop_capacity == 0) {
+        return NULL;
+    }
+
+    i = plan_index_slot (index, size);
+    SLOT_LOCK (index, i);
+    entry = index->inloop_free[i];
+    if (entry != NULL) {
+        index->inloop_free[i] = entry->free_next;
+        if (entry->free_next) {
+            entry->free_next->free_prev = NULL;
+        }
+        entry->free_next = NULL;
     }
+    SLOT_UNLOCK (index, i);
+
+    return entry;
+}
+
+
+// return an inloop entry (which has just been freed) to its list
+void
+plan_index_push_inloop (cuzmem_plan_index* index, cuzmem_plan* entry)
+{
+    unsigned int i = plan_index_slot (index, entry->size);
+
+    SLOT_LOCK (index, i);
+    entry->free_prev = NULL;
+    entry->free_next = index->inloop_free[i];
+    if (entry->free_next) {
+        entry->free_next->free_prev = entry;
+    }
+    index->inloop_free[i] = entry;
+    SLOT_UNLOCK (index, i);
+}
+
+
+// remove a specific inloop entry from its list (it is being allocated
+// by id rather than popped by size)
+// returns:
+//   1 if the entry was unlinked (caller now owns it)
+//   0 if it was not on a list (someone else already took it)
+int
+plan_index_unlink_inloop (cuzmem_plan_index* index, cuzmem_plan* entry)
+{
+    unsigned int i = plan_index_slot (index, entry->size);
+    int unlinked = 1;
+
+    SLOT_LOCK (index, i);
+    if (entry->free_prev) {
+        entry->free_prev->free_next = entry->free_next;
+    }
+    else if (index->inloop_free[i] == entry) {
+        index->inloop_free[i] = entry->free_next;
+    }
+    else {
+        unlinked = 0;
+    }
+    if (unlinked) {
+        if (entry->free_next) {
+            entry->free_next->free_prev = entry->free_prev;
+        }
+        entry->free_next = NULL;
+        entry->free_prev = NULL;
+    }
+    SLOT_UNLOCK (index, i);
+
+    return unlinked;
 }
@@ -19,24 +19,125 @@
 #define _plans_h_
 
 #include <stdlib.h>
+#include <pthread.h>
 #include <cuda.h>
 
+#define PLAN_INDEX_LOCKS 64     // must be a power of 2
+
+#define PLAN_EXT_TEXT    "plan"
+#define PLAN_EXT_BIN     "planb"
+#define PLAN_MAGIC       0x505a5543     // "CUZP"
+#define PLAN_VERSION     4
+
 // -- Plan structure -----------------------------
 typedef struct cuzmem_plan_entry cuzmem_plan;
 struct cuzmem_plan_entry
 {
     int id;
+    int gene;          // knobs sharing a gene are placed together
     size_t size;
     int loc;           // 0: pinned cpu, 1: gpu global
     int inloop;        // 0: false     , 1: true
     int first_hit;     // 0: false     , 1: true
     int gold_member;   // 0: false     , 1: true
 
+    unsigned long long alloc_stamp;  // ctx clock at most recent alloc
+    unsigned long long gold_stamp;   // peak this entry was live for
+    unsigned long long site;         // call site hash (0: unknown)
+    unsigned int ordinal;            // # of earlier knobs of this site & size
+
     void* gpu_pointer;
     void* cpu_pointer;
     CUdeviceptr gpu_dptr;
+    size_t block_size;          // bytes actually backing gpu_pointer
+
+    // backing kept from the previous tuning iteration (retain mode)
+    void* kept_gpu_pointer;     // NULL: nothing kept
+    void* kept_cpu_pointer;
+    size_t kept_block_size;
+    int kept_loc;
 
     cuzmem_plan* next;
+    cuzmem_plan* free_next;     // free inloop list (RUN mode & 0th cycle)
+    cuzmem_plan* free_prev;
+};
+// -----------------------------------------------
+
+// -- Device Fingerprint -------------------------
+// identifies the GPU a plan was tuned on (all zero if unknown)
+typedef struct cuzmem_device_fp_struct cuzmem_device_fp;
+struct cuzmem_device_fp_struct
+{
+    char name[64];
+    unsigned long long total_mem;
+    int cc_major;
+    int cc_minor;
+    int driver_version;
+    int pad;
+};
+// -----------------------------------------------
+
+// -- Binary Plan File layout --------------------
+// header followed by num_entries records sorted by id
+// (native byte order; the file is mmap()ed and read in place)
+typedef struct cuzmem_plan_header_struct cuzmem_plan_header;
+struct cuzmem_plan_header_struct
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int num_entries;
+    unsigned int entry_size;    // sizeof(cuzmem_plan_record)
+    unsigned int checksum;      // FNV-1a of the records
+    unsigned int reserved;
+    cuzmem_device_fp device;    // GPU the plan was tuned on
+};
+
+typedef struct cuzmem_plan_record_struct cuzmem_plan_record;
+struct cuzmem_plan_record_struct
+{
+    unsigned long long size;
+    unsigned long long site;
+    int id;
+    int gene;
+    unsigned int ordinal;
+    unsigned char loc;
+    unsigned char inloop;
+    unsigned char pad[2];
+};
+// -----------------------------------------------
+
+// -- Plan Index structure -----------------------
+// built once when a plan is loaded so that RUN mode allocation
+// decisions never walk the plan:
+//   by_id[]       : knob id -> entry
+//   sites[]       : open addressed table, (call site, size) -> entries
+//                   by ordinal, plus how many have been asked for
+//   inloop_*[]    : open addressed table, size -> list of currently
+//                   unallocated inloop entries of that size
+// by_id[] and the tables' keys never change after the build, so
+// lookups take no locks; the lists are guarded by striped locks.
+typedef struct cuzmem_plan_site_struct cuzmem_plan_site;
+struct cuzmem_plan_site_struct
+{
+    unsigned long long site;    // 0: empty slot
+    size_t size;
+    cuzmem_plan** by_ordinal;
+    unsigned int num;
+    unsigned int next_ordinal;  // bumped atomically by each lookup
+};
+
+typedef struct cuzmem_plan_index_struct cuzmem_plan_index;
+struct cuzmem_plan_index_struct
+{
+    cuzmem_plan** by_id;
+    unsigned int num_ids;
+    cuzmem_plan_site* sites;
+    unsigned int site_capacity;     // power of 2 (0: plan has no sites)
+    size_t* inloop_size;
+    cuzmem_plan** inloop_free;
+    unsigned int inloop_capacity;   // power of 2
+    unsigned int inloop_sizes;      // keys in use
+    pthread_mutex_t inloop_lock[PLAN_INDEX_LOCKS];
 };
 // -----------------------------------------------
 
@@ -48,14 +149,65 @@ extern "C" {
 size_t
 rm_whitespace (char *str);
 
+int
+plan_filename (char* filename, const char* project_name, const char* plan_name, const char* ext);
+
+void
+make_project_directory (char *project_name);
+
+void
+plan_device_tag (const cuzmem_device_fp* dev, char* tag, size_t len);
+
+int
+plan_is_binary (const char* filename);
+
+cuzmem_plan*
+read_plan_text (const char* filename, cuzmem_device_fp* dev);
+
+cuzmem_plan*
+read_plan_bin (const char* filename, cuzmem_device_fp* dev);
+
+int
+write_plan_text (cuzmem_plan* plan, const cuzmem_device_fp* dev, const char* filename);
+
+int
+write_plan_bin (cuzmem_plan* plan, const cuzmem_device_fp* dev, const char* filename);
+
+cuzmem_plan*
+read_plan (char *project_name, char *plan_name, const cuzmem_device_fp* dev);
+
+void
+write_plan (cuzmem_plan* plan, char *project_name, char *plan_name, const cuzmem_device_fp* dev);
+
+int
+check_plan (const char* project_name, const char* plan_name, const cuzmem_device_fp* dev);
+
+void
+plan_index_init (cuzmem_plan_index* index);
+
+void
+plan_index_build (cuzmem_plan_index* index, cuzmem_plan* plan);
+
+void
+plan_index_destroy (cuzmem_plan_index* index);
+
+cuzmem_plan*
+plan_index_lookup (cuzmem_plan_index* index, unsigned long long id);
+
+cuzmem_plan*
+plan_index_lookup_site (cuzmem_plan_index* index, unsigned long long site, size_t size);
+
+void
+plan_index_add_size (cuzmem_plan_index* index, size_t size);
+
 cuzmem_plan*
-read_plan (char *project_name, char *plan_name);
+plan_index_pop_inloop (cuzmem_plan_index* index, size_t size);
 
 void
-write_plan (cuzmem_plan* plan, char *project_name, char *plan_name);
+plan_index_push_inloop (cuzmem_plan_index* index, cuzmem_plan* entry);
 
 int
-check_plan (const char* project_name, const char* plan_name);
+plan_index_unlink_inloop (cuzmem_plan_index* index, cuzmem_plan* entry);
 
 #if defined __cplusplus
 };
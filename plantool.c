@@ -0,0 +1,109 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "plans.h"
+
+// cuzmem-plan: converts plans between the text and binary formats
+//
+//   cuzmem-plan [-t|-b] <in> <out>
+//
+// The input format is detected from the file.  The output format is
+// binary if the output file ends in .planb (or -b is given) and text
+// otherwise (or if -t is given).  The fingerprint of the device the
+// plan was tuned on is carried across.
+
+static int
+usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-t|-b] <in plan> <out plan>\n", prog);
+    fprintf (stderr, "  -t  write text plan\n");
+    fprintf (stderr, "  -b  write binary plan (default for *.%s)\n", PLAN_EXT_BIN);
+    return 1;
+}
+
+int
+main (int argc, char** argv)
+{
+    int i, n, binary = -1;
+    const char *in = NULL, *out = NULL;
+    const char *ext;
+    char tag[128];
+    cuzmem_plan *plan, *curr;
+    cuzmem_device_fp dev;
+
+    for (i=1; i<argc; i++) {
+        if (!strcmp (argv[i], "-t")) {
+            binary = 0;
+        }
+        else if (!strcmp (argv[i], "-b")) {
+            binary = 1;
+        }
+        else if (in == NULL) {
+            in = argv[i];
+        }
+        else if (out == NULL) {
+            out = argv[i];
+        }
+        else {
+            return usage (argv[0]);
+        }
+    }
+    if (in == NULL || out == NULL) {
+        return usage (argv[0]);
+    }
+
+    if (binary == -1) {
+        ext = strrchr (out, '.');
+        binary = (ext != NULL && !strcmp (ext+1, PLAN_EXT_BIN));
+    }
+
+    if (plan_is_binary (in)) {
+        plan = read_plan_bin (in, &dev);
+    } else {
+        plan = read_plan_text (in, &dev);
+    }
+    if (plan == NULL) {
+        fprintf (stderr, "%s: unable to read plan %s\n", argv[0], in);
+        return 1;
+    }
+
+    if (binary) {
+        i = write_plan_bin (plan, &dev, out);
+    } else {
+        i = write_plan_text (plan, &dev, out);
+    }
+    if (i != 0) {
+        fprintf (stderr, "%s: unable to write plan %s\n", argv[0], out);
+        return 1;
+    }
+
+    for (n=0, curr=plan; curr != NULL; curr = curr->next) {
+        n++;
+    }
+    fprintf (stderr, "%s: wrote %i entries to %s (%s)\n",
+            argv[0], n, out, binary ? "binary" : "text");
+    if (dev.total_mem) {
+        plan_device_tag (&dev, tag, sizeof(tag));
+        fprintf (stderr, "%s: plan was tuned on %s\n", argv[0], tag);
+    }
+
+    // NOTE: plan memory is simply left to the OS
+    return 0;
+}
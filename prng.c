@@ -0,0 +1,60 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "prng.h"
+
+//------------------------------------------------------------------------------
+// PRNG INTERFACE
+//------------------------------------------------------------------------------
+void
+prng_seed (cuzmem_prng* p, unsigned long long seed)
+{
+    // splitmix the seed so that nearby seeds give unrelated streams
+    seed += 0x9E3779B97F4A7C15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+    seed ^= seed >> 31;
+
+    p->s = seed ? seed : 0x9E3779B97F4A7C15ULL;
+}
+
+
+// 64 random bits
+unsigned long long
+prng_next (cuzmem_prng* p)
+{
+    p->s ^= p->s >> 12;
+    p->s ^= p->s << 25;
+    p->s ^= p->s >> 27;
+    return p->s * 0x2545F4914F6CDD1DULL;
+}
+
+
+// uniform in [0, 1)
+double
+prng_uniform (cuzmem_prng* p)
+{
+    return (double)(prng_next (p) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// uniform in [0, n)
+unsigned int
+prng_below (cuzmem_prng* p, unsigned int n)
+{
+    return n ? (unsigned int)(prng_uniform (p) * n) : 0;
+}
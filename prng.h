@@ -0,0 +1,52 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _prng_h_
+#define _prng_h_
+
+// -- Pseudo Random Number Generator -------------
+// xorshift64*: small, fast & reproducible from its seed (unlike rand(),
+// whose sequence is shared with the application)
+typedef struct cuzmem_prng_struct cuzmem_prng;
+struct cuzmem_prng_struct
+{
+    unsigned long long s;       // never 0
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+prng_seed (cuzmem_prng* p, unsigned long long seed);
+
+unsigned long long
+prng_next (cuzmem_prng* p);
+
+double
+prng_uniform (cuzmem_prng* p);
+
+unsigned int
+prng_below (cuzmem_prng* p, unsigned int n);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
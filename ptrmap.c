@@ -0,0 +1,239 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "ptrmap.h"
+
+// marks a slot whose key has been removed.  Device pointers and
+// mapped pinned pointers are always aligned, so 0x1 is never a key.
+#define TOMBSTONE ((void*)0x1)
+
+// NOTES
+//
+// * Linear probing over a power of 2 table.  Removal leaves a tombstone
+//   so that probe chains stay intact; tombstones are swept out whenever
+//   the table is rebuilt.
+//
+// * The table is rebuilt when live keys + tombstones exceed 3/4 of the
+//   capacity.  If most of that load is tombstones we rebuild at the same
+//   size, so a steady malloc/free cycle never grows the table.
+//
+// * The map is split into PTRMAP_SHARDS tables, each with its own lock.
+//   The top bits of the hash pick the shard, the low bits the slot.
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+
+// Fibonacci hash of a pointer (low bits are alignment, so drop them)
+static unsigned long long
+ptr_hash (void* ptr)
+{
+    unsigned long long h = ((uintptr_t)ptr) >> 4;
+    return h * 0x9E3779B97F4A7C15ULL;
+}
+
+static cuzmem_ptrmap_shard*
+ptr_shard (cuzmem_ptrmap* map, unsigned long long h)
+{
+    return &map->shard[(h >> 58) & (PTRMAP_SHARDS - 1)];
+}
+
+static unsigned int
+ptr_slot (unsigned long long h, unsigned int capacity)
+{
+    return (unsigned int)(h >> 16) & (capacity - 1);
+}
+
+
+static void
+shard_rebuild (cuzmem_ptrmap_shard* shard, unsigned int capacity)
+{
+    unsigned int i, j;
+    void** old_keys = shard->keys;
+    cuzmem_plan** old_vals = shard->vals;
+    unsigned int old_capacity = shard->capacity;
+
+    shard->keys = (void**)calloc (capacity, sizeof(void*));
+    shard->vals = (cuzmem_plan**)calloc (capacity, sizeof(cuzmem_plan*));
+    if (shard->keys == NULL || shard->vals == NULL) {
+        fprintf (stderr, "libcuzmem: unable to grow pointer map!\n");
+        exit (1);
+    }
+    shard->capacity = capacity;
+    shard->used = shard->count;
+
+    for (i=0; i<old_capacity; i++) {
+        if (old_keys[i] == NULL || old_keys[i] == TOMBSTONE) {
+            continue;
+        }
+        j = ptr_slot (ptr_hash (old_keys[i]), capacity);
+        while (shard->keys[j] != NULL) {
+            j = (j + 1) & (capacity - 1);
+        }
+        shard->keys[j] = old_keys[i];
+        shard->vals[j] = old_vals[i];
+    }
+
+    free (old_keys);
+    free (old_vals);
+}
+
+
+//------------------------------------------------------------------------------
+// POINTER MAP INTERFACE
+//------------------------------------------------------------------------------
+void
+ptrmap_init (cuzmem_ptrmap* map)
+{
+    unsigned int s;
+
+    for (s=0; s<PTRMAP_SHARDS; s++) {
+        map->shard[s].keys = NULL;
+        map->shard[s].vals = NULL;
+        map->shard[s].capacity = 0;
+        map->shard[s].count = 0;
+        map->shard[s].used = 0;
+        pthread_mutex_init (&map->shard[s].lock, NULL);
+    }
+}
+
+
+void
+ptrmap_destroy (cuzmem_ptrmap* map)
+{
+    unsigned int s;
+
+    for (s=0; s<PTRMAP_SHARDS; s++) {
+        free (map->shard[s].keys);
+        free (map->shard[s].vals);
+        pthread_mutex_destroy (&map->shard[s].lock);
+    }
+}
+
+
+void
+ptrmap_insert (cuzmem_ptrmap* map, void* ptr, cuzmem_plan* entry)
+{
+    unsigned int i;
+    unsigned int tomb = UINT32_MAX;
+    unsigned long long h = ptr_hash (ptr);
+    cuzmem_ptrmap_shard* shard = ptr_shard (map, h);
+
+    pthread_mutex_lock (&shard->lock);
+
+    if ((shard->used + 1) * 4 > shard->capacity * 3) {
+        unsigned int capacity = shard->capacity;
+        if (capacity == 0) {
+            capacity = PTRMAP_MIN_CAPACITY;
+        }
+        else if ((shard->count + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        shard_rebuild (shard, capacity);
+    }
+
+    i = ptr_slot (h, shard->capacity);
+    while (shard->keys[i] != NULL) {
+        if (shard->keys[i] == ptr) {
+            // pointer already mapped: just update it
+            shard->vals[i] = entry;
+            pthread_mutex_unlock (&shard->lock);
+            return;
+        }
+        if (shard->keys[i] == TOMBSTONE && tomb == UINT32_MAX) {
+            tomb = i;
+        }
+        i = (i + 1) & (shard->capacity - 1);
+    }
+
+    // reuse the first tombstone on the probe chain if we passed one
+    if (tomb != UINT32_MAX) {
+        i = tomb;
+    } else {
+        shard->used++;
+    }
+    shard->keys[i] = ptr;
+    shard->vals[i] = entry;
+    shard->count++;
+
+    pthread_mutex_unlock (&shard->lock);
+}
+
+
+cuzmem_plan*
+ptrmap_lookup (cuzmem_ptrmap* map, void* ptr)
+{
+    unsigned int i;
+    unsigned long long h = ptr_hash (ptr);
+    cuzmem_ptrmap_shard* shard = ptr_shard (map, h);
+    cuzmem_plan* entry = NULL;
+
+    if (ptr == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock (&shard->lock);
+    if (shard->capacity != 0) {
+        i = ptr_slot (h, shard->capacity);
+        while (shard->keys[i] != NULL) {
+            if (shard->keys[i] == ptr) {
+                entry = shard->vals[i];
+                break;
+            }
+            i = (i + 1) & (shard->capacity - 1);
+        }
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    return entry;
+}
+
+
+cuzmem_plan*
+ptrmap_remove (cuzmem_ptrmap* map, void* ptr)
+{
+    unsigned int i;
+    unsigned long long h = ptr_hash (ptr);
+    cuzmem_ptrmap_shard* shard = ptr_shard (map, h);
+    cuzmem_plan* entry = NULL;
+
+    if (ptr == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock (&shard->lock);
+    if (shard->capacity != 0) {
+        i = ptr_slot (h, shard->capacity);
+        while (shard->keys[i] != NULL) {
+            if (shard->keys[i] == ptr) {
+                entry = shard->vals[i];
+                shard->keys[i] = TOMBSTONE;
+                shard->vals[i] = NULL;
+                shard->count--;
+                break;
+            }
+            i = (i + 1) & (shard->capacity - 1);
+        }
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    return entry;
+}
@@ -0,0 +1,73 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _ptrmap_h_
+#define _ptrmap_h_
+
+#include <pthread.h>
+#include "plans.h"
+
+#define PTRMAP_MIN_CAPACITY 64
+#define PTRMAP_SHARDS       16      // must be a power of 2
+
+// -- Pointer Map structure ----------------------
+// open addressed hash table: gpu pointer -> plan entry
+// (split into independently locked shards so that
+//  concurrent cudaFree()s rarely contend)
+typedef struct cuzmem_ptrmap_shard_struct cuzmem_ptrmap_shard;
+struct cuzmem_ptrmap_shard_struct
+{
+    void** keys;
+    cuzmem_plan** vals;
+    unsigned int capacity;     // always a power of 2
+    unsigned int count;        // live keys
+    unsigned int used;         // live keys + tombstones
+    pthread_mutex_t lock;
+};
+
+typedef struct cuzmem_ptrmap_struct cuzmem_ptrmap;
+struct cuzmem_ptrmap_struct
+{
+    cuzmem_ptrmap_shard shard[PTRMAP_SHARDS];
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+ptrmap_init (cuzmem_ptrmap* map);
+
+void
+ptrmap_destroy (cuzmem_ptrmap* map);
+
+void
+ptrmap_insert (cuzmem_ptrmap* map, void* ptr, cuzmem_plan* entry);
+
+cuzmem_plan*
+ptrmap_lookup (cuzmem_ptrmap* map, void* ptr);
+
+cuzmem_plan*
+ptrmap_remove (cuzmem_ptrmap* map, void* ptr);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
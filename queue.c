@@ -0,0 +1,753 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cuda.h>
+#include "plans.h"
+#include "memo.h"
+#include "checkpoint.h"
+#include "queue.h"
+
+// NOTES
+//
+// * A coordinated tuning session is several processes running the same
+//   application, one per gpu, each with a rank in CUZMEM_QUEUE_RANK.
+//   Rank 0 is the leader: it runs the tuner as usual.  The others are
+//   workers: after their own trace iteration they only run candidates
+//   the leader offers (see tuner_worker.c) and report their fitness.
+//
+// * The queue is a directory next to the plan, ~/.project/plan.queue/,
+//   so there is nothing to set up and nothing but the file system in
+//   between.  Every file is written under a temporary name & renamed
+//   into place, so a file that exists is complete:
+//
+//     leader        session header: leader pid, # of genes, trace shape
+//     cand.N        candidate N offered by the leader (its genome)
+//     claim.N       pid of the process running candidate N
+//     done.N        what a worker measured for candidate N
+//     worker.R      worker R has joined the session
+//     stop          tuning is over (and the final placement)
+//
+//   A candidate is claimed by creating claim.N with O_EXCL, so exactly
+//   one process runs it.  The queue must be on a local file system.
+//
+// * Tuners offer drafts they know they will look up later (a whole
+//   genetic generation, the greedy sweep, the next exhaustive drafts).
+//   When a tuner looks a draft up (lookup_fitness() in tuner_util.c) the
+//   leader takes in every result workers have written back into the
+//   memo, then: a draft a worker is running is waited for and comes
+//   back as a memo hit; one nobody has taken yet is claimed and run by
+//   the leader itself.  So the search is exactly the search a single
+//   process would make (and is bounded the same way), only most of its
+//   runs happen elsewhere.  Tuners whose next draft depends on the last
+//   measurement (annealing, surrogate) offer nothing and so still run
+//   one candidate at a time, on the leader.
+//
+// * A worker's result goes into the memo under the placement it really
+//   ran and, if that differs, under the draft (as MEMO_DRAFTED), just as
+//   memo_store() does for the leader's own runs (a placement that split
+//   a gene is only stored under the draft).
+//
+// * The leader clears the directory when it starts tuning.  Workers may
+//   be started before or after it; they join the session whose header
+//   they see, as long as it traced the same allocations.  A worker that
+//   sees no live leader for CUZMEM_QUEUE_TIMEOUT s (default 60) stops
+//   tuning.  A candidate whose worker died (or whose claim names no
+//   process QUEUE_CLAIM_CHECKS s in a row) is run by the leader, as is
+//   one that isn't back after CUZMEM_QUEUE_TIMEOUT s.
+//
+// * Each process picks gpu (rank % # of gpus) when libcuzmem creates
+//   the CUDA context (a context the runtime already made is used as is).
+
+
+typedef struct queue_header_struct queue_header;
+struct queue_header_struct
+{
+    unsigned int magic;
+    int pid;
+    unsigned int num_genes;
+    unsigned int pad;
+    unsigned long long shape;       // see plan_shape()
+};
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+// returns 0 if snprintf() wrote all len characters of path, 1 (and an
+// empty path) if they didn't fit: a shortened path names another file
+static int
+path_truncated (char* path, int len)
+{
+    if (len < 0 || len >= FILENAME_MAX) {
+        fprintf (stderr, "libcuzmem: queue: path %.64s... is too long\n", path);
+        path[0] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+
+// path of queue file name.seq.  returns 0 on success, 1 if too long
+static int
+queue_path (const cuzmem_queue* q, char* path, const char* name, unsigned int seq)
+{
+    return path_truncated (path, snprintf (path, FILENAME_MAX, "%s/%s.%u", q->dir, name, seq));
+}
+
+
+// path of queue file name.  returns 0 on success, 1 if too long
+static int
+queue_file (const cuzmem_queue* q, char* path, const char* name)
+{
+    return path_truncated (path, snprintf (path, FILENAME_MAX, "%s/%s", q->dir, name));
+}
+
+
+// hash of the trace a plan came from: processes with the same
+// shape agree on what every gene of a genome means
+static unsigned long long
+plan_shape (const cuzmem_plan* plan)
+{
+    unsigned long long h = 0xCBF29CE484222325ULL;
+
+    for (; plan != NULL; plan = plan->next) {
+        h = (h ^ (unsigned long long)plan->id) * 0x100000001B3ULL;
+        h = (h ^ (unsigned long long)plan->gene) * 0x100000001B3ULL;
+        h = (h ^ (unsigned long long)plan->size) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+
+static int
+alive (pid_t pid)
+{
+    return (kill (pid, 0) == 0 || errno == EPERM);
+}
+
+
+// opens a temporary file for path (queue_commit() puts it in place)
+static int
+queue_create (const char* path, char* tmpname, cuzmem_ckpt* ck)
+{
+    if (path_truncated (tmpname, snprintf (tmpname, FILENAME_MAX, "%s.%d.tmp", path, (int)getpid ()))) {
+        ck->fp = NULL;
+        ck->ok = 0;
+        return 0;
+    }
+    ck->fp = fopen (tmpname, "wb");
+    ck->ok = (ck->fp != NULL);
+    if (!ck->ok) {
+        fprintf (stderr, "libcuzmem: queue: unable to write %s\n", tmpname);
+    }
+    return ck->ok;
+}
+
+
+// returns 0 if the file is in place
+static int
+queue_commit (const char* path, const char* tmpname, cuzmem_ckpt* ck)
+{
+    if (fclose (ck->fp) != 0) {
+        ck->ok = 0;
+    }
+    if (!ck->ok || rename (tmpname, path) != 0) {
+        fprintf (stderr, "libcuzmem: queue: unable to write %s\n", path);
+        unlink (tmpname);
+        return 1;
+    }
+    return 0;
+}
+
+
+static void
+write_header (const char* path, const cuzmem_plan* plan,
+              const cuzmem_bitset* genome, unsigned int num_genes)
+{
+    char tmpname[FILENAME_MAX];
+    queue_header h;
+    cuzmem_ckpt ck;
+
+    memset (&h, 0, sizeof(h));
+    h.magic = QUEUE_MAGIC;
+    h.pid = (int)getpid ();
+    h.num_genes = num_genes;
+    h.shape = plan_shape (plan);
+
+    if (!queue_create (path, tmpname, &ck)) {
+        return;
+    }
+    ckpt_put (&ck, &h, sizeof(h));
+    if (genome != NULL) {
+        ckpt_put_bitset (&ck, genome);
+    }
+    queue_commit (path, tmpname, &ck);
+}
+
+
+// reads the header of the leader or stop file (and the genome that
+// follows, if genome is as wide).  returns 1 if there is one
+static int
+read_header (const cuzmem_queue* q, const char* name, queue_header* h, cuzmem_bitset* genome)
+{
+    char path[FILENAME_MAX];
+    cuzmem_ckpt ck;
+
+    if (queue_file (q, path, name)) {
+        return 0;
+    }
+    ck.fp = fopen (path, "rb");
+    if (ck.fp == NULL) {
+        return 0;
+    }
+    ck.ok = 1;
+    ckpt_get (&ck, h, sizeof(queue_header));
+    if (ck.ok && genome != NULL && h->num_genes == genome->nbits && h->num_genes > 0) {
+        ckpt_get_bitset (&ck, genome);
+    }
+    fclose (ck.fp);
+
+    return (ck.ok && h->magic == QUEUE_MAGIC);
+}
+
+
+// claims candidate seq for this process.  returns 1 if we got it
+static int
+claim (const cuzmem_queue* q, unsigned int seq)
+{
+    char path[FILENAME_MAX];
+    int fd, pid = (int)getpid ();
+
+    if (queue_path (q, path, "claim", seq)) {
+        return 0;
+    }
+    fd = open (path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    if (write (fd, &pid, sizeof(pid)) != sizeof(pid)) {
+        fprintf (stderr, "libcuzmem: queue: unable to write %s\n", path);
+    }
+    close (fd);
+    return 1;
+}
+
+
+// pid of the process that claimed candidate seq (0 if unknown)
+static pid_t
+claimant (const cuzmem_queue* q, unsigned int seq)
+{
+    char path[FILENAME_MAX];
+    int fd, pid = 0;
+
+    if (queue_path (q, path, "claim", seq)) {
+        return 0;
+    }
+    fd = open (path, O_RDONLY);
+    if (fd >= 0) {
+        if (read (fd, &pid, sizeof(pid)) != sizeof(pid)) {
+            pid = 0;
+        }
+        close (fd);
+    }
+    return (pid_t)pid;
+}
+
+
+static void
+drop_offer (cuzmem_queue* q, unsigned int i)
+{
+    bitset_destroy (q->offer[i].genome);
+    q->offer[i] = q->offer[--q->num_offers];
+}
+
+
+// puts what a worker measured for offer o into the memo.  returns 1
+// if the worker is done with it
+static int
+read_result (cuzmem_queue* q, const cuzmem_queue_offer* o, cuzmem_memo* m)
+{
+    char path[FILENAME_MAX];
+    double time;
+    int have;
+    cuzmem_ckpt ck;
+    cuzmem_bitset* realized;
+
+    if (queue_path (q, path, "done", o->seq)) {
+        return 0;
+    }
+    ck.fp = fopen (path, "rb");
+    if (ck.fp == NULL) {
+        return 0;
+    }
+    ck.ok = 1;
+
+    realized = bitset_create (o->genome->nbits);
+    ckpt_get (&ck, &have, sizeof(have));
+    if (have) {
+        ckpt_get_bitset (&ck, realized);
+    }
+    ckpt_get (&ck, &time, sizeof(time));
+    fclose (ck.fp);
+
+    if (ck.ok) {
+        if (have) {
+            memo_insert (m, realized, time, MEMO_REALIZED);
+        }
+        if (!have || !bitset_equal (realized, o->genome)) {
+            memo_insert (m, o->genome, time, MEMO_DRAFTED);
+        }
+        q->remote++;
+    } else {
+        // (the draft will simply be run again if it is looked up)
+        fprintf (stderr, "libcuzmem: queue: ignoring unreadable %s\n", path);
+    }
+    bitset_destroy (realized);
+
+    return 1;
+}
+
+
+// takes in every result workers have written back
+static void
+collect (cuzmem_queue* q, cuzmem_memo* m)
+{
+    unsigned int i = 0;
+
+    while (i < q->num_offers) {
+        if (read_result (q, &q->offer[i], m)) {
+            drop_offer (q, i);
+        } else {
+            i++;
+        }
+    }
+}
+
+
+// claims the lowest offered candidate nobody has taken.  returns 1
+// (and the candidate's genome) if there was one
+static int
+take_next (cuzmem_queue* q, cuzmem_bitset* genome)
+{
+    char path[FILENAME_MAX];
+    cuzmem_ckpt ck;
+
+    for (;; q->cursor++) {
+        if (queue_path (q, path, "cand", q->cursor) || access (path, F_OK) != 0) {
+            // not offered (yet)
+            return 0;
+        }
+        if (!claim (q, q->cursor)) {
+            continue;
+        }
+
+        ck.fp = fopen (path, "rb");
+        ck.ok = (ck.fp != NULL);
+        if (ck.ok) {
+            ckpt_get_bitset (&ck, genome);
+            fclose (ck.fp);
+        }
+        if (!ck.ok) {
+            // give it back: the leader will run it
+            fprintf (stderr, "libcuzmem: queue: unable to read %s\n", path);
+            if (!queue_path (q, path, "claim", q->cursor)) {
+                unlink (path);
+            }
+            continue;
+        }
+
+        q->seq = q->cursor++;
+        q->taken++;
+        return 1;
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// CANDIDATE QUEUE INTERFACE
+//------------------------------------------------------------------------------
+void
+queue_init (cuzmem_queue* q)
+{
+    char* env;
+
+    memset (q, 0, sizeof(cuzmem_queue));
+    q->role = QUEUE_OFF;
+    q->timeout = QUEUE_TIMEOUT;
+
+    env = getenv ("CUZMEM_QUEUE_RANK");
+    if (env != NULL && *env != '\0' && atoi (env) >= 0) {
+        q->rank = (unsigned int)atoi (env);
+        q->role = q->rank ? QUEUE_WORKER : QUEUE_LEADER;
+    }
+
+    env = getenv ("CUZMEM_QUEUE_TIMEOUT");
+    if (env != NULL) {
+        q->timeout = (unsigned int)atoi (env);
+    }
+}
+
+
+void
+queue_destroy (cuzmem_queue* q)
+{
+    while (q->num_offers > 0) {
+        drop_offer (q, q->num_offers - 1);
+    }
+    free (q->offer);
+    q->offer = NULL;
+    q->max_offers = 0;
+}
+
+
+// the gpu this process should create its CUDA context on
+CUdevice
+queue_device (const cuzmem_queue* q, CUdevice dev)
+{
+    int count;
+    CUdevice d;
+
+    if (q->role == QUEUE_OFF) {
+        return dev;
+    }
+    if (cuDeviceGetCount (&count) != CUDA_SUCCESS || count < 2) {
+        return dev;
+    }
+    if (cuDeviceGet (&d, (int)(q->rank % (unsigned int)count)) != CUDA_SUCCESS) {
+        return dev;
+    }
+    return d;
+}
+
+
+// called when tuning starts.  the leader starts a new session
+void
+queue_open (cuzmem_queue* q, const char* project_name, const char* plan_name)
+{
+    char path[FILENAME_MAX];
+    DIR* dir;
+    struct dirent* de;
+
+    if (q->role == QUEUE_OFF) {
+        return;
+    }
+
+    make_project_directory ((char*)project_name);
+    if (plan_filename (q->dir, project_name, plan_name, QUEUE_EXT) ||
+        (mkdir (q->dir, 0755) != 0 && errno != EEXIST)) {
+        fprintf (stderr, "libcuzmem: queue: unable to create %s, tuning alone\n", q->dir);
+        q->role = QUEUE_OFF;
+        return;
+    }
+
+    if (q->role == QUEUE_LEADER) {
+        // whatever an earlier session left behind
+        dir = opendir (q->dir);
+        while (dir != NULL && (de = readdir (dir)) != NULL) {
+            if (de->d_name[0] != '.' && !queue_file (q, path, de->d_name)) {
+                unlink (path);
+            }
+        }
+        if (dir != NULL) {
+            closedir (dir);
+        }
+        queue_destroy (q);
+        q->published = 0;
+        q->next_seq = 0;
+        fprintf (stderr, "libcuzmem: queue: leading tuning session in %s\n", q->dir);
+    } else {
+        q->leader = 0;
+        q->cursor = 0;
+    }
+}
+
+
+// leader: lets workers join (once the search space is known)
+void
+queue_publish (cuzmem_queue* q, const cuzmem_plan* plan, unsigned int num_genes)
+{
+    char path[FILENAME_MAX];
+
+    if (q->role != QUEUE_LEADER || q->published) {
+        return;
+    }
+    if (queue_file (q, path, "leader")) {
+        return;
+    }
+    write_header (path, plan, NULL, num_genes);
+    q->published = 1;
+}
+
+
+// leader: a draft the tuner will look up later.  a worker may run it
+// in the meantime (unless it is in the memo or offered already)
+void
+queue_offer (cuzmem_queue* q, const cuzmem_memo* m, const cuzmem_bitset* genome)
+{
+    char path[FILENAME_MAX];
+    char tmpname[FILENAME_MAX];
+    unsigned int i;
+    double time;
+    cuzmem_ckpt ck;
+
+    if (q->role != QUEUE_LEADER) {
+        return;
+    }
+    if (memo_find (m, genome, &time) != MEMO_MISS) {
+        return;
+    }
+    for (i=0; i<q->num_offers; i++) {
+        if (bitset_equal (q->offer[i].genome, genome)) {
+            return;
+        }
+    }
+
+    if (queue_path (q, path, "cand", q->next_seq) || !queue_create (path, tmpname, &ck)) {
+        return;
+    }
+    ckpt_put_bitset (&ck, genome);
+    if (queue_commit (path, tmpname, &ck)) {
+        return;
+    }
+
+    if (q->num_offers == q->max_offers) {
+        q->max_offers = q->max_offers ? 2 * q->max_offers : 16;
+        q->offer = (cuzmem_queue_offer*)realloc (q->offer,
+                        q->max_offers * sizeof(cuzmem_queue_offer));
+        if (q->offer == NULL) {
+            fprintf (stderr, "libcuzmem: unable to grow candidate queue!\n");
+            exit (1);
+        }
+    }
+    q->offer[q->num_offers].seq = q->next_seq++;
+    q->offer[q->num_offers].genome = bitset_clone (genome);
+    q->num_offers++;
+    q->offered++;
+}
+
+
+// leader: call before looking genome up in the memo.  if a worker is
+// running it, waits until its result is in the memo.  if it was offered
+// and nobody has taken it, takes it back (we are about to run it)
+void
+queue_settle (cuzmem_queue* q, cuzmem_memo* m, const cuzmem_bitset* genome)
+{
+    unsigned int i, seq, polls, unnamed = 0;
+    pid_t pid;
+
+    if (q->role != QUEUE_LEADER) {
+        return;
+    }
+
+    collect (q, m);
+    for (i=0; i<q->num_offers; i++) {
+        if (bitset_equal (q->offer[i].genome, genome)) {
+            break;
+        }
+    }
+    if (i == q->num_offers) {
+        return;
+    }
+    seq = q->offer[i].seq;
+
+    if (claim (q, seq)) {
+        drop_offer (q, i);
+        return;
+    }
+
+    for (polls=1; ; polls++) {
+        if (read_result (q, &q->offer[i], m)) {
+            drop_offer (q, i);
+            return;
+        }
+
+        // check up on the worker every second or so.  a claim that
+        // never names a live process is as good as a dead worker
+        if (polls % (1000000 / QUEUE_POLL_US) == 0) {
+            pid = claimant (q, seq);
+            if (pid > 0 && alive (pid)) {
+                unnamed = 0;
+            } else if (pid > 0 || ++unnamed >= QUEUE_CLAIM_CHECKS) {
+                fprintf (stderr, "libcuzmem: queue: worker (pid %d) died running candidate %u, running it here\n",
+                        (int)pid, seq);
+                drop_offer (q, i);
+                return;
+            }
+        }
+
+        // (a late result is simply not used)
+        if ((unsigned long long)polls * QUEUE_POLL_US >= (unsigned long long)q->timeout * 1000000ULL) {
+            fprintf (stderr, "libcuzmem: queue: candidate %u not back after %u s, running it here\n",
+                    seq, q->timeout);
+            drop_offer (q, i);
+            return;
+        }
+        usleep (QUEUE_POLL_US);
+    }
+}
+
+
+// leader: # of workers that have joined the session
+unsigned int
+queue_workers (const cuzmem_queue* q)
+{
+    unsigned int n = 0;
+    DIR* dir;
+    struct dirent* de;
+
+    if (q->role != QUEUE_LEADER) {
+        return 0;
+    }
+    dir = opendir (q->dir);
+    if (dir == NULL) {
+        return 0;
+    }
+    while ((de = readdir (dir)) != NULL) {
+        if (!strncmp (de->d_name, "worker.", 7)) {
+            n++;
+        }
+    }
+    closedir (dir);
+
+    return n;
+}
+
+
+// called when tuning is over.  the leader tells the workers (and hands
+// them the final placement, if there is a search space)
+void
+queue_finish (cuzmem_queue* q, const cuzmem_plan* plan, const cuzmem_bitset* final_genome)
+{
+    char path[FILENAME_MAX];
+
+    if (q->role == QUEUE_WORKER) {
+        if (!queue_path (q, path, "worker", q->rank)) {
+            unlink (path);
+        }
+        q->leader = 0;
+    }
+    else if (q->role == QUEUE_LEADER) {
+        queue_publish (q, plan, final_genome ? final_genome->nbits : 0);
+        if (!queue_file (q, path, "stop")) {
+            write_header (path, plan, final_genome, final_genome ? final_genome->nbits : 0);
+        }
+        queue_destroy (q);
+    }
+}
+
+
+// worker: waits for a candidate to run (into genome) or for tuning to
+// be over.  returns what it got (enum cuzmem_queue_take).  on
+// QUEUE_FINISHED genome is the final placement
+int
+queue_take (cuzmem_queue* q, const cuzmem_plan* plan, cuzmem_bitset* genome)
+{
+    char path[FILENAME_MAX];
+    unsigned long long waited = 0;
+    queue_header h, s;
+
+    if (q->role != QUEUE_WORKER) {
+        return QUEUE_ABANDONED;
+    }
+
+    for (;;) {
+        if (read_header (q, "leader", &h, NULL)) {
+            // tuning is over
+            if (read_header (q, "stop", &s, genome) && s.pid == h.pid) {
+                return (s.num_genes == genome->nbits && s.num_genes > 0) ?
+                        QUEUE_FINISHED : QUEUE_ABANDONED;
+            }
+
+            // a new session: join it
+            if ((pid_t)h.pid != q->leader) {
+                if (h.num_genes != genome->nbits || h.shape != plan_shape (plan)) {
+                    fprintf (stderr, "libcuzmem: queue: leader (pid %d) traced different allocations, not joining\n",
+                            h.pid);
+                    return QUEUE_ABANDONED;
+                }
+                q->leader = (pid_t)h.pid;
+                q->cursor = 0;
+                if (!queue_path (q, path, "worker", q->rank)) {
+                    write_header (path, plan, NULL, h.num_genes);
+                }
+                fprintf (stderr, "libcuzmem: queue: worker %u joined leader (pid %d)\n",
+                        q->rank, h.pid);
+            }
+
+            if (take_next (q, genome)) {
+                return QUEUE_CANDIDATE;
+            }
+            waited = alive (q->leader) ? 0 : waited + 1;
+        } else {
+            waited++;
+        }
+
+        if (waited * QUEUE_POLL_US >= (unsigned long long)q->timeout * 1000000ULL) {
+            fprintf (stderr, "libcuzmem: queue: no leader for %u s, worker %u stops tuning\n",
+                    q->timeout, q->rank);
+            return QUEUE_ABANDONED;
+        }
+        usleep (QUEUE_POLL_US);
+    }
+}
+
+
+// worker: reports what the candidate queue_take() gave us measured
+// (and the placement it really ran as, NULL if no genome describes it)
+void
+queue_result (cuzmem_queue* q, const cuzmem_bitset* realized, double time)
+{
+    char path[FILENAME_MAX];
+    char tmpname[FILENAME_MAX];
+    int have = (realized != NULL);
+    cuzmem_ckpt ck;
+
+    if (q->role != QUEUE_WORKER || q->leader == 0) {
+        return;
+    }
+    if (queue_path (q, path, "done", q->seq) || !queue_create (path, tmpname, &ck)) {
+        return;
+    }
+    ckpt_put (&ck, &have, sizeof(have));
+    if (have) {
+        ckpt_put_bitset (&ck, realized);
+    }
+    ckpt_put (&ck, &time, sizeof(time));
+    queue_commit (path, tmpname, &ck);
+}
+
+
+void
+queue_report (const cuzmem_queue* q, FILE* fp)
+{
+    if (q->role == QUEUE_LEADER && q->offered > 0) {
+        fprintf (fp, "libcuzmem: queue: %llu of %llu offered candidates run by workers\n",
+                q->remote, q->offered);
+    }
+    else if (q->role == QUEUE_WORKER) {
+        fprintf (fp, "libcuzmem: queue: worker %u ran %llu candidates\n", q->rank, q->taken);
+    }
+}
@@ -0,0 +1,127 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _queue_h_
+#define _queue_h_
+
+#include <stdio.h>
+#include <cuda.h>
+#include <sys/types.h>
+#include "plans.h"
+#include "bitset.h"
+#include "memo.h"
+
+#define QUEUE_EXT       "queue"     // ~/.project/plan.queue/
+#define QUEUE_MAGIC     0x5155435a  // "ZCUQ"
+#define QUEUE_POLL_US   10000       // how often a waiting process looks again
+#define QUEUE_TIMEOUT   60          // s a worker waits for a leader (& the leader for a result)
+#define QUEUE_CLAIM_CHECKS 3        // s a claim may name no process before it is run elsewhere
+
+// what a process does in a coordinated tuning session
+enum cuzmem_queue_role {
+    QUEUE_OFF,                  // tunes on its own
+    QUEUE_LEADER,               // runs the tuner, offers candidates
+    QUEUE_WORKER                // runs candidates the leader offers
+};
+
+// what queue_take() got a worker
+enum cuzmem_queue_take {
+    QUEUE_CANDIDATE,            // a candidate to run
+    QUEUE_FINISHED,             // tuning is over, here is the final placement
+    QUEUE_ABANDONED             // tuning is over for us (no leader, wrong shape)
+};
+
+// -- Candidate queue structures -----------------
+// a candidate the leader offered that hasn't come back yet
+typedef struct cuzmem_queue_offer_struct cuzmem_queue_offer;
+struct cuzmem_queue_offer_struct
+{
+    unsigned int seq;
+    cuzmem_bitset* genome;
+};
+
+typedef struct cuzmem_queue_struct cuzmem_queue;
+struct cuzmem_queue_struct
+{
+    enum cuzmem_queue_role role;
+    unsigned int rank;          // 0: leader, 1..: workers
+    unsigned int timeout;       // s a worker waits for a leader (& the leader for a result)
+    char dir[FILENAME_MAX];
+
+    // leader
+    int published;              // session header written
+    unsigned int next_seq;      // seq of the next offer
+    cuzmem_queue_offer* offer;  // outstanding offers
+    unsigned int num_offers;
+    unsigned int max_offers;
+    unsigned long long offered;
+    unsigned long long remote;  // offers run by workers
+
+    // worker
+    pid_t leader;               // leader of the session joined (0: none)
+    unsigned int cursor;        // lowest seq that may still be unclaimed
+    unsigned int seq;           // candidate being run
+    unsigned long long taken;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+queue_init (cuzmem_queue* q);
+
+void
+queue_destroy (cuzmem_queue* q);
+
+CUdevice
+queue_device (const cuzmem_queue* q, CUdevice dev);
+
+void
+queue_open (cuzmem_queue* q, const char* project_name, const char* plan_name);
+
+void
+queue_publish (cuzmem_queue* q, const cuzmem_plan* plan, unsigned int num_genes);
+
+void
+queue_offer (cuzmem_queue* q, const cuzmem_memo* m, const cuzmem_bitset* genome);
+
+void
+queue_settle (cuzmem_queue* q, cuzmem_memo* m, const cuzmem_bitset* genome);
+
+unsigned int
+queue_workers (const cuzmem_queue* q);
+
+void
+queue_finish (cuzmem_queue* q, const cuzmem_plan* plan, const cuzmem_bitset* final_genome);
+
+int
+queue_take (cuzmem_queue* q, const cuzmem_plan* plan, cuzmem_bitset* genome);
+
+void
+queue_result (cuzmem_queue* q, const cuzmem_bitset* realized, double time);
+
+void
+queue_report (const cuzmem_queue* q, FILE* fp);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,249 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include "sim.h"
+
+// NOTES
+//
+// * sim_cost() replays a trace's allocations & frees, in order, with
+//   each knob placed where a genome puts its gene.  A knob headed for
+//   gpu memory that no longer fits goes to pinned memory instead, as
+//   alloc_mem() would do.  Every allocation is then charged:
+//     gpu    : passes * size / dev_bw
+//     pinned : passes * (size / host_bw + host_latency)
+//   plus, unless the fitness profile leaves allocation time out,
+//     gpu    : dev_latency
+//     pinned : pin_latency + size / pin_bw
+//
+// * That is far too crude to predict a run time outright: it knows
+//   nothing of the kernels.  So sim_predict() anchors it on the one
+//   placement that was measured, the trace's own:
+//     predicted = trace time + cost (genome) - cost (trace placement)
+//   What it is good for is ranking thousands of placements on a cpu, so
+//   that only the most promising few are run on the gpu.
+//
+// * passes is how much of the traffic a kernel's memory accesses are
+//   compared to what the allocations alone make.  1 if each byte is
+//   read about once per iteration; raise it for iterative kernels.
+//
+// * The model's parameters come from CUZMEM_SIM_<NAME> (in the units
+//   of the defaults in sim.h) or sim_model_set():
+//     DEV_BW HOST_BW HOST_LATENCY PIN_BW PIN_LATENCY DEV_LATENCY
+//     PASSES CAPACITY (B)
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+
+// parameter name -> field & what a value is multiplied by to be SI
+typedef struct sim_parm_struct sim_parm;
+struct sim_parm_struct
+{
+    const char* name;
+    size_t offset;
+    double scale;
+};
+
+static const sim_parm sim_parms[] = {
+    { "dev_bw",       offsetof (cuzmem_sim_model, dev_bw),       1e9  },
+    { "host_bw",      offsetof (cuzmem_sim_model, host_bw),      1e9  },
+    { "host_latency", offsetof (cuzmem_sim_model, host_latency), 1e-6 },
+    { "pin_bw",       offsetof (cuzmem_sim_model, pin_bw),       1e9  },
+    { "pin_latency",  offsetof (cuzmem_sim_model, pin_latency),  1e-6 },
+    { "dev_latency",  offsetof (cuzmem_sim_model, dev_latency),  1e-6 },
+    { "passes",       offsetof (cuzmem_sim_model, passes),       1.0  },
+    { NULL, 0, 0.0 }
+};
+
+
+//------------------------------------------------------------------------------
+// COST MODEL
+//------------------------------------------------------------------------------
+void
+sim_model_init (cuzmem_sim_model* m)
+{
+    const sim_parm* p;
+    char env[64];
+    char* value;
+    unsigned int i;
+
+    m->dev_bw = SIM_DEV_BW * 1e9;
+    m->host_bw = SIM_HOST_BW * 1e9;
+    m->host_latency = SIM_HOST_LATENCY * 1e-6;
+    m->pin_bw = SIM_PIN_BW * 1e9;
+    m->pin_latency = SIM_PIN_LATENCY * 1e-6;
+    m->dev_latency = SIM_DEV_LATENCY * 1e-6;
+    m->passes = SIM_PASSES;
+    m->alloc = 1;
+    m->capacity = 0;
+
+    for (p = sim_parms; p->name != NULL; p++) {
+        strcpy (env, "CUZMEM_SIM_");
+        for (i=0; p->name[i]; i++) {
+            env[11+i] = (char)toupper ((unsigned char)p->name[i]);
+        }
+        env[11+i] = '\0';
+        if ((value = getenv (env)) != NULL) {
+            sim_model_set (m, p->name, value);
+        }
+    }
+    if ((value = getenv ("CUZMEM_SIM_CAPACITY")) != NULL) {
+        sim_model_set (m, "capacity", value);
+    }
+}
+
+
+// sets a parameter by name (value in the units of sim.h's defaults).
+// returns 0 on success
+int
+sim_model_set (cuzmem_sim_model* m, const char* name, const char* value)
+{
+    const sim_parm* p;
+    char* end;
+    double v = strtod (value, &end);
+
+    if (end == value || *end != '\0' || v < 0.0) {
+        fprintf (stderr, "libcuzmem: bad value \"%s\" for simulator parameter %s\n", value, name);
+        return 1;
+    }
+
+    if (!strcmp (name, "capacity")) {
+        m->capacity = (size_t)v;
+        return 0;
+    }
+    if (!strcmp (name, "alloc")) {
+        m->alloc = (v != 0.0);
+        return 0;
+    }
+    for (p = sim_parms; p->name != NULL; p++) {
+        if (!strcmp (name, p->name)) {
+            // a bandwidth of 0 would divide by 0
+            if (v == 0.0 && p->scale == 1e9) {
+                fprintf (stderr, "libcuzmem: simulator parameter %s must be > 0\n", name);
+                return 1;
+            }
+            *(double*)((char*)m + p->offset) = v * p->scale;
+            return 0;
+        }
+    }
+
+    fprintf (stderr, "libcuzmem: unknown simulator parameter %s=%s (ignored)\n", name, value);
+    return 1;
+}
+
+
+void
+sim_model_report (const cuzmem_sim_model* m, FILE* fp)
+{
+    fprintf (fp, "gpu %.1f GB/s, %.1f us per allocation\n",
+            m->dev_bw / 1e9, m->dev_latency * 1e6);
+    fprintf (fp, "pinned %.1f GB/s + %.1f us per pass, pinning %.1f GB/s + %.1f us per allocation\n",
+            m->host_bw / 1e9, m->host_latency * 1e6, m->pin_bw / 1e9, m->pin_latency * 1e6);
+    fprintf (fp, "%.2f passes per byte, allocation time %s\n",
+            m->passes, m->alloc ? "counted" : "not counted");
+}
+
+
+//------------------------------------------------------------------------------
+// SIMULATOR
+//------------------------------------------------------------------------------
+
+// memory cost (s) of a trace's allocations with each knob placed as
+// genome says (NULL: where the 0th iteration put it).  realized, if
+// not NULL, gets the placement once knobs that don't fit have moved
+double
+sim_cost (const cuzmem_trace* t, const cuzmem_sim_model* m,
+          const cuzmem_bitset* genome, cuzmem_bitset* realized)
+{
+    unsigned int i;
+    int loc;
+    double cost = 0.0;
+    size_t size, used = 0;
+    size_t capacity = m->capacity ? m->capacity : t->capacity;
+    const cuzmem_trace_event* e;
+    const cuzmem_trace_knob* k;
+    unsigned char* live_loc = (unsigned char*)calloc (t->num_knobs ? t->num_knobs : 1, 1);
+
+    if (genome != NULL && t->num_genes == 0) {
+        genome = NULL;
+    }
+    if (realized != NULL) {
+        bitset_zero (realized);
+    }
+
+    for (i=0; i<t->num_events; i++) {
+        e = &t->event[i];
+        k = &t->knob[e->knob];
+        size = (size_t)k->size;
+
+        if (e->op == TRACE_FREE) {
+            if (live_loc[e->knob] == 1) {
+                used -= size;
+            }
+            live_loc[e->knob] = 0;
+            continue;
+        }
+
+        if (genome != NULL) {
+            loc = bitset_get (genome, k->gene);
+            if (loc == 1 && used + size > capacity) {
+                loc = 0;
+            }
+        } else {
+            loc = e->loc;
+        }
+
+        if (loc == 1) {
+            used += size;
+            cost += m->passes * size / m->dev_bw;
+            if (m->alloc) {
+                cost += m->dev_latency;
+            }
+        } else {
+            cost += m->passes * (size / m->host_bw + m->host_latency);
+            if (m->alloc) {
+                cost += m->pin_latency + size / m->pin_bw;
+            }
+        }
+        live_loc[e->knob] = (unsigned char)(loc == 1);
+
+        if (realized != NULL && k->gene >= 0) {
+            bitset_set (realized, k->gene, loc);
+        }
+    }
+
+    free (live_loc);
+    return cost;
+}
+
+
+// predicted fitness (s) of genome: the trace's measured time, adjusted
+// by how much more or less the placement costs than the trace's own
+double
+sim_predict (const cuzmem_trace* t, const cuzmem_sim_model* m,
+             const cuzmem_bitset* genome, cuzmem_bitset* realized)
+{
+    double p = t->time + sim_cost (t, m, genome, realized) - sim_cost (t, m, NULL, NULL);
+
+    return (p > 0.0) ? p : 0.0;
+}
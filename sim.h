@@ -0,0 +1,78 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _sim_h_
+#define _sim_h_
+
+#include <stdio.h>
+#include "bitset.h"
+#include "trace.h"
+
+//-------------------------------------------
+#define SIM_DEV_BW          100.0   // GB/s kernels read gpu global memory at
+#define SIM_HOST_BW         6.0     // GB/s kernels read pinned memory at (zero-copy)
+#define SIM_HOST_LATENCY    10.0    // us each pass over pinned memory waits on the bus
+#define SIM_PIN_BW          4.0     // GB/s pages are pinned at
+#define SIM_PIN_LATENCY     50.0    // us per pinned allocation
+#define SIM_DEV_LATENCY     5.0     // us per gpu allocation
+#define SIM_PASSES          1.0     // times kernels read each allocated byte
+//-------------------------------------------
+
+// -- Simulator Cost Model structure -------------
+// (SI units: B/s & s)
+typedef struct cuzmem_sim_model_struct cuzmem_sim_model;
+struct cuzmem_sim_model_struct
+{
+    double dev_bw;
+    double host_bw;
+    double host_latency;
+    double pin_bw;
+    double pin_latency;
+    double dev_latency;
+    double passes;
+    int alloc;                  // allocation calls cost time (0: service profile)
+    size_t capacity;            // gpu memory for the knobs (0: the trace's)
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+sim_model_init (cuzmem_sim_model* m);
+
+int
+sim_model_set (cuzmem_sim_model* m, const char* name, const char* value);
+
+void
+sim_model_report (const cuzmem_sim_model* m, FILE* fp);
+
+double
+sim_cost (const cuzmem_trace* t, const cuzmem_sim_model* m,
+          const cuzmem_bitset* genome, cuzmem_bitset* realized);
+
+double
+sim_predict (const cuzmem_trace* t, const cuzmem_sim_model* m,
+             const cuzmem_bitset* genome, cuzmem_bitset* realized);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+#include "sim.h"
+#include "bitset.h"
+#include "prng.h"
+
+// cuzmem-sim: replays an allocation trace (~/.project/plan.trace) under
+// candidate placements, no gpu required
+//
+//   cuzmem-sim [-m name=value ...] <trace>                    summary
+//   cuzmem-sim [-m name=value ...] <trace> eval <genome> ...  predict
+//   cuzmem-sim [-m name=value ...] <trace> screen [n] [k] [seed]
+//
+// Genomes are hex, most significant gene first (as the tuners print
+// them).  screen predicts n random placements (default 10000) and
+// lists the k best (default 10): the shortlist worth running.  -m sets
+// a cost model parameter (see sim.c), e.g. -m host_bw=12 -m alloc=0.
+
+typedef struct shortlist_struct shortlist;
+struct shortlist_struct
+{
+    double time;
+    cuzmem_bitset* genome;
+};
+
+
+static int
+usage (const char* prog)
+{
+    fprintf (stderr, "usage: %s [-m name=value ...] <trace> [eval <genome> ... | screen [n] [k] [seed]]\n", prog);
+    fprintf (stderr, "  -m  set a cost model parameter: dev_bw host_bw pin_bw (GB/s),\n");
+    fprintf (stderr, "      host_latency pin_latency dev_latency (us), passes, capacity (B), alloc (0/1)\n");
+    return 1;
+}
+
+
+// hex genome (optionally 0x prefixed) into b.  returns 0 on success
+static int
+parse_genome (const char* s, cuzmem_bitset* b)
+{
+    int i, j, d;
+    unsigned int bit = 0;
+
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        s += 2;
+    }
+    bitset_zero (b);
+    for (i=(int)strlen (s)-1; i>=0; i--, bit+=4) {
+        if (s[i] >= '0' && s[i] <= '9')      d = s[i] - '0';
+        else if (s[i] >= 'a' && s[i] <= 'f') d = s[i] - 'a' + 10;
+        else if (s[i] >= 'A' && s[i] <= 'F') d = s[i] - 'A' + 10;
+        else return 1;
+
+        for (j=0; j<4; j++) {
+            if (d & (1 << j)) {
+                if (bit + j >= b->nbits) {
+                    return 1;
+                }
+                bitset_set (b, bit + j, 1);
+            }
+        }
+    }
+    return 0;
+}
+
+
+static int
+cmp_shortlist (const void* a, const void* b)
+{
+    double x = ((const shortlist*)a)->time;
+    double y = ((const shortlist*)b)->time;
+    return (x > y) - (x < y);
+}
+
+
+static void
+print_prediction (const cuzmem_trace* t, const cuzmem_sim_model* m, const cuzmem_bitset* genome)
+{
+    cuzmem_bitset* realized = bitset_create (t->num_genes);
+    double time = sim_predict (t, m, genome, realized);
+
+    printf ("%f s  ", time);
+    bitset_fprint (stdout, genome);
+    if (!bitset_equal (genome, realized)) {
+        printf ("  (runs as ");
+        bitset_fprint (stdout, realized);
+        printf (")");
+    }
+    printf ("\n");
+    bitset_destroy (realized);
+}
+
+
+// predicts n random placements & prints the k fastest different ones
+// (as they would really be placed)
+static void
+screen (const cuzmem_trace* t, const cuzmem_sim_model* m,
+        unsigned int n, unsigned int k, unsigned long long seed)
+{
+    unsigned int i, j, kept = 0;
+    cuzmem_prng prng;
+    cuzmem_bitset* genome = bitset_create (t->num_genes);
+    shortlist* s = (shortlist*)calloc (n + 1, sizeof(shortlist));
+
+    prng_seed (&prng, seed);
+
+    // the trace's own placement is always a contender
+    for (i=0; i<=n; i++) {
+        if (i == 0) {
+            s[kept].genome = bitset_create (t->num_genes);
+            s[kept].time = sim_predict (t, m, NULL, s[kept].genome);
+        } else {
+            bitset_random_prng (genome, &prng);
+            s[kept].genome = bitset_create (t->num_genes);
+            s[kept].time = sim_predict (t, m, genome, s[kept].genome);
+        }
+        for (j=0; j<kept; j++) {
+            if (bitset_equal (s[j].genome, s[kept].genome)) {
+                break;
+            }
+        }
+        if (j == kept) {
+            kept++;
+        } else {
+            bitset_destroy (s[kept].genome);
+        }
+    }
+
+    qsort (s, kept, sizeof(shortlist), cmp_shortlist);
+    printf ("%u different placements out of %u, fastest %u:\n", kept, n + 1, (k < kept) ? k : kept);
+    for (i=0; i<kept; i++) {
+        if (i < k) {
+            printf ("%f s  ", s[i].time);
+            bitset_fprint (stdout, s[i].genome);
+            printf ("\n");
+        }
+        bitset_destroy (s[i].genome);
+    }
+
+    free (s);
+    bitset_destroy (genome);
+}
+
+
+int
+main (int argc, char** argv)
+{
+    int i;
+    char* eq;
+    const char* in = NULL;
+    cuzmem_trace trace;
+    cuzmem_sim_model model;
+    cuzmem_bitset* genome;
+
+    sim_model_init (&model);
+    for (i=1; i<argc && in == NULL; i++) {
+        if (!strcmp (argv[i], "-m") && i+1 < argc) {
+            eq = strchr (argv[++i], '=');
+            if (eq == NULL) {
+                return usage (argv[0]);
+            }
+            *eq = '\0';
+            if (sim_model_set (&model, argv[i], eq+1)) {
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            return usage (argv[0]);
+        }
+        else {
+            in = argv[i];
+        }
+    }
+    if (in == NULL) {
+        return usage (argv[0]);
+    }
+
+    memset (&trace, 0, sizeof(trace));
+    if (trace_read (&trace, in)) {
+        fprintf (stderr, "%s: unable to read trace %s\n", argv[0], in);
+        return 1;
+    }
+
+    if (i == argc) {
+        trace_report (&trace, stdout);
+        sim_model_report (&model, stdout);
+        printf ("modeled memory cost of the traced placement: %f s\n",
+                sim_cost (&trace, &model, NULL, NULL));
+    }
+    else if (trace.num_genes == 0) {
+        fprintf (stderr, "%s: everything fit in gpu memory when %s was traced: nothing to place\n",
+                argv[0], in);
+        return 1;
+    }
+    else if (!strcmp (argv[i], "eval") && i+1 < argc) {
+        genome = bitset_create (trace.num_genes);
+        for (i++; i<argc; i++) {
+            if (parse_genome (argv[i], genome)) {
+                fprintf (stderr, "%s: %s is not a genome of %u genes\n",
+                        argv[0], argv[i], trace.num_genes);
+                return 1;
+            }
+            print_prediction (&trace, &model, genome);
+        }
+        bitset_destroy (genome);
+    }
+    else if (!strcmp (argv[i], "screen") && i+4 >= argc) {
+        unsigned int n = (i+1 < argc) ? (unsigned int)strtoul (argv[i+1], NULL, 10) : 10000;
+        unsigned int k = (i+2 < argc) ? (unsigned int)strtoul (argv[i+2], NULL, 10) : 10;
+        unsigned long long seed = (i+3 < argc) ? strtoull (argv[i+3], NULL, 10) : 1;
+        if (n == 0 || k == 0) {
+            return usage (argv[0]);
+        }
+        screen (&trace, &model, n, k, seed);
+    }
+    else {
+        return usage (argv[0]);
+    }
+
+    trace_destroy (&trace);
+    return 0;
+}
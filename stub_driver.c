@@ -0,0 +1,271 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A fake CUDA Driver.  Device and pinned memory are both plain host
+// memory so that libcuzmem can be exercised (and benchmarked) on
+// machines without a GPU.  Link this in place of libcuda.so.
+//
+// The amount of "device" memory is set by CUZMEM_STUB_MEM (bytes), the
+// device's name by CUZMEM_STUB_NAME and the # of (identical) devices by
+// CUZMEM_STUB_DEVICES (default 1).  Every process has its own devices,
+// so several processes can stand in for the gpus of one node.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <cuda.h>
+
+#define STUB_DEFAULT_MEM (256*1024*1024)
+
+static size_t stub_mem_total = 0;
+static size_t stub_mem_used = 0;
+static CUcontext stub_ctx = NULL;
+static CUdevice stub_dev = 0;
+
+// every device allocation is prefixed with its size
+#define STUB_HDR 16
+
+
+static void
+stub_init_mem ()
+{
+    char* env;
+
+    if (stub_mem_total != 0) {
+        return;
+    }
+
+    env = getenv ("CUZMEM_STUB_MEM");
+    if (env) {
+        stub_mem_total = (size_t)strtoull (env, NULL, 10);
+    } else {
+        stub_mem_total = STUB_DEFAULT_MEM;
+    }
+}
+
+
+CUresult
+cuInit (unsigned int flags)
+{
+    stub_init_mem ();
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuCtxAttach (CUcontext* pctx, unsigned int flags)
+{
+    // pretend the runtime never made one for us
+    return CUDA_ERROR_INVALID_CONTEXT;
+}
+
+CUresult
+cuCtxCreate (CUcontext* pctx, unsigned int flags, CUdevice dev)
+{
+    *pctx = (CUcontext)malloc (1);
+    stub_ctx = *pctx;
+    stub_dev = dev;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuCtxDestroy (CUcontext ctx)
+{
+    if (ctx == stub_ctx) {
+        stub_ctx = NULL;
+    }
+    free (ctx);
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuCtxSynchronize (void)
+{
+    return (stub_ctx == NULL) ? CUDA_ERROR_INVALID_CONTEXT : CUDA_SUCCESS;
+}
+
+CUresult
+cuCtxGetDevice (CUdevice* device)
+{
+    if (stub_ctx == NULL) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    *device = stub_dev;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuDeviceGetCount (int* count)
+{
+    char* env = getenv ("CUZMEM_STUB_DEVICES");
+
+    *count = env ? atoi (env) : 1;
+    if (*count < 1) {
+        *count = 1;
+    }
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuDeviceGet (CUdevice* device, int ordinal)
+{
+    int count;
+
+    cuDeviceGetCount (&count);
+    if (ordinal < 0 || ordinal >= count) {
+        return CUDA_ERROR_INVALID_VALUE;
+    }
+    *device = ordinal;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuDeviceGetName (char* name, int len, CUdevice dev)
+{
+    char* env = getenv ("CUZMEM_STUB_NAME");
+
+    snprintf (name, len, "%s", env ? env : "libcuzmem Stub Device");
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuDeviceTotalMem_v2 (size_t* bytes, CUdevice dev)
+{
+    stub_init_mem ();
+    *bytes = stub_mem_total;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuDeviceComputeCapability (int* major, int* minor, CUdevice dev)
+{
+    *major = 2;
+    *minor = 0;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuDriverGetVersion (int* version)
+{
+    *version = 4000;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuMemAlloc (CUdeviceptr* dptr, unsigned int bytesize)
+{
+    char* mem;
+
+    stub_init_mem ();
+    if (__sync_add_and_fetch (&stub_mem_used, bytesize) > stub_mem_total) {
+        __sync_sub_and_fetch (&stub_mem_used, bytesize);
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+
+    mem = (char*)malloc (bytesize + STUB_HDR);
+    if (mem == NULL) {
+        __sync_sub_and_fetch (&stub_mem_used, bytesize);
+        return CUDA_ERROR_OUT_OF_MEMORY;
+    }
+    *(size_t*)mem = bytesize;
+    *dptr = (CUdeviceptr)(mem + STUB_HDR);
+
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuMemFree (CUdeviceptr dptr)
+{
+    char* mem = (char*)dptr - STUB_HDR;
+
+    __sync_sub_and_fetch (&stub_mem_used, *(size_t*)mem);
+    free (mem);
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuMemHostAlloc (void** pp, size_t bytesize, unsigned int flags)
+{
+    *pp = malloc (bytesize);
+    return (*pp == NULL) ? CUDA_ERROR_OUT_OF_MEMORY : CUDA_SUCCESS;
+}
+
+CUresult
+cuMemFreeHost (void* p)
+{
+    free (p);
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuMemHostGetDevicePointer (CUdeviceptr* pdptr, void* p, unsigned int flags)
+{
+    *pdptr = (CUdeviceptr)p;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuMemGetInfo (unsigned int* free, unsigned int* total)
+{
+    stub_init_mem ();
+    *total = (unsigned int)stub_mem_total;
+    *free = (unsigned int)(stub_mem_total - stub_mem_used);
+    return CUDA_SUCCESS;
+}
+
+
+// events just hold the host time they were recorded at
+// (nothing is ever asynchronous here)
+CUresult
+cuEventCreate (CUevent* event, unsigned int flags)
+{
+    if (stub_ctx == NULL) {
+        return CUDA_ERROR_INVALID_CONTEXT;
+    }
+    *event = (CUevent)calloc (1, sizeof(double));
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuEventRecord (CUevent event, CUstream stream)
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, 0);
+    *(double*)event = (double)tv.tv_sec + (double)tv.tv_usec / 1000000.;
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuEventSynchronize (CUevent event)
+{
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuEventElapsedTime (float* ms, CUevent start, CUevent end)
+{
+    *ms = (float)((*(double*)end - *(double*)start) * 1000.0);
+    return CUDA_SUCCESS;
+}
+
+CUresult
+cuEventDestroy (CUevent event)
+{
+    free (event);
+    return CUDA_SUCCESS;
+}
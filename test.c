@@ -1,9 +1,20 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-//#include "libcuzmem.h"
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "libcuzmem.h"
 #include "plans.h"
 #include "context.h"
 
+// the interposed runtime calls (normally come from cuda_runtime.h)
+cudaError_t cudaMalloc (void **devPtr, size_t size);
+cudaError_t cudaFree (void *devPtr);
+
 
 void
 test_planfile (void)
@@ -12,10 +23,10 @@ test_planfile (void)
     cuzmem_plan *plan = NULL;
     cuzmem_plan *curr = NULL;
 
-    plan = read_plan ("plastimatch", "foobar");
+    plan = read_plan ("plastimatch", "foobar", NULL);
     curr = plan;
 
-    write_plan (plan, "plastimatch", "foobaz");
+    write_plan (plan, "plastimatch", "foobaz", NULL);
 }
 
 void
@@ -29,17 +40,595 @@ test_context (void)
 
     printf ("plan_name[] : %s\n", context->plan_name);
     printf ("start_time  : %lu\n", context->start_time);
-    printf ("best_time   : %lu\n", context->best_time);
+    printf ("best_time   : %f\n", context->best_time);
 
     destroy_context ();
 }
 
+// cudaFree() latency vs. plan size (run against stub_driver.c)
+// * allocations are made during the 0th tune cycle, which is where
+//   cudaFree() also does its gold member bookkeeping
+// * frees happen in random order so the plan is not walked in luck
+void
+bench_free_latency (void)
+{
+    int n, i, j;
+    void** ptrs;
+    void* tmp;
+    double t;
+
+    printf ("cudaFree() latency (0th tune cycle)\n");
+    for (n=256; n<=16384; n*=4) {
+        ptrs = (void**)malloc (n * sizeof(void*));
+
+        cuzmem_set_tuner (CUZMEM_NOTUNE);
+        cuzmem_start (CUZMEM_TUNE, 0);
+        for (i=0; i<n; i++) {
+            // distinct sizes, so nothing looks loopy
+            cudaMalloc (&ptrs[i], 256 + i);
+        }
+
+        for (i=n-1; i>0; i--) {
+            j = rand() % (i+1);
+            tmp = ptrs[i]; ptrs[i] = ptrs[j]; ptrs[j] = tmp;
+        }
+
+        t = get_time ();
+        for (i=0; i<n; i++) {
+            cudaFree (ptrs[i]);
+        }
+        t = get_time () - t;
+
+        printf ("  plan entries: %6i    ns/free: %8.1f\n", n, 1e9 * t / n);
+
+        cuzmem_end ();
+        destroy_context ();
+        free (ptrs);
+    }
+}
+
+// -- multi-threaded RUN mode stress ------------
+#define STRESS_SIZES  8
+#define STRESS_OPS    20000
+
+typedef struct stress_arg_struct stress_arg;
+struct stress_arg_struct
+{
+    unsigned int seed;
+    double* lat;        // per malloc/free pair latency (ns)
+};
+
+static double
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+cmp_double (const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void*
+stress_thread (void* p)
+{
+    stress_arg* arg = (stress_arg*)p;
+    void* ptr;
+    double t;
+    int i;
+
+    for (i=0; i<STRESS_OPS; i++) {
+        t = now_ns ();
+        cudaMalloc (&ptr, 1024 * (1 + rand_r (&arg->seed) % STRESS_SIZES));
+        cudaFree (ptr);
+        arg->lat[i] = now_ns () - t;
+    }
+
+    return NULL;
+}
+
+// cudaMalloc()/cudaFree() throughput & p99 latency as host threads are
+// added (run against stub_driver.c).  The plan is built in memory: every
+// entry is inloop, with enough of each size for every thread to hold one.
+void
+bench_threads (void)
+{
+    int t, i, n, num_threads;
+    pthread_t* tid;
+    stress_arg* arg;
+    double* all;
+    double elapsed;
+    cuzmem_plan* entry;
+    CUZMEM_CONTEXT ctx;
+
+    printf ("cudaMalloc()+cudaFree() under concurrency (RUN mode)\n");
+    for (num_threads=1; num_threads<=16; num_threads*=2) {
+        ctx = get_context ();
+        ctx->plan = NULL;
+        n = STRESS_SIZES * num_threads;
+        for (i=n-1; i>=0; i--) {
+            entry = (cuzmem_plan*)calloc (1, sizeof(cuzmem_plan));
+            entry->id = i;
+            entry->size = 1024 * (1 + i % STRESS_SIZES);
+            entry->loc = 1;
+            entry->inloop = 1;
+            entry->next = ctx->plan;
+            ctx->plan = entry;
+        }
+        plan_index_build (&ctx->plan_index, ctx->plan);
+        ctx->op_mode = CUZMEM_RUN;
+        ctx->current_knob = 0;
+
+        tid = (pthread_t*)malloc (num_threads * sizeof(pthread_t));
+        arg = (stress_arg*)malloc (num_threads * sizeof(stress_arg));
+        all = (double*)malloc (num_threads * STRESS_OPS * sizeof(double));
+
+        elapsed = now_ns ();
+        for (t=0; t<num_threads; t++) {
+            arg[t].seed = t + 1;
+            arg[t].lat = &all[t * STRESS_OPS];
+            pthread_create (&tid[t], NULL, stress_thread, &arg[t]);
+        }
+        for (t=0; t<num_threads; t++) {
+            pthread_join (tid[t], NULL);
+        }
+        elapsed = now_ns () - elapsed;
+
+        qsort (all, num_threads * STRESS_OPS, sizeof(double), cmp_double);
+        printf ("  threads: %2i    ops/s: %10.0f    p50: %7.0f ns    p99: %7.0f ns\n",
+                num_threads,
+                1e9 * num_threads * STRESS_OPS / elapsed,
+                all[num_threads * STRESS_OPS / 2],
+                all[(int)(num_threads * STRESS_OPS * 0.99)]);
+
+        free (tid);
+        free (arg);
+        free (all);
+        destroy_context ();
+    }
+}
+
+// -- coordinated tuning session ----------------
+#define QUEUE_TEST_KNOBS  12
+#define QUEUE_TEST_MEM    "8000"    // stub gpu bytes: not all knobs fit
+
+// the application: tunes until the leader is done.  a dying worker
+// exits in the middle of the first candidate it takes
+static void
+queue_app (char* plan, int die)
+{
+    void* p[QUEUE_TEST_KNOBS];
+    int i, it = 0;
+
+    cuzmem_set_project ("cuzmem_test");
+    cuzmem_set_plan (plan);
+    cuzmem_set_tuner (CUZMEM_GENETIC);
+    CUZMEM_START (CUZMEM_TUNE, 0)
+    it++;
+    for (i=0; i<QUEUE_TEST_KNOBS; i++) {
+        cudaMalloc (&p[i], 1000 + 16*i);
+    }
+    if (die && it > 1) {
+        _exit (3);
+    }
+    usleep (5000);
+    for (i=0; i<QUEUE_TEST_KNOBS; i++) {
+        cudaFree (p[i]);
+    }
+    CUZMEM_END
+}
+
+// runs the application as rank in a child process
+static pid_t
+queue_spawn (const char* rank, int die)
+{
+    CUZMEM_CONTEXT ctx;
+    pid_t pid = fork ();
+    int leader = !strcmp (rank, "0");
+    int ok;
+
+    if (pid != 0) {
+        return pid;
+    }
+
+    // a hung session fails the test instead of hanging it
+    alarm (120);
+    setenv ("CUZMEM_QUEUE_RANK", rank, 1);
+    // (a session per plan, so a worker never sees the last one's stop)
+    queue_app (die ? "queue_dying" : "queue", die && !leader);
+
+    // leader: the worker's results must have come back to its memo
+    ctx = get_context ();
+    ok = (ctx->memo.count > 0) && (!leader || die || ctx->queue.remote > 0);
+    printf ("  rank %s: %u placements in memo, %llu run by workers\n",
+            rank, ctx->memo.count, ctx->queue.remote);
+    fflush (stdout);
+    _exit (ok ? 0 : 1);
+}
+
+static void
+rm_tree (const char* path)
+{
+    char sub[FILENAME_MAX];
+    DIR* dir = opendir (path);
+    struct dirent* de;
+
+    while (dir != NULL && (de = readdir (dir)) != NULL) {
+        if (strcmp (de->d_name, ".") && strcmp (de->d_name, "..")) {
+            snprintf (sub, FILENAME_MAX, "%s/%s", path, de->d_name);
+            rm_tree (sub);
+        }
+    }
+    if (dir != NULL) {
+        closedir (dir);
+    }
+    remove (path);
+}
+
+// a leader (rank 0) & a worker (rank 1) in separate processes, on stub
+// gpus of their own.  then again with a worker that dies while it runs
+// a candidate: the leader must run it & finish anyway.  (must run
+// before anything else initializes the stub driver in this process)
+int
+test_queue (void)
+{
+    char home[] = "/tmp/cuzmem_test.XXXXXX";
+    pid_t leader, worker;
+    int die, status, failed = 0;
+
+    if (mkdtemp (home) == NULL) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    setenv ("HOME", home, 1);
+    setenv ("CUZMEM_STUB_MEM", QUEUE_TEST_MEM, 1);
+    setenv ("CUZMEM_STUB_DEVICES", "2", 1);
+    setenv ("CUZMEM_QUEUE_TIMEOUT", "10", 1);
+
+    for (die=0; die<2; die++) {
+        printf ("coordinated tuning session (%s worker)\n", die ? "dying" : "healthy");
+        fflush (stdout);
+
+        worker = queue_spawn ("1", die);
+        leader = queue_spawn ("0", die);
+
+        // (the worker first: until it is reaped the leader can't see
+        //  that it died)
+        waitpid (worker, &status, 0);
+        if (!WIFEXITED (status) || WEXITSTATUS (status) != (die ? 3 : 0)) {
+            printf ("  FAILED: worker exited with status %d\n", status);
+            failed++;
+        }
+        waitpid (leader, &status, 0);
+        if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+            printf ("  FAILED: leader did not finish the session\n");
+            failed++;
+        }
+    }
+
+    rm_tree (home);
+    unsetenv ("CUZMEM_STUB_MEM");
+    unsetenv ("CUZMEM_STUB_DEVICES");
+    unsetenv ("CUZMEM_QUEUE_TIMEOUT");
+
+    return failed;
+}
+
+// -- checkpoint & resume -----------------------
+#define CKPT_TEST_KNOBS  5
+#define CKPT_TEST_MEM    "16000"    // stub gpu bytes: not all knobs fit
+#define CKPT_TEST_KILL   4          // iteration the interrupted run dies in
+
+// what a tuning session ended with
+typedef struct ckpt_result_struct ckpt_result;
+struct ckpt_result_struct
+{
+    unsigned int placement;     // bit id: knob id is in gpu memory
+    unsigned int memo;          // placements in the memo
+    int runs;                   // times the application was run
+};
+
+// the application: knob i is 1000 << i B and every pinned byte costs
+// a microsecond, so the fastest placement (the most bytes in gpu
+// memory that fit) is unique & is found no matter how noisy the
+// stub's timing is.  kill > 0 exits at the start of that iteration.
+// returns # of times the application was run
+static int
+ckpt_app (char* plan, int kill)
+{
+    CUZMEM_CONTEXT ctx;
+    cuzmem_plan* entry;
+    void* p[CKPT_TEST_KNOBS];
+    size_t pinned;
+    int i, it = 0;
+
+    cuzmem_set_project ("cuzmem_test");
+    cuzmem_set_plan (plan);
+    cuzmem_set_tuner (CUZMEM_EXHAUSTIVE);
+    cuzmem_set_minimum (50);
+    CUZMEM_START (CUZMEM_TUNE, 0)
+    if (++it == kill) {
+        _exit (3);
+    }
+    for (i=0; i<CKPT_TEST_KNOBS; i++) {
+        cudaMalloc (&p[i], 1000 << i);
+    }
+    ctx = get_context ();
+    pinned = 0;
+    for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+        if (entry->cpu_pointer != NULL) {
+            pinned += entry->size;
+        }
+    }
+    usleep (pinned);
+    for (i=0; i<CKPT_TEST_KNOBS; i++) {
+        cudaFree (p[i]);
+    }
+    CUZMEM_END
+
+    return it;
+}
+
+// runs the application in a child process & collects what it ended with
+static int
+ckpt_run (char* plan, int kill, ckpt_result* r)
+{
+    CUZMEM_CONTEXT ctx;
+    cuzmem_plan* entry;
+    int fd[2], status;
+    pid_t pid;
+
+    if (pipe (fd)) {
+        perror ("pipe");
+        return 1;
+    }
+    pid = fork ();
+    if (pid == 0) {
+        close (fd[0]);
+        alarm (120);
+        r->runs = ckpt_app (plan, kill);
+
+        ctx = get_context ();
+        r->placement = 0;
+        for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+            r->placement |= (unsigned int)entry->loc << entry->id;
+        }
+        r->memo = ctx->memo.count;
+        _exit (write (fd[1], r, sizeof(*r)) != sizeof(*r));
+    }
+    close (fd[1]);
+    if (kill == 0 && read (fd[0], r, sizeof(*r)) != sizeof(*r)) {
+        memset (r, 0, sizeof(*r));
+    }
+    close (fd[0]);
+    waitpid (pid, &status, 0);
+
+    return !WIFEXITED (status) || WEXITSTATUS (status) != (kill ? 3 : 0);
+}
+
+// a tuning session killed part way & run again must end on the same
+// plan, having measured the same placements, as one run straight
+// through.  (the runs are child processes: must run before anything
+// else initializes the stub driver in this process)
+int
+test_checkpoint (void)
+{
+    char home[] = "/tmp/cuzmem_ckpt.XXXXXX";
+    ckpt_result full, resumed;
+    int failed = 0;
+
+    printf ("checkpoint & resume\n");
+    if (mkdtemp (home) == NULL) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    setenv ("HOME", home, 1);
+    setenv ("CUZMEM_STUB_MEM", CKPT_TEST_MEM, 1);
+
+    if (ckpt_run ("ckpt_full", 0, &full)) {
+        printf ("  FAILED: uninterrupted session did not finish\n");
+        failed++;
+    }
+    if (ckpt_run ("ckpt_resumed", CKPT_TEST_KILL, &resumed)) {
+        printf ("  FAILED: interrupted session did not die at iteration %d\n",
+                CKPT_TEST_KILL);
+        failed++;
+    }
+    if (ckpt_run ("ckpt_resumed", 0, &resumed)) {
+        printf ("  FAILED: resumed session did not finish\n");
+        failed++;
+    }
+
+    printf ("  uninterrupted: placement %02x, %u in memo, %d runs\n",
+            full.placement, full.memo, full.runs);
+    printf ("  resumed:       placement %02x, %u in memo, %d runs\n",
+            resumed.placement, resumed.memo, resumed.runs);
+    if (!failed && (full.placement != resumed.placement || full.memo != resumed.memo)) {
+        printf ("  FAILED: resumed session ended differently\n");
+        failed++;
+    }
+    // (the iteration that was killed is run again)
+    if (!failed && resumed.runs != full.runs - CKPT_TEST_KILL + 1) {
+        printf ("  FAILED: resumed session did not pick up where it stopped\n");
+        failed++;
+    }
+
+    rm_tree (home);
+    unsetenv ("CUZMEM_STUB_MEM");
+
+    return failed;
+}
+
+// -- plan files --------------------------------
+#define PLAN_TEST_ENTRIES  6
+
+static int
+file_equal (const char* a, const char* b)
+{
+    FILE* fa = fopen (a, "rb");
+    FILE* fb = fopen (b, "rb");
+    int ca = 0, cb = 0;
+
+    while (fa != NULL && fb != NULL && ca == cb && ca != EOF) {
+        ca = fgetc (fa);
+        cb = fgetc (fb);
+    }
+    if (fa != NULL) {
+        fclose (fa);
+    }
+    if (fb != NULL) {
+        fclose (fb);
+    }
+
+    return (fa != NULL && fb != NULL && ca == cb);
+}
+
+// a binary plan that has been tampered with must not load
+static int
+plan_bin_rejected (const char* filename, const char* what)
+{
+    cuzmem_plan* plan = read_plan_bin (filename, NULL);
+
+    if (plan != NULL) {
+        printf ("  FAILED: binary plan with %s was loaded\n", what);
+        free (plan);
+        return 1;
+    }
+    return 0;
+}
+
+// text -> binary -> text must give back the text plan byte for byte,
+// and a binary plan with a bad checksum or the wrong size is refused
+int
+test_plan_files (void)
+{
+    char dir[] = "/tmp/cuzmem_plan.XXXXXX";
+    char text[FILENAME_MAX], bin[FILENAME_MAX], again[FILENAME_MAX];
+    cuzmem_plan entries[PLAN_TEST_ENTRIES];
+    cuzmem_plan *plan, *next;
+    cuzmem_device_fp dev, dev_text, dev_bin;
+    unsigned char byte = 0;
+    FILE* fp;
+    long size;
+    int i, failed = 0;
+
+    printf ("plan file round trip\n");
+    if (mkdtemp (dir) == NULL) {
+        perror ("mkdtemp");
+        return 1;
+    }
+    snprintf (text, FILENAME_MAX, "%s/p.plan", dir);
+    snprintf (bin, FILENAME_MAX, "%s/p.planb", dir);
+    snprintf (again, FILENAME_MAX, "%s/again.plan", dir);
+
+    memset (&dev, 0, sizeof(dev));
+    strcpy (dev.name, "Test Device");
+    dev.total_mem = 1ULL << 32;
+    dev.cc_major = 3;
+    dev.cc_minor = 5;
+    dev.driver_version = 11020;
+
+    // ids, grouped genes, call sites, both locations & inloop entries
+    memset (entries, 0, sizeof(entries));
+    for (i=0; i<PLAN_TEST_ENTRIES; i++) {
+        entries[i].id = i;
+        entries[i].gene = i / 2;
+        entries[i].site = (i % 3) ? 0x7f00deadbeef0000ULL + i : 0;
+        entries[i].ordinal = (i % 3) ? i / 3 : 0;
+        entries[i].size = 1000 + 256 * i;
+        entries[i].loc = i & 1;
+        entries[i].inloop = (i == 4);
+        entries[i].next = (i+1 < PLAN_TEST_ENTRIES) ? &entries[i+1] : NULL;
+    }
+
+    if (write_plan_text (entries, &dev, text)) {
+        printf ("  FAILED: could not write %s\n", text);
+        rm_tree (dir);
+        return 1;
+    }
+
+    plan = read_plan_text (text, &dev_text);
+    if (plan == NULL || write_plan_bin (plan, &dev_text, bin)) {
+        printf ("  FAILED: text plan did not convert to binary\n");
+        failed++;
+    }
+    while (plan != NULL) {
+        next = plan->next;
+        free (plan);
+        plan = next;
+    }
+
+    // (a binary plan's entries are one allocation)
+    plan = read_plan_bin (bin, &dev_bin);
+    if (plan == NULL || write_plan_text (plan, &dev_bin, again)) {
+        printf ("  FAILED: binary plan did not convert back to text\n");
+        failed++;
+    }
+    free (plan);
+
+    if (!failed && !file_equal (text, again)) {
+        printf ("  FAILED: %s and %s differ\n", text, again);
+        failed++;
+    }
+    if (!failed && memcmp (&dev, &dev_bin, sizeof(dev))) {
+        printf ("  FAILED: device fingerprint did not survive\n");
+        failed++;
+    }
+
+    // flip a bit in the last record: the checksum no longer matches
+    fp = fopen (bin, "r+b");
+    if (fp != NULL) {
+        fseek (fp, -(long)sizeof(cuzmem_plan_record), SEEK_END);
+        byte = (unsigned char)fgetc (fp);
+        fseek (fp, -(long)sizeof(cuzmem_plan_record), SEEK_END);
+        fputc (byte ^ 1, fp);
+        fclose (fp);
+    }
+    failed += plan_bin_rejected (bin, "a bad checksum");
+
+    // put it back & drop the last record: the size no longer matches
+    fp = fopen (bin, "r+b");
+    if (fp != NULL) {
+        fseek (fp, -(long)sizeof(cuzmem_plan_record), SEEK_END);
+        fputc (byte, fp);
+        fseek (fp, 0, SEEK_END);
+        size = ftell (fp);
+        fclose (fp);
+
+        plan = read_plan_bin (bin, NULL);
+        if (plan == NULL) {
+            printf ("  FAILED: repaired binary plan was refused\n");
+            failed++;
+        }
+        free (plan);
+        if (truncate (bin, size - sizeof(cuzmem_plan_record))) {
+            perror ("truncate");
+        }
+    }
+    failed += plan_bin_rejected (bin, "a missing record");
+
+    printf ("  %s\n", failed ? "FAILED" : "ok");
+    rm_tree (dir);
+
+    return failed;
+}
+
 int
 main (void)
 {
+    int failed;
 
 //    test_planfile ();
     test_context ();
+    failed = test_queue ();
+    failed += test_checkpoint ();
+    failed += test_plan_files ();
+    bench_free_latency ();
+    bench_threads ();
 
-    return(0);
+    return (failed != 0);
 }
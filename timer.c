@@ -0,0 +1,142 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cuda.h>
+#include "context.h"
+#include "timer.h"
+
+// NOTES
+//
+// * Kernel launches are asynchronous.  Timing an iteration with the host
+//   clock alone misses work still running at cuzmem_end() (or bills it
+//   to the next iteration).  Instead a CUDA event is recorded at
+//   cuzmem_start() and another at cuzmem_end(), we wait for the second,
+//   and the iteration takes the elapsed time between them.  Both are
+//   recorded on the NULL stream, which waits on all other streams, so the
+//   elapsed time covers all device work issued in between.
+//
+// * Events belong to a CUDA context, so they are made on first use and
+//   released by timer_destroy() before libcuzmem destroys the context.
+//
+// * If events can't be used, the host clock is the fallback.  The context
+//   is still synchronized first, so asynchronous work is not missed.
+//
+// * CUZMEM_TIMER=host forces the host clock (default: event).
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static void
+timer_fallback (cuzmem_timer* t, const char* why)
+{
+    if (!t->warned) {
+        fprintf (stderr, "libcuzmem: CUDA event timing unavailable (%s), using host clock\n", why);
+        t->warned = 1;
+    }
+    t->recording = 0;
+}
+
+
+//------------------------------------------------------------------------------
+// ITERATION TIMER INTERFACE
+//------------------------------------------------------------------------------
+void
+timer_init (cuzmem_timer* t)
+{
+    char* env = getenv ("CUZMEM_TIMER");
+
+    memset (t, 0, sizeof(cuzmem_timer));
+    t->source = CUZMEM_TIMER_EVENT;
+    if (env != NULL) {
+        if (!strcmp (env, "host")) {
+            t->source = CUZMEM_TIMER_HOST;
+        }
+        else if (strcmp (env, "event")) {
+            fprintf (stderr, "libcuzmem: unknown CUZMEM_TIMER \"%s\" (using event)\n", env);
+        }
+    }
+}
+
+
+// releases the events (call before the CUDA context is destroyed)
+void
+timer_destroy (cuzmem_timer* t)
+{
+    if (t->have_events) {
+        cuEventDestroy (t->start);
+        cuEventDestroy (t->stop);
+        t->have_events = 0;
+    }
+    t->recording = 0;
+}
+
+
+// marks the start of an iteration
+void
+timer_start (cuzmem_timer* t)
+{
+    t->recording = 0;
+    if (t->source != CUZMEM_TIMER_EVENT) {
+        return;
+    }
+
+    if (!t->have_events) {
+        if (cuEventCreate (&t->start, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+            timer_fallback (t, "cuEventCreate");
+            return;
+        }
+        if (cuEventCreate (&t->stop, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+            cuEventDestroy (t->start);
+            timer_fallback (t, "cuEventCreate");
+            return;
+        }
+        t->have_events = 1;
+    }
+
+    if (cuEventRecord (t->start, 0) != CUDA_SUCCESS) {
+        timer_fallback (t, "cuEventRecord");
+        return;
+    }
+    t->recording = 1;
+}
+
+
+// waits for the device to finish the iteration's work and returns the
+// iteration's time in seconds.  host_start is the host clock at the
+// start of the iteration (for the fallback)
+double
+timer_stop (cuzmem_timer* t, double host_start)
+{
+    float ms;
+
+    if (t->recording) {
+        t->recording = 0;
+        if (cuEventRecord (t->stop, 0) == CUDA_SUCCESS &&
+            cuEventSynchronize (t->stop) == CUDA_SUCCESS &&
+            cuEventElapsedTime (&ms, t->start, t->stop) == CUDA_SUCCESS) {
+            return (double)ms / 1000.0;
+        }
+        timer_fallback (t, "cuEventElapsedTime");
+    }
+
+    cuCtxSynchronize ();
+    return get_time () - host_start;
+}
@@ -0,0 +1,62 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _timer_h_
+#define _timer_h_
+
+#include <cuda.h>
+
+enum cuzmem_timer_source {
+    CUZMEM_TIMER_EVENT,         // CUDA events (device time)
+    CUZMEM_TIMER_HOST           // host clock after a context synchronize
+};
+
+// -- Iteration timer structure ------------------
+typedef struct cuzmem_timer_struct cuzmem_timer;
+struct cuzmem_timer_struct
+{
+    enum cuzmem_timer_source source;
+    int have_events;            // events exist in the current CUDA context
+    int recording;              // start event recorded this iteration
+    int warned;
+    CUevent start;
+    CUevent stop;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+timer_init (cuzmem_timer* t);
+
+void
+timer_destroy (cuzmem_timer* t);
+
+void
+timer_start (cuzmem_timer* t);
+
+double
+timer_stop (cuzmem_timer* t, double host_start);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
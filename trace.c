@@ -0,0 +1,298 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+// NOTES
+//
+// * The 0th tuning iteration sees every allocation: its size, call
+//   site, order, whether it is made in a loop and when it is freed.
+//   Only the plan draft used to survive it.  Now each cudaMalloc() and
+//   cudaFree() of the iteration is also appended to an event list, and
+//   zeroth_end_handler() completes the trace with a knob table (knob
+//   id -> size, site, gene, ...) and writes it to ~/.project/plan.trace.
+//
+// * A knob allocated in a loop is one knob with several ALLOC/FREE
+//   pairs.  Events carry the knob id, where the 0th iteration put the
+//   allocation and the host clock since the iteration started.
+//
+// * 12 bytes per event & 32 per knob: a trace of a few thousand
+//   allocations is well under a megabyte.  It is written to a
+//   temporary file that is renamed into place.
+//
+// * The trace is what sim.c replays to predict the fitness of a
+//   placement without running it (see cuzmem-sim).
+//
+// * Native byte order & struct layout, like the checkpoints.
+//
+// * CUZMEM_TRACE=0 (or cuzmem_set_trace (0)) turns it off.
+
+
+//------------------------------------------------------------------------------
+// TRACE INTERFACE
+//------------------------------------------------------------------------------
+void
+trace_init (cuzmem_trace* t)
+{
+    char* env = getenv ("CUZMEM_TRACE");
+
+    memset (t, 0, sizeof(cuzmem_trace));
+    t->enabled = (env == NULL || atoi (env) != 0);
+}
+
+
+void
+trace_destroy (cuzmem_trace* t)
+{
+    free (t->knob);
+    free (t->event);
+    t->knob = NULL;
+    t->event = NULL;
+    t->num_knobs = 0;
+    t->num_events = 0;
+    t->max_events = 0;
+    t->complete = 0;
+}
+
+
+// appends an allocation (op TRACE_ALLOC, after it is placed) or a free
+// of entry's knob, when seconds into the iteration
+void
+trace_event (cuzmem_trace* t, const cuzmem_plan* entry, int op, double when)
+{
+    cuzmem_trace_event* e;
+
+    if (!t->enabled || t->complete) {
+        return;
+    }
+
+    if (t->num_events == t->max_events) {
+        unsigned int max = t->max_events ? 2 * t->max_events : 1024;
+        e = (cuzmem_trace_event*)realloc (t->event, max * sizeof(cuzmem_trace_event));
+        if (e == NULL) {
+            fprintf (stderr, "libcuzmem: out of memory for the allocation trace (tracing off)\n");
+            trace_destroy (t);
+            t->enabled = 0;
+            return;
+        }
+        t->event = e;
+        t->max_events = max;
+    }
+
+    e = &t->event[t->num_events++];
+    e->knob = (unsigned int)entry->id;
+    e->op = (unsigned char)op;
+    e->loc = (op == TRACE_ALLOC) ? (unsigned char)entry->loc : 0;
+    e->pad = 0;
+    e->t = (float)when;
+}
+
+
+// fills in the knob table from the 0th iteration's plan draft (once
+// the knobs have their genes).  time is the iteration's fitness and
+// capacity the gpu memory the knobs could have had.
+void
+trace_finish (cuzmem_trace* t, const cuzmem_plan* plan, unsigned int num_genes,
+              double time, size_t capacity, const cuzmem_device_fp* dev)
+{
+    const cuzmem_plan* entry;
+    cuzmem_trace_knob* k;
+    unsigned int n = 0;
+
+    if (!t->enabled || t->complete) {
+        return;
+    }
+
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->id >= 0 && (unsigned int)entry->id >= n) {
+            n = entry->id + 1;
+        }
+    }
+
+    free (t->knob);
+    t->knob = (cuzmem_trace_knob*)calloc (n ? n : 1, sizeof(cuzmem_trace_knob));
+    t->num_knobs = n;
+    t->num_genes = num_genes;
+    for (entry = plan; entry != NULL; entry = entry->next) {
+        if (entry->id < 0) {
+            continue;
+        }
+        k = &t->knob[entry->id];
+        k->size = entry->size;
+        k->site = entry->site;
+        k->gene = num_genes ? entry->gene : -1;
+        k->ordinal = entry->ordinal;
+        k->inloop = (unsigned char)entry->inloop;
+        k->gold_member = (unsigned char)entry->gold_member;
+    }
+
+    t->time = time;
+    t->capacity = capacity;
+    if (dev != NULL) {
+        t->device = *dev;
+    }
+    t->complete = 1;
+}
+
+
+// returns 0 on success
+int
+trace_write (const cuzmem_trace* t, const char* filename)
+{
+    char tmpname[FILENAME_MAX];
+    cuzmem_trace_header h;
+    FILE* fp;
+    int ok;
+
+    if (!t->complete) {
+        return 1;
+    }
+
+    snprintf (tmpname, FILENAME_MAX, "%s.%d", filename, (int)getpid ());
+    fp = fopen (tmpname, "wb");
+    if (fp == NULL) {
+        fprintf (stderr, "libcuzmem: unable to write allocation trace %s\n", tmpname);
+        return 1;
+    }
+
+    memset (&h, 0, sizeof(h));
+    h.magic = TRACE_MAGIC;
+    h.version = TRACE_VERSION;
+    h.num_knobs = t->num_knobs;
+    h.num_genes = t->num_genes;
+    h.num_events = t->num_events;
+    h.time = t->time;
+    h.capacity = t->capacity;
+    h.device = t->device;
+
+    ok = (fwrite (&h, sizeof(h), 1, fp) == 1);
+    if (ok && t->num_knobs) {
+        ok = (fwrite (t->knob, sizeof(cuzmem_trace_knob), t->num_knobs, fp) == t->num_knobs);
+    }
+    if (ok && t->num_events) {
+        ok = (fwrite (t->event, sizeof(cuzmem_trace_event), t->num_events, fp) == t->num_events);
+    }
+    ok = (fclose (fp) == 0) && ok;
+
+    if (!ok || rename (tmpname, filename) != 0) {
+        fprintf (stderr, "libcuzmem: unable to write allocation trace %s\n", filename);
+        unlink (tmpname);
+        return 1;
+    }
+    return 0;
+}
+
+
+// replaces t with the trace in filename.  returns 0 on success
+int
+trace_read (cuzmem_trace* t, const char* filename)
+{
+    cuzmem_trace_header h;
+    unsigned int i;
+    int bad = 0, enabled = t->enabled;
+    FILE* fp = fopen (filename, "rb");
+
+    if (fp == NULL) {
+        return 1;
+    }
+
+    trace_destroy (t);
+    if (fread (&h, sizeof(h), 1, fp) != 1 ||
+        h.magic != TRACE_MAGIC || h.version != TRACE_VERSION) {
+        fprintf (stderr, "libcuzmem: %s is not an allocation trace\n", filename);
+        fclose (fp);
+        return 1;
+    }
+
+    t->knob = (cuzmem_trace_knob*)calloc (h.num_knobs ? h.num_knobs : 1, sizeof(cuzmem_trace_knob));
+    t->event = (cuzmem_trace_event*)calloc (h.num_events ? h.num_events : 1, sizeof(cuzmem_trace_event));
+    if (t->knob == NULL || t->event == NULL ||
+        fread (t->knob, sizeof(cuzmem_trace_knob), h.num_knobs, fp) != h.num_knobs ||
+        fread (t->event, sizeof(cuzmem_trace_event), h.num_events, fp) != h.num_events) {
+        fprintf (stderr, "libcuzmem: allocation trace %s is truncated\n", filename);
+        fclose (fp);
+        trace_destroy (t);
+        return 1;
+    }
+    fclose (fp);
+
+    // the simulator indexes with these
+    for (i=0; i<h.num_knobs; i++) {
+        if (h.num_genes && (t->knob[i].gene < 0 || (unsigned int)t->knob[i].gene >= h.num_genes)) {
+            bad = 1;
+        }
+    }
+    for (i=0; i<h.num_events; i++) {
+        if (t->event[i].knob >= h.num_knobs) {
+            bad = 1;
+        }
+    }
+    if (bad) {
+        fprintf (stderr, "libcuzmem: allocation trace %s is corrupt\n", filename);
+        trace_destroy (t);
+        return 1;
+    }
+
+    t->enabled = enabled;
+    t->num_knobs = h.num_knobs;
+    t->num_genes = h.num_genes;
+    t->num_events = h.num_events;
+    t->max_events = h.num_events;
+    t->time = h.time;
+    t->capacity = (size_t)h.capacity;
+    t->device = h.device;
+    t->complete = 1;
+    return 0;
+}
+
+
+void
+trace_report (const cuzmem_trace* t, FILE* fp)
+{
+    unsigned int i, allocs = 0, inloop = 0, gold = 0;
+    unsigned long long live = 0, peak = 0, bytes = 0;
+    const cuzmem_trace_event* e;
+
+    for (i=0; i<t->num_knobs; i++) {
+        inloop += t->knob[i].inloop;
+        gold += t->knob[i].gold_member;
+    }
+    for (i=0; i<t->num_events; i++) {
+        e = &t->event[i];
+        if (e->op == TRACE_ALLOC) {
+            allocs++;
+            bytes += t->knob[e->knob].size;
+            live += t->knob[e->knob].size;
+            if (live > peak) {
+                peak = live;
+            }
+        } else {
+            live -= t->knob[e->knob].size;
+        }
+    }
+
+    fprintf (fp, "%u knobs (%u in loops, %u live at the peak) in %u genes\n",
+            t->num_knobs, inloop, gold, t->num_genes);
+    fprintf (fp, "%u allocations of %llu B in all, %llu B at the peak\n",
+            allocs, bytes, peak);
+    fprintf (fp, "traced iteration took %f s with %llu B of gpu memory free\n",
+            t->time, (unsigned long long)t->capacity);
+}
@@ -0,0 +1,130 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _trace_h_
+#define _trace_h_
+
+#include <stdio.h>
+#include "plans.h"
+
+#define TRACE_EXT       "trace"
+#define TRACE_MAGIC     0x545a5543      // "CUZT"
+#define TRACE_VERSION   1
+
+enum cuzmem_trace_op {
+    TRACE_ALLOC,
+    TRACE_FREE
+};
+
+// -- Trace Knob record --------------------------
+// what the 0th iteration learned about knob id (the record's index)
+typedef struct cuzmem_trace_knob_struct cuzmem_trace_knob;
+struct cuzmem_trace_knob_struct
+{
+    unsigned long long size;
+    unsigned long long site;
+    int gene;
+    unsigned int ordinal;
+    unsigned char inloop;
+    unsigned char gold_member;
+    unsigned char pad[6];
+};
+// -----------------------------------------------
+
+// -- Trace Event record -------------------------
+typedef struct cuzmem_trace_event_struct cuzmem_trace_event;
+struct cuzmem_trace_event_struct
+{
+    unsigned int knob;
+    unsigned char op;           // enum cuzmem_trace_op
+    unsigned char loc;          // ALLOC: where the 0th iteration put it
+    unsigned short pad;
+    float t;                    // s since the iteration started
+};
+// -----------------------------------------------
+
+// -- Trace File layout --------------------------
+// header, num_knobs knob records, num_events event records
+// (native byte order)
+typedef struct cuzmem_trace_header_struct cuzmem_trace_header;
+struct cuzmem_trace_header_struct
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int num_knobs;
+    unsigned int num_genes;
+    unsigned int num_events;
+    unsigned int pad;
+    double time;                // the 0th iteration's fitness (s)
+    unsigned long long capacity;    // gpu memory free for the knobs
+    cuzmem_device_fp device;
+};
+// -----------------------------------------------
+
+// -- Allocation Trace structure -----------------
+// every cudaMalloc()/cudaFree() of the 0th tuning iteration.  Once
+// complete, the knob table says what each knob id is & which gene
+// places it.
+typedef struct cuzmem_trace_struct cuzmem_trace;
+struct cuzmem_trace_struct
+{
+    int enabled;                // record & write the 0th iteration
+    int complete;               // knob table filled in
+    unsigned int num_knobs;
+    unsigned int num_genes;
+    cuzmem_trace_knob* knob;
+    unsigned int num_events;
+    unsigned int max_events;
+    cuzmem_trace_event* event;
+    double time;
+    size_t capacity;
+    cuzmem_device_fp device;
+};
+// -----------------------------------------------
+
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+void
+trace_init (cuzmem_trace* t);
+
+void
+trace_destroy (cuzmem_trace* t);
+
+void
+trace_event (cuzmem_trace* t, const cuzmem_plan* entry, int op, double when);
+
+void
+trace_finish (cuzmem_trace* t, const cuzmem_plan* plan, unsigned int num_genes,
+              double time, size_t capacity, const cuzmem_device_fp* dev);
+
+int
+trace_write (const cuzmem_trace* t, const char* filename);
+
+int
+trace_read (cuzmem_trace* t, const char* filename);
+
+void
+trace_report (const cuzmem_trace* t, FILE* fp);
+
+#if defined __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,434 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "context.h"
+#include "plans.h"
+#include "bitset.h"
+#include "prng.h"
+#include "tuner_util.h"
+#include "checkpoint.h"
+#include "tuner_anneal.h"
+
+//-------------------------------------------
+#define ANNEAL_ITERS    100     // tuning iterations after the trace
+#define ANNEAL_T0       0.05    // start temp, fraction of trace plan time
+#define ANNEAL_ALPHA    0.95    // geometric cooling factor
+#define MAX_FLIPS       4       // most bits flipped by one move
+#define MAX_TRIES       64      // proposals tried before forcing a feasible one
+#define ANNEAL_SEED     1ULL
+//-------------------------------------------
+
+//#define DEBUG
+
+// -- State Macros -----------------------
+#define SAVE_STATE(state_ptr)            \
+    (ctx->tuner_state = (void*)state_ptr)
+
+#define RESTORE_STATE(state_ptr)         \
+    (state_ptr = ctx->tuner_state)
+// ---------------------------------------
+
+// NOTES
+//
+// * Local search from the 0th iteration's memory trace plan (the same
+//   starting point save_trace_candidate() gives the genetic tuner).  Each
+//   iteration runs a neighbour of the current plan: 1 bit flipped half of
+//   the time, 2 a quarter of the time, ... up to MAX_FLIPS.  Good plans
+//   are kept whole, unlike with crossover.
+//
+// * Metropolis acceptance: faster neighbours always become current,
+//   slower ones with probability exp(-dt/T).  T starts at a fraction of
+//   the trace plan's time so it is on the scale of the measurements.
+//
+// * Moves whose gold members would not fit in the gpu_mem_budget() max
+//   are rejected before they are ever run.  If MAX_TRIES proposals are
+//   all rejected, a gene is simply moved to pinned memory, which can
+//   only lower the requirement.
+//
+// * As with the genetic tuner, alloc_mem() may push an allocation to
+//   pinned memory anyway.  That is recorded in the candidate.
+//
+// * A neighbour whose placement is in the memo is judged without being
+//   run (it still counts as an iteration, so the schedule is unchanged).
+//
+// * Moves & acceptance draw from a xorshift generator seeded with
+//   CUZMEM_ANNEAL_SEED, which is checkpointed with the rest of the
+//   state: a session (even a resumed one) can be repeated exactly, and
+//   rand() is left to the application.
+//
+// * Environment:
+//     CUZMEM_ANNEAL_ITERS     # of iterations (default 100)
+//     CUZMEM_ANNEAL_T0        start temperature (default 0.05)
+//     CUZMEM_ANNEAL_SCHEDULE  geometric (default), linear or log
+//     CUZMEM_ANNEAL_ALPHA     geometric cooling factor (default 0.95)
+//     CUZMEM_ANNEAL_SEED      random number seed (default 1)
+
+enum anneal_schedule {
+    ANNEAL_GEOMETRIC,       // T0 * alpha^k
+    ANNEAL_LINEAR,          // T0 * (1 - k/iters)
+    ANNEAL_LOG              // T0 * ln(2) / ln(k+2)
+};
+
+// -- Annealing Tuner State ----------------------
+typedef struct anneal_state_struct anneal_state;
+struct anneal_state_struct
+{
+    cuzmem_bitset* current;     // plan draft we move from
+    cuzmem_bitset* candidate;   // neighbour being run
+    double current_time;
+    double best_time;
+    double t0;                  // start temperature (s)
+    double temp;                // current temperature (s)
+    double alpha;
+    enum anneal_schedule schedule;
+    cuzmem_prng prng;
+    unsigned long long accepted;
+    unsigned long long rejected;    // infeasible, never run
+};
+// -----------------------------------------------
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static double
+env_double (const char* name, double def)
+{
+    char* env = getenv (name);
+    return env ? atof (env) : def;
+}
+
+
+static anneal_state*
+anneal_state_create (CUZMEM_CONTEXT ctx, double trace_time)
+{
+    char* env;
+    anneal_state* state = (anneal_state*)malloc (sizeof(anneal_state));
+
+    state->current = bitset_create (ctx->num_genes);
+    state->candidate = bitset_create (ctx->num_genes);
+    genome_from_plan (ctx, state->current);
+
+    state->current_time = trace_time;
+    state->best_time = trace_time;
+    state->t0 = env_double ("CUZMEM_ANNEAL_T0", ANNEAL_T0) * trace_time;
+    state->temp = state->t0;
+    state->alpha = env_double ("CUZMEM_ANNEAL_ALPHA", ANNEAL_ALPHA);
+    state->accepted = 0;
+    state->rejected = 0;
+
+    env = getenv ("CUZMEM_ANNEAL_SEED");
+    prng_seed (&state->prng, env ? strtoull (env, NULL, 10) : ANNEAL_SEED);
+
+    state->schedule = ANNEAL_GEOMETRIC;
+    env = getenv ("CUZMEM_ANNEAL_SCHEDULE");
+    if (env != NULL) {
+        if (!strcmp (env, "linear")) {
+            state->schedule = ANNEAL_LINEAR;
+        }
+        else if (!strcmp (env, "log")) {
+            state->schedule = ANNEAL_LOG;
+        }
+        else if (strcmp (env, "geometric")) {
+            fprintf (stderr, "libcuzmem: unknown CUZMEM_ANNEAL_SCHEDULE '%s', using geometric\n", env);
+        }
+    }
+
+    return state;
+}
+
+
+static void
+anneal_state_destroy (anneal_state* state)
+{
+    bitset_destroy (state->current);
+    bitset_destroy (state->candidate);
+    free (state);
+}
+
+
+// temperature after k iterations
+static void
+anneal_cool (CUZMEM_CONTEXT ctx, anneal_state* state, unsigned long long k)
+{
+    switch (state->schedule)
+    {
+    case ANNEAL_LINEAR:
+        state->temp = state->t0 * (1.0 - (double)k / (double)ctx->tune_iter_max);
+        break;
+    case ANNEAL_LOG:
+        state->temp = state->t0 * log (2.0) / log ((double)k + 2.0);
+        break;
+    case ANNEAL_GEOMETRIC:
+    default:
+        state->temp = state->t0 * pow (state->alpha, (double)k);
+    }
+}
+
+
+// draft the next neighbour of the current plan into state->candidate
+static void
+anneal_propose (CUZMEM_CONTEXT ctx, anneal_state* state)
+{
+    unsigned int i, j, k, tries, flipped[MAX_FLIPS];
+    unsigned int n = (unsigned int)ctx->num_genes;
+    size_t gpu_mem_min, gpu_mem_max;
+
+    gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
+
+    for (tries=0; tries<MAX_TRIES; tries++) {
+        bitset_copy (state->candidate, state->current);
+
+        // # of bits to flip
+        k = 1;
+        while (k < MAX_FLIPS && k < n && prng_uniform (&state->prng) < 0.5) {
+            k++;
+        }
+
+        // flip k different genes
+        for (i=0; i<k; i++) {
+            do {
+                flipped[i] = prng_below (&state->prng, n);
+                for (j=0; j<i; j++) {
+                    if (flipped[j] == flipped[i]) {
+                        break;
+                    }
+                }
+            } while (j < i);
+            bitset_flip (state->candidate, flipped[i]);
+        }
+
+        if (genome_gpu_mem_req (ctx, state->candidate) < gpu_mem_max) {
+            return;
+        }
+        state->rejected++;
+    }
+
+    // no luck: move one gpu gene to pinned memory, which always fits
+    // if the current plan did
+    bitset_copy (state->candidate, state->current);
+    k = bitset_count (state->current);
+    if (k > 0) {
+        k = prng_below (&state->prng, k);
+        for (i=0; i<n; i++) {
+            if (bitset_get (state->current, i) && k-- == 0) {
+                bitset_set (state->candidate, i, 0);
+                break;
+            }
+        }
+    }
+}
+
+
+// judges the candidate that took time (iteration k) & cools down
+static void
+anneal_judge (CUZMEM_CONTEXT ctx, anneal_state* state, unsigned long long k, double time)
+{
+    double dt;
+
+    // Metropolis acceptance
+    dt = time - state->current_time;
+    if (dt <= 0.0 || (state->temp > 0.0 &&
+            prng_uniform (&state->prng) < exp (-dt / state->temp))) {
+        bitset_copy (state->current, state->candidate);
+        state->current_time = time;
+        state->accepted++;
+    }
+    if (time < state->best_time) {
+        state->best_time = time;
+        bitset_copy (ctx->best_plan, state->candidate);
+    }
+
+#if defined (DEBUG)
+    fprintf (stderr, "libcuzmem: anneal: iter %llu  T: %f  t: %f  best: %f\n",
+            k, state->temp, time, state->best_time);
+#endif
+
+    anneal_cool (ctx, state, k);
+}
+
+
+//------------------------------------------------------------------------------
+// ANNEALING TUNER
+//------------------------------------------------------------------------------
+cuzmem_plan*
+cuzmem_tuner_anneal (enum cuzmem_tuner_action action, void* parm)
+{
+    anneal_state* state;
+    CUZMEM_CONTEXT ctx = get_context();
+
+    // =========================================================================
+    //  TUNER START
+    // =========================================================================
+    if (CUZMEM_TUNER_START == action) {
+        // the candidate was drafted at the end of the previous iteration
+
+        // start timing the iteration
+        ctx->start_time = get_time ();
+
+        // Return value currently has no meaning
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER LOOKUP
+    // =========================================================================
+    else if (CUZMEM_TUNER_LOOKUP == action) {
+        // parm: pointer to size of allocation
+        size_t size = *(size_t*)(parm);
+        int loc;
+        cuzmem_plan* entry = NULL;
+
+        // default 0th tuning iteration handling
+        if (ctx->tune_iter == 0) {
+            return zeroth_lookup_handler (ctx, size);
+        }
+
+        // handle looping allocations & get current entry
+        if (loopy_entry (ctx, &entry, size)) {
+            return loopy_entry_handler (entry, size);
+        }
+
+        RESTORE_STATE (state);
+
+        // assign candidate's location to entry and perform allocation
+        loc = bitset_get (state->candidate, entry->gene);
+        entry->loc = loc;
+        alloc_mem (entry, size);
+
+        // check for environment induced mutation
+        if (entry->loc != loc) {
+            bitset_set (state->candidate, entry->gene, entry->loc);
+        }
+
+        ctx->current_knob++;
+
+        return entry;
+    }
+    // =========================================================================
+    //  TUNER END
+    // =========================================================================
+    else if (CUZMEM_TUNER_END == action) {
+        double time;
+        cuzmem_plan* entry;
+
+        time = fitness_time (&ctx->fitness);
+
+        if (ctx->tune_iter == 0) {
+            if (zeroth_end_handler (ctx)) {
+                // everything fits in GPU memory, returning ends search
+                return NULL;
+            }
+
+            // annealing specific: start from the memory trace plan
+            ctx->tune_iter_max = (unsigned long long)
+                    env_double ("CUZMEM_ANNEAL_ITERS", ANNEAL_ITERS);
+            state = anneal_state_create (ctx, time);
+            bitset_copy (ctx->best_plan, state->current);
+            SAVE_STATE (state);
+        }
+        else {
+            RESTORE_STATE (state);
+            anneal_judge (ctx, state, ctx->tune_iter, time);
+        }
+
+        // clear out all of our inloop entry's 1st hit flags
+        for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+            entry->first_hit = 1;
+        }
+
+        // always end with this
+        max_iteration_handler (ctx);
+        while (ctx->op_mode != CUZMEM_RUN) {
+            anneal_propose (ctx, state);
+
+            // neighbours measured already don't need another run
+            if (lookup_fitness (ctx, state->candidate, &time) == MEMO_MISS) {
+                break;
+            }
+            ctx->tune_iter++;
+            anneal_judge (ctx, state, ctx->tune_iter, time);
+            max_iteration_handler (ctx);
+        }
+
+        if (ctx->op_mode == CUZMEM_RUN) {
+            fprintf (stderr, "libcuzmem: anneal: %llu moves accepted, %llu infeasible moves skipped, best %f s\n",
+                    state->accepted, state->rejected, state->best_time);
+            anneal_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER SAVE / LOAD / DROP (checkpoint)
+    // =========================================================================
+    else if (CUZMEM_TUNER_SAVE == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+
+        RESTORE_STATE (state);
+        ckpt_put_bitset (ck, state->current);
+        ckpt_put_bitset (ck, state->candidate);
+        ckpt_put (ck, &state->current_time, sizeof(state->current_time));
+        ckpt_put (ck, &state->best_time, sizeof(state->best_time));
+        ckpt_put (ck, &state->t0, sizeof(state->t0));
+        ckpt_put (ck, &state->temp, sizeof(state->temp));
+        ckpt_put (ck, &state->alpha, sizeof(state->alpha));
+        ckpt_put (ck, &state->schedule, sizeof(state->schedule));
+        ckpt_put (ck, &state->prng, sizeof(state->prng));
+        ckpt_put (ck, &state->accepted, sizeof(state->accepted));
+        ckpt_put (ck, &state->rejected, sizeof(state->rejected));
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_LOAD == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+
+        state = anneal_state_create (ctx, 0.0);
+        ckpt_get_bitset (ck, state->current);
+        ckpt_get_bitset (ck, state->candidate);
+        ckpt_get (ck, &state->current_time, sizeof(state->current_time));
+        ckpt_get (ck, &state->best_time, sizeof(state->best_time));
+        ckpt_get (ck, &state->t0, sizeof(state->t0));
+        ckpt_get (ck, &state->temp, sizeof(state->temp));
+        ckpt_get (ck, &state->alpha, sizeof(state->alpha));
+        ckpt_get (ck, &state->schedule, sizeof(state->schedule));
+        ckpt_get (ck, &state->prng, sizeof(state->prng));
+        ckpt_get (ck, &state->accepted, sizeof(state->accepted));
+        ckpt_get (ck, &state->rejected, sizeof(state->rejected));
+        SAVE_STATE (state);
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_DROP == action) {
+        RESTORE_STATE (state);
+        if (state != NULL) {
+            anneal_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
+        return NULL;
+    }
+    // =========================================================================
+    // TUNER: UNKNOWN ACTION SPECIFIED
+    // =========================================================================
+    else {
+        printf ("libcuzmem: tuner asked to perform unknown action!\n");
+        exit (1);
+        return NULL;
+    }
+    // =========================================================================
+}
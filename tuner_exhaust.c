@@ -16,12 +16,86 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <math.h>
 #include "context.h"
 #include "plans.h"
 #include "tuner_util.h"
+#include "checkpoint.h"
+#include "queue.h"
 #include "tuner_exhaust.h"
 
+// -- State Macros -----------------------
+#define SAVE_STATE(state_ptr)            \
+    (ctx->tuner_state = (void*)state_ptr) 
+
+#define RESTORE_STATE(state_ptr)         \
+    (state_ptr = ctx->tuner_state)        
+// ---------------------------------------
+
+// NOTES
+//
+// * The plan draft for tuning iteration i is the binary number i: bit k
+//   is the location of the knobs in gene k.  With more than 64 knobs i
+//   no longer fits in tune_iter, so the plan draft being run is kept as
+//   a bitset genome that counts along with tune_iter.
+//
+// * Exhaustive search over more than a few dozen knobs will of course
+//   never finish; tune_iter_max saturates rather than overflows.
+//
+// * A draft whose pinned allocations had to fall back to global memory
+//   ("natural mutation") did not run the plan it describes, so it can't
+//   become the best plan.  (This used to be done by skewing start_time.)
+//
+// * Drafts whose placement was already measured (usually because an
+//   earlier draft fell back to it) are judged from the memo instead of
+//   being run again.
+//
+// * In a coordinated tuning session (see queue.c) the drafts after the
+//   one about to run are offered ahead, one per worker.
+
+// -- Exhaustive Tuner State ---------------------
+typedef struct exhaust_state_struct exhaust_state;
+struct exhaust_state_struct
+{
+    cuzmem_bitset* genome;          // plan draft being run
+    unsigned long long best_iter;   // iteration that found best_plan
+    int mutated;                    // this draft didn't run as planned
+};
+// -----------------------------------------------
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+
+// offers the drafts after genome (draft #i) that meet the gpu memory
+// constraint to the workers of a coordinated tuning session, if any
+static void
+offer_ahead (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome, unsigned long long i,
+             size_t gpu_mem_min, size_t gpu_mem_max)
+{
+    unsigned int n = queue_workers (&ctx->queue);
+    size_t gpu_mem_req;
+    cuzmem_bitset* ahead;
+
+    if (n == 0) {
+        return;
+    }
+
+    ahead = bitset_clone (genome);
+    while (n > 0 && !bitset_increment (ahead) && ++i < ctx->tune_iter_max) {
+        gpu_mem_req = genome_gpu_mem_req (ctx, ahead);
+        if ((gpu_mem_req < gpu_mem_min) || (gpu_mem_req >= gpu_mem_max)) {
+            continue;
+        }
+        offer_draft (ctx, ahead);
+        n--;
+    }
+    bitset_destroy (ahead);
+}
+
+
 //------------------------------------------------------------------------------
 // TUNER INTERFACE
 //------------------------------------------------------------------------------
@@ -58,6 +132,7 @@ cuzmem_tuner_exhaust (enum cuzmem_tuner_action action, void* parm)
         CUresult ret;
         int loopy = 0;
         cuzmem_plan* entry = NULL;
+        exhaust_state* state;
         int loc;
 
         // default 0th tuning iteration handling
@@ -72,15 +147,15 @@ cuzmem_tuner_exhaust (enum cuzmem_tuner_action action, void* parm)
 
         // exhaustive tuning
         // ---------------------------------------------------------------------
-        entry->loc = (ctx->tune_iter >> ctx->current_knob) & 0x0001;
+        RESTORE_STATE (state);
+        entry->loc = bitset_get (state->genome, entry->gene);
 
         loc = entry->loc;
         ret = alloc_mem (entry, size);
 
         // "natural mutation"
         if (loc != entry->loc) {
-            // add large value to timer to invalidate this plan 
-            ctx->start_time -= (0.50*ctx->start_time);
+            state->mutated = 1;
         }
         // ---------------------------------------------------------------------
 
@@ -92,14 +167,14 @@ cuzmem_tuner_exhaust (enum cuzmem_tuner_action action, void* parm)
     //  TUNER END
     // =========================================================================
     else if (CUZMEM_TUNER_END == action) {
-        int i;
+        unsigned long long i;
         double time;
         cuzmem_plan* entry = NULL;
+        exhaust_state* state;
+        int hit;
         int all_global = 1;
         int satisfied = 0;
-        unsigned int gpu_mem_free, gpu_mem_total, gpu_mem_req;
-        unsigned int gpu_mem_min;
-        CUresult ret;
+        size_t gpu_mem_req, gpu_mem_min, gpu_mem_max;
 
         // standard tuner structure
         // ---------------------------------------------------------------------
@@ -110,32 +185,41 @@ cuzmem_tuner_exhaust (enum cuzmem_tuner_action action, void* parm)
             }
 
             // exhaustive search specific: compute # of tune iterations
-            ctx->tune_iter_max = (unsigned long long)pow (2, ctx->num_knobs);
+            if (ctx->num_genes < 64) {
+                ctx->tune_iter_max = 1ULL << ctx->num_genes;
+            } else {
+                ctx->tune_iter_max = ULLONG_MAX;
+            }
+
+            // the 0th iteration is plan draft #0
+            state = (exhaust_state*)malloc (sizeof(exhaust_state));
+            state->genome = bitset_create (ctx->num_genes);
+            state->best_iter = 0;
+            state->mutated = 0;
+            SAVE_STATE (state);
         }
 
+        RESTORE_STATE (state);
+
         // get the time to complete this iteration
-        time = get_time() - ctx->start_time;
+        time = fitness_time (&ctx->fitness);
 
-        if (time < ctx->best_time) {
+        // the 0th iteration ran the trace placement, not draft #0
+        if (ctx->tune_iter > 0 && !state->mutated && time < ctx->best_time) {
             ctx->best_time = time;
-            ctx->best_plan = ctx->tune_iter;    // algorithm dependent
+            bitset_copy (ctx->best_plan, state->genome);    // algorithm dependent
+            state->best_iter = ctx->tune_iter;
         }
+        state->mutated = 0;
 
         // reset current knob for next tune iteration
         ctx->current_knob = 0;
         // ---------------------------------------------------------------------
 
-        printf ("libcuzmem: best plan is #%llu of %llu\n", ctx->best_plan, ctx->tune_iter_max);
+        printf ("libcuzmem: best plan is #%llu of %llu\n", state->best_iter, ctx->tune_iter_max);
 
         // pull down GPU global memory usage from CUDA driver
-        ret = cuMemGetInfo (&gpu_mem_free, &gpu_mem_total);
-        if (ret != CUDA_SUCCESS) {
-            fprintf (stderr, "libcuzmem: could not retrieve GPU memory info from CUDA Driver!\n");
-            exit (1);
-        } else {
-            gpu_mem_min = (unsigned int)((float)gpu_mem_free * (float)ctx->gpu_mem_percent * 0.01f);
-            gpu_mem_free -= 20000000;
-        }
+        gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
 
         // check to make sure the next iteration's plan draft meets the GPU
         // global memory utilization constraint if it doesn't, we will skip it
@@ -143,41 +227,101 @@ cuzmem_tuner_exhaust (enum cuzmem_tuner_action action, void* parm)
         //
         // we also use this oppurtunity to clear out all of our inloop entry's
         // 1st hit flags
+        entry = ctx->plan;
+        while (entry != NULL) {
+            entry->first_hit = 1;
+            entry = entry->next;
+        }
+
         i = ctx->tune_iter + 1;
         do {
-            gpu_mem_req = 0;
-            entry = ctx->plan;
-            while (entry != NULL) {
-                entry->loc = (i >> entry->id) & 0x0001;
-                entry->first_hit = 1;
-                if (entry->loc == 1 && entry->gold_member) {
-                    gpu_mem_req += entry->size;
-                }
-                entry = entry->next;
+            if (bitset_increment (state->genome) || i >= ctx->tune_iter_max) {
+                // out of plan drafts
+                i = ctx->tune_iter_max + 1;
+                break;
             }
 
+            gpu_mem_req = genome_gpu_mem_req (ctx, state->genome);
+
             fprintf (stderr,
-                        "  Request for Plan %i of %llu: %i (min: %i)\n",
+                        "  Request for Plan %llu of %llu: %lu (min: %lu)\n",
                         i,
                         ctx->tune_iter_max,
-                        gpu_mem_req,
-                        gpu_mem_min
+                        (unsigned long)gpu_mem_req,
+                        (unsigned long)gpu_mem_min
             );
 
-            if ((gpu_mem_req >= gpu_mem_min) && (gpu_mem_req < gpu_mem_free)) {
-                // we subtract one beacuse tune_iter is auto-increment after this
-                // function returns (before the next tune iterations starts)
-                ctx->tune_iter = i - 1;
+            if ((gpu_mem_req < gpu_mem_min) || (gpu_mem_req >= gpu_mem_max)) {
+                i++;
+                continue;
+            }
+
+            // measured already?  then there is no need to run it again
+            hit = lookup_fitness (ctx, state->genome, &time);
+            if (hit == MEMO_MISS) {
                 satisfied = 1;
             } else {
+                if (hit == MEMO_REALIZED && time < ctx->best_time) {
+                    ctx->best_time = time;
+                    bitset_copy (ctx->best_plan, state->genome);
+                    state->best_iter = i;
+                }
                 i++;
             }
         } while (!satisfied);
 
+        if (satisfied) {
+            offer_ahead (ctx, state->genome, i, gpu_mem_min, gpu_mem_max);
+        }
+
+        // we subtract one beacuse tune_iter is auto-increment after this
+        // function returns (before the next tune iterations starts)
+        ctx->tune_iter = i - 1;
+
 
 
         // always end with this
         max_iteration_handler (ctx);
+        if (ctx->op_mode == CUZMEM_RUN) {
+            bitset_destroy (state->genome);
+            free (state);
+            SAVE_STATE (NULL);
+        }
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER SAVE / LOAD / DROP (checkpoint)
+    // =========================================================================
+    else if (CUZMEM_TUNER_SAVE == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+        exhaust_state* state;
+
+        RESTORE_STATE (state);
+        ckpt_put_bitset (ck, state->genome);
+        ckpt_put (ck, &state->best_iter, sizeof(state->best_iter));
+        ckpt_put (ck, &state->mutated, sizeof(state->mutated));
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_LOAD == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+        exhaust_state* state = (exhaust_state*)malloc (sizeof(exhaust_state));
+
+        state->genome = bitset_create (ctx->num_genes);
+        ckpt_get_bitset (ck, state->genome);
+        ckpt_get (ck, &state->best_iter, sizeof(state->best_iter));
+        ckpt_get (ck, &state->mutated, sizeof(state->mutated));
+        SAVE_STATE (state);
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_DROP == action) {
+        exhaust_state* state;
+
+        RESTORE_STATE (state);
+        if (state != NULL) {
+            bitset_destroy (state->genome);
+            free (state);
+            SAVE_STATE (NULL);
+        }
         return NULL;
     }
     // =========================================================================
@@ -17,18 +17,18 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include "context.h"
 #include "plans.h"
+#include "prng.h"
 #include "tuner_util.h"
+#include "checkpoint.h"
 #include "tuner_genetic.h"
 
 //-------------------------------------------
-#define MIN_GPU_MEM 0.50f
-#define GENERATIONS 10
-#define POPULATION  20
-#define ELITE       0.25f
-#define MUTATION    0.25f
+#define MIN_GAIN    0.005       // least relative gain that counts as progress
+#define MAX_TRIES   64          // random 1st generation genomes tried per candidate
 //-------------------------------------------
 
 #define DEBUG
@@ -53,6 +53,74 @@
 //   automatically move a GPU allocation to pinned host memory and modify
 //   entry->loc.  This is an environment induced mutation and should be
 //   checked for after every alloc_mem().
+//
+// * Elites, offspring identical to a parent, and drafts that mutate into
+//   a placement already run are not run again: their fitness comes from
+//   the memo.  So generations are bred at the end of an iteration, where
+//   the candidates the memo knows can be skipped over.
+//
+// * All randomness comes from a xorshift generator seeded with
+//   parms.seed, so a tuning session can be repeated exactly (given the
+//   same measurements).  rand() is left to the application.
+//
+// * Adaptive mutation: every generation whose best is no more than
+//   MIN_GAIN better than the best before it raises the mutation rate by
+//   the base rate.  If the population has collapsed to a quarter as many
+//   distinct genomes as candidates, every offspring is mutated.  Any
+//   real gain drops the rate back to the base rate.
+//
+// * Feasibility repair: crossover & mutation can make offspring whose
+//   gold members need more gpu memory than is free.  alloc_mem() would
+//   push some of them to pinned memory anyway, at random, and we would
+//   spend a run on a candidate nobody bred.  Instead every new genome is
+//   projected onto the gpu_mem_budget() max before it is run: gold genes
+//   it wants in gpu memory are moved to pinned memory, in random order,
+//   until it fits.  The # of repairs is reported every generation.
+//
+// * Early stopping: after parms.stall generations in a row without gain
+//   the search ends and the best candidate becomes the plan.
+//
+// * The plan is the fastest candidate ever measured (ctx->best_plan), not
+//   the best of the last generation: with no elites a generation can be
+//   worse than the one before it.
+//
+// * Screening: with parms.screen > 1, each new candidate is the one of
+//   parms.screen drafts (bred or random) that sim.c predicts to be the
+//   fastest, replaying the 0th iteration's allocation trace.  Drafts
+//   are cheap to simulate & expensive to run, so many more placements
+//   are looked at for the same # of runs.  The prediction only ranks
+//   drafts: the fitness of a candidate is always measured.
+//
+// * In a coordinated tuning session (see queue.c) every generation is
+//   offered to the workers as soon as it is made.
+//
+// * Parameters come from cuzmem_set_genetic() & friends, or from:
+//     CUZMEM_GENETIC_GENERATIONS  (10)
+//     CUZMEM_GENETIC_POPULATION   (20, at least 4)
+//     CUZMEM_GENETIC_ELITE        (0.25)
+//     CUZMEM_GENETIC_MUTATION     (0.25)
+//     CUZMEM_GENETIC_MIN_GPU_MEM  (0.50)
+//     CUZMEM_GENETIC_STALL        (3, 0 never stops early)
+//     CUZMEM_GENETIC_SEED         (1)
+//     CUZMEM_GENETIC_SCREEN       (1, no screening)
+
+// -- Genetic Tuner State ------------------------
+typedef struct genetic_state_struct genetic_state;
+struct genetic_state_struct
+{
+    cuzmem_genetic_parms parms;     // fixed when tuning starts
+    cuzmem_prng prng;
+    candidate** c;                  // the current generation
+    unsigned int num_elite;
+    unsigned int generation;
+    double best_fit;                // best of all earlier generations
+    unsigned int stalled;           // generations in a row without gain
+    float mutation;                 // current mutation rate
+    unsigned int* gene;             // scratch: gold genes of a genome
+    unsigned long long repairs;     // offspring repaired, all generations
+    unsigned long long screened;    // drafts simulated, all generations
+};
+// -----------------------------------------------
 
 
 #if defined (DEBUG)
@@ -62,60 +130,96 @@
 //------------------------------------------------------------------------------
 // HELPERS
 //------------------------------------------------------------------------------
+static int
+cmp_fit (const void* a, const void* b)
+{
+    double x = (*(candidate* const*)a)->fit;
+    double y = (*(candidate* const*)b)->fit;
+    return (x > y) - (x < y);
+}
+
+
 void
 sort (candidate** c, int n)
 {
-    int i, j;
-    double tmp_fit;
-    unsigned long long tmp_DNA;
-    for (j=0; j<(n-1); j++) {
-        for (i=0; i<(n-(1+j)); i++) {
-            if (c[i]->fit > c[i+1]->fit) {
-                tmp_fit = c[i+1]->fit;
-                tmp_DNA = c[i+1]->DNA;
-
-                c[i+1]->fit = c[i]->fit;
-                c[i+1]->DNA = c[i]->DNA;
-
-                c[i]->fit = tmp_fit;
-                c[i]->DNA = tmp_DNA;
-            }
+    qsort (c, n, sizeof(candidate*), cmp_fit);
+}
+
+
+candidate*
+candidate_create (CUZMEM_CONTEXT ctx)
+{
+    candidate* c = (candidate*)malloc (sizeof(candidate));
+
+    c->DNA = bitset_create (ctx->num_genes);
+    c->fit = 0;
+
+    return c;
+}
+
+
+void
+candidate_destroy (candidate* c)
+{
+    bitset_destroy (c->DNA);
+    free (c);
+}
+
+
+// moves gold genes of dna to pinned memory until its gpu memory
+// requirement is under max.  returns 1 if anything had to be moved
+static int
+repair (CUZMEM_CONTEXT ctx, genetic_state* state, cuzmem_bitset* dna, size_t max)
+{
+    unsigned int g, k, n = 0;
+    size_t gpu_mem_req = genome_gpu_mem_req (ctx, dna);
+
+    if (gpu_mem_req < max) {
+        return 0;
+    }
+
+    for (g=0; g<ctx->num_genes; g++) {
+        if (bitset_get (ctx->gold_mask, g) && bitset_get (dna, g)) {
+            state->gene[n++] = g;
         }
     }
+
+    // drop randomly picked gold genes (a partial Fisher-Yates shuffle)
+    while (gpu_mem_req >= max && n > 0) {
+        k = prng_below (&state->prng, n);
+        g = state->gene[k];
+        state->gene[k] = state->gene[--n];
+
+        bitset_set (dna, g, 0);
+        gpu_mem_req -= ctx->gene_size[g];
+    }
+
+    return 1;
 }
 
 
 candidate*
-immaculate_conception (CUZMEM_CONTEXT ctx)
+immaculate_conception (CUZMEM_CONTEXT ctx, genetic_state* state)
 {
-    unsigned long long DNA;
-    unsigned int loc, gpu_mem_free, gpu_mem_total, gpu_mem_req;
-    unsigned int creating = 1;
-    cuzmem_plan* entry = ctx->plan;
-    candidate* c = (candidate*)malloc (sizeof(candidate));
+    unsigned int gpu_mem_free, gpu_mem_total;
+    size_t gpu_mem_req, gpu_mem_min, gpu_mem_max;
+    unsigned int tries;
+    candidate* c = candidate_create (ctx);
 
-    cuMemGetInfo (&gpu_mem_free, &gpu_mem_total);
+    get_gpu_mem_info (&gpu_mem_free, &gpu_mem_total);
+    gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
 
-    while (creating) {
-        c->DNA = rand();
-        c->DNA = c->DNA << 32;
-        c->DNA = c->DNA + rand();
-        c->DNA &= generate_mask(ctx->num_knobs);
+    // (if the floor can't be met, settle for the last genome tried)
+    for (tries=0; tries<MAX_TRIES; tries++) {
+        bitset_random_prng (c->DNA, &state->prng);
+        repair (ctx, state, c->DNA, gpu_mem_max);
 
         // gpu memory utilization
-        gpu_mem_req = 0;
-        entry = ctx->plan;
-        while (entry != NULL) {
-            if (entry->gold_member) {
-                loc = (c->DNA >> entry->id) & 0x0001;
-                gpu_mem_req += entry->size * loc;
-            }
-            entry = entry->next;
-        }
+        gpu_mem_req = genome_gpu_mem_req (ctx, c->DNA);
 
         // check constraint
-        if (gpu_mem_req > gpu_mem_free * MIN_GPU_MEM) {
-            creating = 0;
+        if (gpu_mem_req > gpu_mem_free * state->parms.min_gpu_mem) {
+            break;
         }
     }
 
@@ -124,31 +228,388 @@ immaculate_conception (CUZMEM_CONTEXT ctx)
 }
 
 
+// remember a candidate if it is the fastest one so far
+static void
+keep_best (CUZMEM_CONTEXT ctx, const candidate* c)
+{
+    if (c->fit < ctx->best_time) {
+        ctx->best_time = c->fit;
+        bitset_copy (ctx->best_plan, c->DNA);
+    }
+}
+
+
 void
 save_trace_candidate (CUZMEM_CONTEXT ctx)
 {
-    cuzmem_plan* entry = ctx->plan;
+    genetic_state* state;
+    RESTORE_STATE (state);
+
+    state->c[0] = candidate_create (ctx);
+    state->c[0]->fit = fitness_time (&ctx->fitness);
+    genome_from_plan (ctx, state->c[0]->DNA);
+    keep_best (ctx, state->c[0]);
+}
 
+
+static unsigned int
+env_uint (const char* name, unsigned int def)
+{
+    char* env = getenv (name);
+    return env ? (unsigned int)strtoul (env, NULL, 10) : def;
+}
+
+
+static float
+env_float (const char* name, float def)
+{
+    char* env = getenv (name);
+    return env ? (float)atof (env) : def;
+}
+
+
+// makes parameters the tuner can work with
+static void
+genetic_parms_check (cuzmem_genetic_parms* g)
+{
+    if (g->generations < 1) {
+        g->generations = 1;
+    }
+    if (g->population < 4) {
+        fprintf (stderr, "libcuzmem: genetic population of %u is too small, using 4\n", g->population);
+        g->population = 4;
+    }
+    if (g->elite < 0.0f || g->elite * g->population >= g->population - 1) {
+        fprintf (stderr, "libcuzmem: genetic elite fraction %f out of range, using %f\n",
+                g->elite, GENETIC_ELITE);
+        g->elite = GENETIC_ELITE;
+    }
+    if (g->mutation < 0.0f) {
+        g->mutation = 0.0f;
+    }
+    if (g->mutation > 1.0f) {
+        g->mutation = 1.0f;
+    }
+    if (g->screen < 1) {
+        g->screen = 1;
+    }
+}
+
+
+static genetic_state*
+genetic_state_create (CUZMEM_CONTEXT ctx)
+{
+    genetic_state* state = (genetic_state*)malloc (sizeof(genetic_state));
+
+    state->parms = ctx->genetic;
+    genetic_parms_check (&state->parms);
+    prng_seed (&state->prng, state->parms.seed);
+
+    state->c = (candidate**)calloc (state->parms.population, sizeof(candidate*));
+    state->num_elite = (unsigned int)(state->parms.population * state->parms.elite);
+    state->generation = 0;
+    state->best_fit = -1.0;
+    state->stalled = 0;
+    state->mutation = state->parms.mutation;
+    state->gene = NULL;             // (# of genes isn't known yet)
+    state->repairs = 0;
+    state->screened = 0;
+
+    return state;
+}
+
+
+static void
+genetic_state_destroy (genetic_state* state)
+{
+    unsigned int i;
+
+    for (i=0; i<state->parms.population; i++) {
+        if (state->c[i] != NULL) {
+            candidate_destroy (state->c[i]);
+        }
+    }
+    free (state->c);
+    free (state->gene);
+    free (state);
+}
+
+
+// # of different genomes in the (sorted) generation
+static unsigned int
+diversity (genetic_state* state)
+{
+    unsigned int i, j, n = 0;
+
+    for (i=0; i<state->parms.population; i++) {
+        for (j=0; j<i; j++) {
+            if (bitset_equal (state->c[i]->DNA, state->c[j]->DNA)) {
+                break;
+            }
+        }
+        if (j == i) {
+            n++;
+        }
+    }
+    return n;
+}
+
+
+// judges the generation just measured: adapts the mutation rate and
+// returns 0 if the search has stopped paying off
+static int
+judge_generation (genetic_state* state)
+{
+    float base = state->parms.mutation;
+    double best = state->c[0]->fit;
+
+    if (state->best_fit < 0.0 || best < state->best_fit * (1.0 - MIN_GAIN)) {
+        state->stalled = 0;
+        state->mutation = base;
+    } else {
+        state->stalled++;
+        state->mutation += (base > 0.0f) ? base : 0.1f;
+    }
+    if (state->best_fit < 0.0 || best < state->best_fit) {
+        state->best_fit = best;
+    }
+
+    if (diversity (state) * 4 <= state->parms.population) {
+        state->mutation = 1.0f;
+    }
+    if (state->mutation > 1.0f) {
+        state->mutation = 1.0f;
+    }
+
+    return !(state->parms.stall > 0 && state->stalled >= state->parms.stall);
+}
+
+
+// none of a generation's candidates depend on each other's fitness, so
+// all of them can be run at once (by the workers of a coordinated
+// tuning session, if there are any)
+static void
+offer_generation (CUZMEM_CONTEXT ctx, genetic_state* state)
+{
+    unsigned int i;
+
+    for (i=0; i<state->parms.population; i++) {
+        offer_draft (ctx, state->c[i]->DNA);
+    }
+}
+
+
+// breeds an offspring of the top half of the (sorted) generation into
+// dna.  returns 1 if it had to be repaired to fit gpu memory
+static unsigned int
+breed (CUZMEM_CONTEXT ctx, genetic_state* state, cuzmem_bitset* dna,
+       cuzmem_bitset* mix, size_t gpu_mem_max)
+{
+    unsigned int mom, dad;
+    unsigned int population = state->parms.population;
+    candidate** c = state->c;
+
+    // choose parents (no asexual reproduction)
+    do {
+        mom = prng_below (&state->prng, population / 2);
+        dad = prng_below (&state->prng, population / 2);
+    } while (mom == dad);
+
+    // determine DNA mix
+    bitset_random_prng (mix, &state->prng);
+
+    // mate the parents
+    bitset_crossover (dna, c[mom]->DNA, c[dad]->DNA, mix);
+
+    // mutate sometimes so we don't become overly inbread
+    if (prng_uniform (&state->prng) < state->mutation) {
+        bitset_random_prng (mix, &state->prng);
+        bitset_xor (dna, mix);
+    }
+
+    // keep it within the gpu memory there is
+    return repair (ctx, state, dna, gpu_mem_max);
+}
+
+
+// breed(), but when screening: the offspring predicted to be fastest
+// of parms.screen
+static unsigned int
+screened_offspring (CUZMEM_CONTEXT ctx, genetic_state* state, cuzmem_bitset* dna,
+                    cuzmem_bitset* mix, size_t gpu_mem_max)
+{
+    unsigned int k, rep, best_rep;
+    double time, best_time;
+    cuzmem_bitset* draft;
+
+    best_rep = breed (ctx, state, dna, mix, gpu_mem_max);
+    if (state->parms.screen < 2 || !predict_fitness (ctx, dna, &best_time)) {
+        return best_rep;
+    }
+
+    draft = bitset_create (ctx->num_genes);
+    for (k=1; k<state->parms.screen; k++) {
+        rep = breed (ctx, state, draft, mix, gpu_mem_max);
+        predict_fitness (ctx, draft, &time);
+        if (time < best_time) {
+            bitset_copy (dna, draft);
+            best_time = time;
+            best_rep = rep;
+        }
+    }
+    state->screened += state->parms.screen;
+    bitset_destroy (draft);
+
+    return best_rep;
+}
+
+
+// immaculate_conception(), but when screening: the 1st generation
+// candidate predicted to be fastest of parms.screen
+static candidate*
+screened_conception (CUZMEM_CONTEXT ctx, genetic_state* state)
+{
+    unsigned int k;
+    double time, best_time;
+    candidate *best, *draft;
+
+    best = immaculate_conception (ctx, state);
+    if (state->parms.screen < 2 || !predict_fitness (ctx, best->DNA, &best_time)) {
+        return best;
+    }
+
+    for (k=1; k<state->parms.screen; k++) {
+        draft = immaculate_conception (ctx, state);
+        predict_fitness (ctx, draft->DNA, &time);
+        if (time < best_time) {
+            candidate_destroy (best);
+            best = draft;
+            best_time = time;
+        } else {
+            candidate_destroy (draft);
+        }
+    }
+    state->screened += state->parms.screen;
+
+    return best;
+}
+
+
+// makes the generation that tuning iteration iter starts.  returns 0
+// instead if tuning should stop
+static int
+next_generation (CUZMEM_CONTEXT ctx, unsigned long long iter)
+{
+    genetic_state* state;
     candidate** c;
-    RESTORE_STATE (c);
+    unsigned int i;
+    unsigned int population, repaired = 0;
+    size_t gpu_mem_min, gpu_mem_max;
+
+    RESTORE_STATE (state);
+    c = state->c;
+    population = state->parms.population;
+
+    // time to magic up the first generation
+    if (iter == 1) {
+        // c[0] is already populated by the mem trace plan's candidate
+        for (i=1; i<population; i++) {
+            c[i] = screened_conception (ctx, state);
+        }
+        state->generation = 1;
+        offer_generation (ctx, state);
+        return 1;
+    }
+
+    // time to breed the next generation
+    sort (c, population);
+
+#if defined (DEBUG)
+    fprintf (fp, "Generation %u (mutation %.2f)\n", state->generation, state->mutation);
+    for (i=0; i<population; i++) {
+        fprintf (fp, "c: %i  f: %f  dna: ", i, c[i]->fit);
+        bitset_fprint (fp, c[i]->DNA);
+        fprintf (fp, "\n");
+    }
+    fprintf (fp, "\n");
+    fflush (fp);
+#endif
+
+    if (!judge_generation (state)) {
+        fprintf (stderr, "libcuzmem: genetic: no gain in %u generations, stopping after generation %u\n",
+                state->stalled, state->generation);
+        return 0;
+    }
+
+    {
+        cuzmem_bitset* mix = bitset_create (ctx->num_genes);
+        candidate** b = (candidate**) malloc (sizeof(candidate*) * population);
+
+        gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
+
+        // construct buffer
+        for (i=0; i<population; i++) {
+            b[i] = candidate_create (ctx);
+        }
+
+        // pick out the "alpha-males"
+        for (i=0; i<state->num_elite; i++) {
+            bitset_copy (b[i]->DNA, c[i]->DNA);
+            b[i]->fit = c[i]->fit;
+        }
+
+        // remaining are offspring of the top 50th percentile
+        for (i=state->num_elite; i<population; i++) {
+            repaired += screened_offspring (ctx, state, b[i]->DNA, mix, gpu_mem_max);
+        }
+        state->repairs += repaired;
+
+        fprintf (stderr, "libcuzmem: genetic: generation %u: %u of %u offspring repaired to fit gpu memory\n",
+                state->generation + 1, repaired, population - state->num_elite);
 
-    c[0] = (candidate*)malloc (sizeof(candidate));
-    c[0]->DNA = 0x0;
-    c[0]->fit = get_time() - ctx->start_time;
-    while (entry != NULL) {
-        c[0]->DNA |= (entry->loc & 0x0001) << entry->id;
-        entry = entry->next;
+        // make offspring the new generation
+        for (i=0; i<population; i++) {
+            candidate_destroy (c[i]);
+        }
+        free (c);
+        bitset_destroy (mix);
+        state->c = b;
     }
 
-    SAVE_STATE (c);
+    state->generation++;
+    offer_generation (ctx, state);
+    return 1;
 }
 
+
+//------------------------------------------------------------------------------
+// GENETIC PARAMETERS
+//------------------------------------------------------------------------------
+void
+genetic_parms_init (cuzmem_genetic_parms* g)
+{
+    char* env;
+
+    g->generations = env_uint ("CUZMEM_GENETIC_GENERATIONS", GENETIC_GENERATIONS);
+    g->population = env_uint ("CUZMEM_GENETIC_POPULATION", GENETIC_POPULATION);
+    g->elite = env_float ("CUZMEM_GENETIC_ELITE", GENETIC_ELITE);
+    g->mutation = env_float ("CUZMEM_GENETIC_MUTATION", GENETIC_MUTATION);
+    g->min_gpu_mem = env_float ("CUZMEM_GENETIC_MIN_GPU_MEM", GENETIC_MIN_GPU_MEM);
+    g->stall = env_uint ("CUZMEM_GENETIC_STALL", GENETIC_STALL);
+    g->screen = env_uint ("CUZMEM_GENETIC_SCREEN", GENETIC_SCREEN);
+
+    env = getenv ("CUZMEM_GENETIC_SEED");
+    g->seed = env ? strtoull (env, NULL, 10) : GENETIC_SEED;
+}
+
+
 //------------------------------------------------------------------------------
 // GENETIC TUNER
 //------------------------------------------------------------------------------
 cuzmem_plan*
 cuzmem_tuner_genetic (enum cuzmem_tuner_action action, void* parm)
 {
+    genetic_state* state;
     candidate** c;
     CUZMEM_CONTEXT ctx = get_context();
 
@@ -162,90 +623,8 @@ cuzmem_tuner_genetic (enum cuzmem_tuner_action action, void* parm)
             fp = fopen("scores.txt", "w");
 #endif
             // allocate array of candidates
-            c = (candidate**)malloc (sizeof(candidate*) * POPULATION);
-            SAVE_STATE (c);
-        }
-        else if (ctx->tune_iter % POPULATION == 1) {
-            RESTORE_STATE (c);
-
-            // time to magic up the first generation
-            if (ctx->tune_iter == 1) {
-                int i;
-
-                // c[0] is already populated by the mem trace plan's candidate
-                for (i=1; i<POPULATION; i++) {
-                    c[i] = immaculate_conception (ctx);
-                }
-
-                SAVE_STATE (c);
-            }
-
-            // time to breed the next generation
-            else {
-                int i,mom,dad;
-                unsigned long long mix, mutant_dna;
-                int num_elite = POPULATION * ELITE;
-                candidate** b = (candidate**) malloc (sizeof(candidate*) * POPULATION);
-
-                sort (c, POPULATION);
-
-#if defined (DEBUG)
-                fprintf (fp, "Generation %i\n", ctx->tune_iter / POPULATION);
-                for (i=0; i<POPULATION; i++) {
-                    fprintf (fp, "c: %i  f: %f  dna: %llu\n", i, c[i]->fit, c[i]->DNA);
-                }
-                fprintf (fp, "\n");
-                fflush (fp);
-#endif
-                // construct buffer
-                for (i=0; i<POPULATION; i++) {
-                    b[i] = (candidate*)malloc (sizeof(candidate));
-                    b[i]->fit = 0;
-                }
-
-                // pick out the "alpha-males"
-                for (i=0; i<num_elite; i++) {
-                    b[i]->DNA = c[i]->DNA;
-                    b[i]->fit = c[i]->fit;
-                }
-
-                // remaining are offspring of the top 50th percentile
-                for (i=num_elite; i<(POPULATION); i++) {
-                    // choose parents (no asexual reproduction)
-                    do {
-                        mom = rand() % (POPULATION / 2);
-                        dad = rand() % (POPULATION / 2);
-                    } while (mom == dad);
-
-                    // determine DNA mix
-                    mix = rand();
-                    mix = mix << 32;
-                    mix = mix + rand();
-                    mix &= generate_mask(ctx->num_knobs);
-
-                    // mate the parents
-                    b[i]->DNA = c[mom]->DNA & mix; 
-                    mix  = (~mix) & generate_mask(ctx->num_knobs);
-                    b[i]->DNA |= c[dad]->DNA & mix;
-
-                    // mutate sometimes so we don't become overly inbread
-                    if (rand() < RAND_MAX * MUTATION) {
-                        mutant_dna = rand();
-                        mutant_dna = mutant_dna << 32;
-                        mutant_dna = mutant_dna + rand();
-                        mutant_dna &= generate_mask(ctx->num_knobs);
-                        b[i]->DNA ^= mutant_dna;
-                    }
-                }
-
-                // make offspring the new generation
-                SAVE_STATE (b);
-                for (i=0; i<POPULATION; i++) {
-                    free (c[i]);
-                }
-                free (c);
-
-            }
+            state = genetic_state_create (ctx);
+            SAVE_STATE (state);
         }
 
         // start timing the iteration
@@ -275,11 +654,12 @@ cuzmem_tuner_genetic (enum cuzmem_tuner_action action, void* parm)
             return loopy_entry_handler (entry, size);
         }
 
-        RESTORE_STATE (c);
+        RESTORE_STATE (state);
+        c = state->c;
 
         // retrieve candidate's location for this allocation
-        c_num = (ctx->tune_iter - 1) % POPULATION;
-        loc = (c[c_num]->DNA >> entry->id) & 0x0001;
+        c_num = (ctx->tune_iter - 1) % state->parms.population;
+        loc = bitset_get (c[c_num]->DNA, entry->gene);
 
         // assign to entry and perform allocation
         entry->loc = loc;
@@ -287,12 +667,8 @@ cuzmem_tuner_genetic (enum cuzmem_tuner_action action, void* parm)
 
         // check for environment induced mutation
         if (entry->loc != loc) {
-            // clear mutated bit
-            c[c_num]->DNA &= ~(0x0001 << entry->id);
-
-            // set mutated bit
-            c[c_num]->DNA |= entry->loc << entry->id;
-            SAVE_STATE (c);
+            // record mutated bit
+            bitset_set (c[c_num]->DNA, entry->gene, entry->loc);
         }
 
         // prepare for next iteration
@@ -304,30 +680,52 @@ cuzmem_tuner_genetic (enum cuzmem_tuner_action action, void* parm)
     // =========================================================================
     else if (CUZMEM_TUNER_END == action) {
         double time;
-        unsigned int c_num, i;
+        unsigned int c_num, i, population;
+        unsigned long long next;
+
+        RESTORE_STATE (state);
+        population = state->parms.population;
 
         if (ctx->tune_iter == 0) {
             if (zeroth_end_handler (ctx)) {
                 // everything fits in GPU memory, returning ends search
+#if defined (DEBUG)
+                fclose (fp);
+#endif
+                genetic_state_destroy (state);
+                SAVE_STATE (NULL);
                 return NULL;
             }
 
             // genetic search specific: compute # of tune iterations
-            ctx->tune_iter_max = (unsigned long long)(GENERATIONS * POPULATION);
+            ctx->tune_iter_max = (unsigned long long)state->parms.generations * population;
 
             // genetic search specific: put 0th iteration memory trace plan
             //    into the 1st generation candidate pool
             save_trace_candidate (ctx);
-
-            max_iteration_handler (ctx);
-            return NULL;
+            state->gene = (unsigned int*)malloc ((ctx->num_genes + 1) * sizeof(unsigned int));
+        }
+        else {
+            // put exec time into active candidate's fitness
+            c_num = (ctx->tune_iter - 1) % population;
+            state->c[c_num]->fit = fitness_time (&ctx->fitness);
+            keep_best (ctx, state->c[c_num]);
         }
 
-        RESTORE_STATE (c);
-
-        // put exec time into active candidate's fitness
-        c_num = (ctx->tune_iter - 1) % POPULATION;
-        c[c_num]->fit = get_time() - ctx->start_time;
+        // on to the next candidate the memo doesn't already know
+        for (next = ctx->tune_iter + 1; next <= ctx->tune_iter_max; next++) {
+            if (next % population == 1 && !next_generation (ctx, next)) {
+                next = ctx->tune_iter_max + 1;
+                break;
+            }
+            c_num = (next - 1) % population;
+            if (lookup_fitness (ctx, state->c[c_num]->DNA, &time) == MEMO_MISS) {
+                break;
+            }
+            state->c[c_num]->fit = time;
+            keep_best (ctx, state->c[c_num]);
+        }
+        ctx->tune_iter = next - 1;
 
         // if we are done
         if (ctx->tune_iter >= ctx->tune_iter_max) {
@@ -336,29 +734,105 @@ cuzmem_tuner_genetic (enum cuzmem_tuner_action action, void* parm)
             // leave tuning mode
             ctx->op_mode = CUZMEM_RUN;
 
-            // make the best final candidate the plan
-            sort (c, POPULATION);
+            // make the best candidate ever measured the plan
             while (entry != NULL) {
-                entry->loc = (c[0]->DNA >> entry->id) & 0x0001;
+                entry->loc = bitset_get (ctx->best_plan, entry->gene);
                 entry = entry->next;
             }
-            write_plan (ctx->plan, ctx->project_name, ctx->plan_name);
+            write_plan (ctx->plan, ctx->project_name, ctx->plan_name, &ctx->device);
+
+            fprintf (stderr, "libcuzmem: genetic: best %f s after %u generation%s, %llu offspring repaired (seed %llu)\n",
+                    ctx->best_time, state->generation, (state->generation == 1) ? "" : "s",
+                    state->repairs, state->parms.seed);
+            if (state->screened) {
+                fprintf (stderr, "libcuzmem: genetic: %llu drafts screened by simulation\n",
+                        state->screened);
+            }
 
 #if defined (DEBUG)
+            c = state->c;
+            sort (c, population);
             fprintf (fp, "Final Generation\n");
-            for (i=0; i<POPULATION; i++) {
-                fprintf (fp, "c: %i  f: %f  dna: %llu\n", i, c[i]->fit, c[i]->DNA);
+            for (i=0; i<population; i++) {
+                fprintf (fp, "c: %i  f: %f  dna: ", i, c[i]->fit);
+                bitset_fprint (fp, c[i]->DNA);
+                fprintf (fp, "\n");
             }
             fclose (fp);
 #endif
             // and free the candidates
-            for (i=0; i<POPULATION; i++) {
-                free (c[i]);
+            genetic_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
+
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER SAVE / LOAD / DROP (checkpoint)
+    // =========================================================================
+    else if (CUZMEM_TUNER_SAVE == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+        unsigned int i;
+        int have;
+
+        RESTORE_STATE (state);
+        ckpt_put (ck, &state->parms, sizeof(state->parms));
+        ckpt_put (ck, &state->prng, sizeof(state->prng));
+        ckpt_put (ck, &state->generation, sizeof(state->generation));
+        ckpt_put (ck, &state->best_fit, sizeof(state->best_fit));
+        ckpt_put (ck, &state->stalled, sizeof(state->stalled));
+        ckpt_put (ck, &state->mutation, sizeof(state->mutation));
+        ckpt_put (ck, &state->repairs, sizeof(state->repairs));
+        ckpt_put (ck, &state->screened, sizeof(state->screened));
+        for (i=0; i<state->parms.population; i++) {
+            have = (state->c[i] != NULL);
+            ckpt_put (ck, &have, sizeof(have));
+            if (have) {
+                ckpt_put (ck, &state->c[i]->fit, sizeof(double));
+                ckpt_put_bitset (ck, state->c[i]->DNA);
+            }
+        }
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_LOAD == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+        unsigned int i;
+        int have;
+
+        state = (genetic_state*)malloc (sizeof(genetic_state));
+        ckpt_get (ck, &state->parms, sizeof(state->parms));
+        genetic_parms_check (&state->parms);
+        ckpt_get (ck, &state->prng, sizeof(state->prng));
+        ckpt_get (ck, &state->generation, sizeof(state->generation));
+        ckpt_get (ck, &state->best_fit, sizeof(state->best_fit));
+        ckpt_get (ck, &state->stalled, sizeof(state->stalled));
+        ckpt_get (ck, &state->mutation, sizeof(state->mutation));
+        ckpt_get (ck, &state->repairs, sizeof(state->repairs));
+        ckpt_get (ck, &state->screened, sizeof(state->screened));
+        state->num_elite = (unsigned int)(state->parms.population * state->parms.elite);
+        state->gene = (unsigned int*)malloc ((ctx->num_genes + 1) * sizeof(unsigned int));
+        state->c = (candidate**)calloc (state->parms.population, sizeof(candidate*));
+        for (i=0; i<state->parms.population; i++) {
+            ckpt_get (ck, &have, sizeof(have));
+            if (have) {
+                state->c[i] = candidate_create (ctx);
+                ckpt_get (ck, &state->c[i]->fit, sizeof(double));
+                ckpt_get_bitset (ck, state->c[i]->DNA);
             }
-            free (c);
         }
+        SAVE_STATE (state);
 
+#if defined (DEBUG)
+        fp = fopen("scores.txt", "a");
+#endif
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_DROP == action) {
+        RESTORE_STATE (state);
+        if (state != NULL) {
+            genetic_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
         return NULL;
     }
 }
-
@@ -20,12 +20,39 @@
 
 #include "libcuzmem.h"
 #include "plans.h"
+#include "bitset.h"
+
+//-------------------------------------------
+#define GENETIC_GENERATIONS 10
+#define GENETIC_POPULATION  20
+#define GENETIC_ELITE       0.25f   // fraction carried over unchanged
+#define GENETIC_MUTATION    0.25f   // chance an offspring is mutated
+#define GENETIC_MIN_GPU_MEM 0.50f   // 1st generation's gpu memory floor
+#define GENETIC_STALL       3       // generations without gain before stopping
+#define GENETIC_SEED        1ULL
+#define GENETIC_SCREEN      1       // drafts simulated per candidate run
+//-------------------------------------------
+
+// -- Genetic Parameters Structure ---------------
+typedef struct cuzmem_genetic_parms_struct cuzmem_genetic_parms;
+struct cuzmem_genetic_parms_struct
+{
+    unsigned int generations;   // most generations
+    unsigned int population;
+    float elite;
+    float mutation;             // base rate (adapted while tuning)
+    float min_gpu_mem;
+    unsigned int stall;         // 0: always run every generation
+    unsigned long long seed;
+    unsigned int screen;        // 1: no screening by simulation
+};
+// -----------------------------------------------
 
 // -- Genetic Candidate Structure ----------------
 typedef struct candidate_struct candidate;
 struct candidate_struct
 {
-    unsigned long long DNA;  // bit pattern
+    cuzmem_bitset* DNA;      // bit pattern (one bit per knob)
     double fit;              // fitness
 };
 // -----------------------------------------------
@@ -34,6 +61,9 @@ struct candidate_struct
 extern "C" {
 #endif
 
+void
+genetic_parms_init (cuzmem_genetic_parms* g);
+
 cuzmem_plan*
 cuzmem_tuner_genetic (enum cuzmem_tuner_action action, void* parm);
 
@@ -0,0 +1,400 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "context.h"
+#include "plans.h"
+#include "bitset.h"
+#include "tuner_util.h"
+#include "checkpoint.h"
+#include "tuner_greedy.h"
+
+//#define DEBUG
+
+#define KNAPSACK_UNITS 4096     // capacity is scaled down to this many units
+
+// -- State Macros -----------------------
+#define SAVE_STATE(state_ptr)            \
+    (ctx->tuner_state = (void*)state_ptr)
+
+#define RESTORE_STATE(state_ptr)         \
+    (state_ptr = ctx->tuner_state)
+// ---------------------------------------
+
+// NOTES
+//
+// * Assumes the cost of putting a gene in pinned memory doesn't depend
+//   much on where the other genes are (close to separable), which it
+//   usually is.  Then n+2 iterations find a plan:
+//
+//     iteration 1       : baseline, every gene in gpu global memory
+//                         (whatever doesn't fit spills as usual)
+//     iteration 2..n+1  : gold gene k alone in pinned memory
+//     iteration n+2     : the knapsack solution
+//
+//   where n is the # of genes with gold members.  Genes without gold
+//   members never add to the peak, so they always stay global.
+//
+// * slowdown(k) = time(k pinned) - time(baseline) is the value of keeping
+//   gene k in gpu memory and the gene's gold bytes are its weight.  The
+//   0/1 knapsack over the gpu_mem_budget() max picks the genes to keep.
+//
+// * Weights are scaled to at most KNAPSACK_UNITS units of capacity
+//   (rounding weights up, so a solution always truly fits), which keeps
+//   the dynamic program at O(n * KNAPSACK_UNITS).
+//
+// * The fastest plan actually run wins, so the result is never worse
+//   than the baseline or any sweep plan.  What counts is the placement
+//   that really ran: a draft whose allocations fell back to pinned
+//   memory (the baseline, on a device too small for it) ran as another
+//   placement, and that is the one kept if it was the fastest.
+//
+// * In a coordinated tuning session (see queue.c) the whole sweep is
+//   offered to the workers as soon as the trace is in.
+//
+// * A draft whose placement is in the memo (e.g. the knapsack keeping
+//   every gene, which is the baseline) is scored without being run.
+
+// -- Greedy Tuner State -------------------------
+typedef struct greedy_state_struct greedy_state;
+struct greedy_state_struct
+{
+    cuzmem_bitset* genome;      // plan draft being run
+    unsigned int* gold_gene;    // genes swept (those with gold members)
+    unsigned int num_gold;
+    double* slowdown;           // per swept gene
+    double base_time;
+    double best_time;
+};
+// -----------------------------------------------
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static greedy_state*
+greedy_state_create (CUZMEM_CONTEXT ctx)
+{
+    unsigned int g;
+    greedy_state* state = (greedy_state*)malloc (sizeof(greedy_state));
+
+    state->genome = bitset_create (ctx->num_genes);
+    state->gold_gene = (unsigned int*)malloc ((ctx->num_genes + 1) * sizeof(unsigned int));
+    state->num_gold = 0;
+    for (g=0; g<ctx->num_genes; g++) {
+        if (bitset_get (ctx->gold_mask, g)) {
+            state->gold_gene[state->num_gold++] = g;
+        }
+    }
+    state->slowdown = (double*)calloc (state->num_gold + 1, sizeof(double));
+    state->base_time = 0.0;
+    state->best_time = -1.0;
+
+    return state;
+}
+
+
+static void
+greedy_state_destroy (greedy_state* state)
+{
+    bitset_destroy (state->genome);
+    free (state->gold_gene);
+    free (state->slowdown);
+    free (state);
+}
+
+
+// 0/1 knapsack: keep the genes whose slowdowns add up to the most
+// without their gold bytes exceeding capacity.  Sets state->genome.
+static void
+knapsack (CUZMEM_CONTEXT ctx, greedy_state* state, size_t capacity)
+{
+    unsigned int i, kept = 0, n = state->num_gold;
+    unsigned int c, units, *w;
+    size_t unit, used = 0;
+    double *best, v;
+    unsigned char* take;
+
+    // scale the weights
+    unit = capacity / KNAPSACK_UNITS + 1;
+    units = (unsigned int)(capacity / unit);
+    w = (unsigned int*)malloc ((n + 1) * sizeof(unsigned int));
+    for (i=0; i<n; i++) {
+        w[i] = (unsigned int)((ctx->gene_size[state->gold_gene[i]] + unit - 1) / unit);
+    }
+
+    // best[c]: most slowdown avoided with c units of gpu memory
+    best = (double*)calloc (units + 1, sizeof(double));
+    take = (unsigned char*)calloc ((size_t)(n + 1) * (units + 1), 1);
+    for (i=0; i<n; i++) {
+        if (state->slowdown[i] <= 0.0 || w[i] > units) {
+            continue;
+        }
+        for (c=units; c>=w[i]; c--) {
+            v = best[c - w[i]] + state->slowdown[i];
+            if (v > best[c]) {
+                best[c] = v;
+                take[(size_t)i * (units + 1) + c] = 1;
+            }
+            if (c == 0) {
+                break;
+            }
+        }
+    }
+
+    // walk back through the choices
+    // (genes without gold members always stay in gpu memory)
+    for (i=0; i<ctx->num_genes; i++) {
+        bitset_set (state->genome, i, 1);
+    }
+    c = units;
+    for (i=n; i>0; i--) {
+        if (take[(size_t)(i-1) * (units + 1) + c]) {
+            c -= w[i-1];
+            kept++;
+            used += ctx->gene_size[state->gold_gene[i-1]];
+        } else {
+            bitset_set (state->genome, state->gold_gene[i-1], 0);
+        }
+    }
+
+    fprintf (stderr, "libcuzmem: greedy: %u of %u gold genes kept in gpu global memory (%lu of %lu B)\n",
+            kept, n,
+            (unsigned long)used, (unsigned long)capacity);
+
+    free (w);
+    free (best);
+    free (take);
+}
+
+
+// plan draft for tuning iteration iter
+static void
+greedy_draft (CUZMEM_CONTEXT ctx, greedy_state* state, unsigned long long iter)
+{
+    unsigned int g;
+
+    if (iter > state->num_gold + 1) {
+        // knapsack solution is already in the genome
+        return;
+    }
+
+    for (g=0; g<ctx->num_genes; g++) {
+        bitset_set (state->genome, g, 1);
+    }
+    if (iter >= 2) {
+        bitset_set (state->genome, state->gold_gene[iter - 2], 0);
+    }
+}
+
+
+// takes the time measured for iteration iter's plan draft.  ran is the
+// placement that was really run (NULL if it isn't known)
+static void
+greedy_score (CUZMEM_CONTEXT ctx, greedy_state* state, unsigned long long iter,
+              double time, const cuzmem_bitset* ran)
+{
+    size_t gpu_mem_min, gpu_mem_max;
+
+    if (iter == 1) {
+        state->base_time = time;
+    }
+    else if (iter <= state->num_gold + 1) {
+        state->slowdown[iter - 2] = time - state->base_time;
+#if defined (DEBUG)
+        fprintf (stderr, "libcuzmem: greedy: gene %u pinned: %+f s\n",
+                state->gold_gene[iter - 2],
+                state->slowdown[iter - 2]);
+#endif
+    }
+
+    // the fastest plan run so far is the one we will keep
+    if (ran != NULL && (state->best_time < 0.0 || time < state->best_time)) {
+        state->best_time = time;
+        bitset_copy (ctx->best_plan, ran);
+    }
+
+    // sweep done: solve for the final plan draft
+    if (iter == state->num_gold + 1) {
+        gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
+        knapsack (ctx, state, gpu_mem_max);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// GREEDY TUNER
+//------------------------------------------------------------------------------
+cuzmem_plan*
+cuzmem_tuner_greedy (enum cuzmem_tuner_action action, void* parm)
+{
+    greedy_state* state;
+    CUZMEM_CONTEXT ctx = get_context();
+
+    // =========================================================================
+    //  TUNER START
+    // =========================================================================
+    if (CUZMEM_TUNER_START == action) {
+        // the plan draft was made at the end of the previous iteration
+
+        // start timing the iteration
+        ctx->start_time = get_time ();
+
+        // Return value currently has no meaning
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER LOOKUP
+    // =========================================================================
+    else if (CUZMEM_TUNER_LOOKUP == action) {
+        // parm: pointer to size of allocation
+        size_t size = *(size_t*)(parm);
+        cuzmem_plan* entry = NULL;
+
+        // default 0th tuning iteration handling
+        if (ctx->tune_iter == 0) {
+            return zeroth_lookup_handler (ctx, size);
+        }
+
+        // handle looping allocations & get current entry
+        if (loopy_entry (ctx, &entry, size)) {
+            return loopy_entry_handler (entry, size);
+        }
+
+        RESTORE_STATE (state);
+        entry->loc = bitset_get (state->genome, entry->gene);
+        alloc_mem (entry, size);
+
+        ctx->current_knob++;
+
+        return entry;
+    }
+    // =========================================================================
+    //  TUNER END
+    // =========================================================================
+    else if (CUZMEM_TUNER_END == action) {
+        double time;
+        unsigned long long i;
+        cuzmem_plan* entry;
+        cuzmem_bitset* realized;
+        int hit;
+
+        if (ctx->tune_iter == 0) {
+            if (zeroth_end_handler (ctx)) {
+                // everything fits in GPU memory, returning ends search
+                return NULL;
+            }
+
+            // greedy search specific: baseline + sweep + knapsack plan
+            state = greedy_state_create (ctx);
+            ctx->tune_iter_max = state->num_gold + 2;
+            SAVE_STATE (state);
+
+            fprintf (stderr, "libcuzmem: greedy: sweeping %u gold genes (%llu iterations)\n",
+                    state->num_gold, ctx->tune_iter_max);
+
+            // the sweep doesn't depend on what it measures, so all of
+            // it can be run at once (in a coordinated tuning session)
+            for (i=1; i<=state->num_gold+1; i++) {
+                greedy_draft (ctx, state, i);
+                offer_draft (ctx, state->genome);
+            }
+        }
+        else {
+            RESTORE_STATE (state);
+            realized = bitset_create (ctx->num_genes);
+            greedy_score (ctx, state, ctx->tune_iter, fitness_time (&ctx->fitness),
+                          genome_from_plan (ctx, realized) ? NULL : realized);
+            bitset_destroy (realized);
+        }
+
+        // draft the next plan (drafts measured already are scored as is)
+        while (ctx->tune_iter < ctx->tune_iter_max) {
+            greedy_draft (ctx, state, ctx->tune_iter + 1);
+            hit = lookup_fitness (ctx, state->genome, &time);
+            if (hit == MEMO_MISS) {
+                break;
+            }
+            ctx->tune_iter++;
+            greedy_score (ctx, state, ctx->tune_iter, time,
+                          (hit == MEMO_REALIZED) ? state->genome : NULL);
+        }
+
+        // clear out all of our inloop entry's 1st hit flags
+        for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+            entry->first_hit = 1;
+        }
+
+        // always end with this
+        max_iteration_handler (ctx);
+        if (ctx->op_mode == CUZMEM_RUN) {
+            greedy_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER SAVE / LOAD / DROP (checkpoint)
+    // =========================================================================
+    else if (CUZMEM_TUNER_SAVE == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+
+        RESTORE_STATE (state);
+        ckpt_put_bitset (ck, state->genome);
+        ckpt_put (ck, &state->num_gold, sizeof(state->num_gold));
+        ckpt_put (ck, state->slowdown, state->num_gold * sizeof(double));
+        ckpt_put (ck, &state->base_time, sizeof(state->base_time));
+        ckpt_put (ck, &state->best_time, sizeof(state->best_time));
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_LOAD == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+        unsigned int num_gold;
+
+        // (the swept genes follow from the gold members)
+        state = greedy_state_create (ctx);
+        ckpt_get_bitset (ck, state->genome);
+        ckpt_get (ck, &num_gold, sizeof(num_gold));
+        if (num_gold != state->num_gold) {
+            ck->ok = 0;
+        }
+        ckpt_get (ck, state->slowdown, state->num_gold * sizeof(double));
+        ckpt_get (ck, &state->base_time, sizeof(state->base_time));
+        ckpt_get (ck, &state->best_time, sizeof(state->best_time));
+        SAVE_STATE (state);
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_DROP == action) {
+        RESTORE_STATE (state);
+        if (state != NULL) {
+            greedy_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
+        return NULL;
+    }
+    // =========================================================================
+    // TUNER: UNKNOWN ACTION SPECIFIED
+    // =========================================================================
+    else {
+        printf ("libcuzmem: tuner asked to perform unknown action!\n");
+        exit (1);
+        return NULL;
+    }
+    // =========================================================================
+}
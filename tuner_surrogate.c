@@ -0,0 +1,809 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "context.h"
+#include "plans.h"
+#include "bitset.h"
+#include "prng.h"
+#include "tuner_util.h"
+#include "checkpoint.h"
+#include "tuner_surrogate.h"
+
+//-------------------------------------------
+#define SURROGATE_ITERS 30      // tuning iterations after the trace
+#define PAIR_GENES      8       // largest gold genes given pairwise terms
+#define MAX_TERMS       256     // most model terms given a full posterior
+#define DIAG_SWEEPS     50      // coordinate descent sweeps of a diagonal fit
+#define POOL            256     // random candidates scored per iteration
+#define MAX_FLIPS       4       // most bits flipped by a pool candidate
+#define PRIOR_PREC      1.0     // prior precision of (relative) effects
+#define NOISE_FLOOR     0.01    // smallest relative noise std dev assumed
+#define SURROGATE_SEED  1ULL
+#define REPORT_EXT      "sensitivity"
+#define SQRT_2PI        2.50662827463100050242
+//-------------------------------------------
+
+//#define DEBUG
+
+// -- State Macros -----------------------
+#define SAVE_STATE(state_ptr)            \
+    (ctx->tuner_state = (void*)state_ptr)
+
+#define RESTORE_STATE(state_ptr)         \
+    (state_ptr = ctx->tuner_state)
+// ---------------------------------------
+
+// NOTES
+//
+// * Every tuning iteration is a full run of the application, so this
+//   tuner spends cpu time to save iterations.  After each run it fits
+//   a Bayesian ridge regression to all (genome -> time) pairs measured:
+//
+//     time ~ b + sum_g w_g x_g + sum_(g,h) w_gh x_g x_h
+//
+//   with x_g = 1 if gene g is in gpu global memory.  Pairwise terms are
+//   only kept for the PAIR_GENES largest gold genes, which is where the
+//   interactions (competing for the same gpu memory) are.
+//
+// * With a full posterior every fit is a Cholesky factorization
+//   (O(p^3) for p terms) and every candidate scored a triangular solve
+//   (O(p^2)).  Past MAX_TERMS terms (ungrouped plans with hundreds of
+//   knobs) that would cost more than the runs it saves, so the model
+//   falls back to main effects only with a diagonal posterior: the
+//   means are fit by coordinate descent on the same ridge objective
+//   and each effect's variance is taken as independent of the others.
+//   Fits, scoring & the report are then all O(p) per genome.
+//
+// * Times are divided by the trace plan's time, so the prior (precision
+//   PRIOR_PREC on every effect) and noise floor are unitless.  Noise
+//   variance is re-estimated from the fit residuals each iteration.
+//
+// * The next plan is the one with the most expected improvement over
+//   the best time measured, among: every single gene flip of the best
+//   plan, plus POOL random 1..MAX_FLIPS flips (or random genomes).
+//   Candidates outside the gpu_mem_budget() (too big to fit, or under
+//   the utilization floor, as in the exhaustive tuner), or that were
+//   already run, are never scored.
+//
+// * A picked genome that the memo knows (a draft that fell back to a
+//   placement already run) is observed from the memo, and we pick again.
+//
+// * When tuning finishes the fitted effects are written next to the
+//   plan in ~/.project/plan.sensitivity (seconds; negative means the gene
+//   runs faster in gpu global memory).
+//
+// * The random pool comes from a xorshift generator seeded with
+//   CUZMEM_SURROGATE_SEED (default 1) and checkpointed with the rest of
+//   the state, so sessions repeat exactly and rand() is left to the
+//   application.
+//
+// * CUZMEM_SURROGATE_ITERS sets the # of iterations (default 30).
+
+// -- Surrogate Tuner State ----------------------
+typedef struct surrogate_state_struct surrogate_state;
+struct surrogate_state_struct
+{
+    unsigned int n;             // # of genes
+    unsigned int num_pairs;
+    unsigned int* pair;         // gene pairs: pair[2*k], pair[2*k+1]
+    unsigned int p;             // # of model terms
+    int diag;                   // diagonal posterior (p > MAX_TERMS)
+
+    cuzmem_bitset** x;          // genomes run so far
+    double* y;                  // their relative times
+    unsigned int num_obs;
+    unsigned int max_obs;
+
+    double scale;               // trace plan time (s)
+    double best_y;
+    double noise;               // noise variance
+
+    double* A;                  // posterior precision, then its Cholesky factor
+                                // (diag: just the precision's diagonal)
+    double* w;                  // posterior mean
+    double* tmp;
+
+    cuzmem_bitset* candidate;   // genome being run
+    cuzmem_prng prng;           // draws the random pool
+};
+// -----------------------------------------------
+
+
+//------------------------------------------------------------------------------
+// HELPERS
+//------------------------------------------------------------------------------
+static surrogate_state*
+surrogate_state_create (CUZMEM_CONTEXT ctx, double trace_time)
+{
+    unsigned int g, h, k, num_gold = 0;
+    unsigned int gold[PAIR_GENES];
+    char* env;
+    surrogate_state* state = (surrogate_state*)malloc (sizeof(surrogate_state));
+
+    state->n = (unsigned int)ctx->num_genes;
+
+    // pick the largest gold genes for pairwise terms (kept largest first)
+    for (g=0; g<state->n; g++) {
+        if (!bitset_get (ctx->gold_mask, g)) {
+            continue;
+        }
+        for (k=num_gold; k>0; k--) {
+            if (ctx->gene_size[gold[k-1]] >= ctx->gene_size[g]) {
+                break;
+            }
+            if (k < PAIR_GENES) {
+                gold[k] = gold[k-1];
+            }
+        }
+        if (k < PAIR_GENES) {
+            gold[k] = g;
+            if (num_gold < PAIR_GENES) {
+                num_gold++;
+            }
+        }
+    }
+
+    state->num_pairs = num_gold * (num_gold - 1) / 2;
+    state->pair = (unsigned int*)malloc ((2 * state->num_pairs + 1) * sizeof(unsigned int));
+    for (g=0, k=0; g<num_gold; g++) {
+        for (h=g+1; h<num_gold; h++, k++) {
+            state->pair[2*k] = gold[g];
+            state->pair[2*k+1] = gold[h];
+        }
+    }
+
+    // intercept + per gene + pairwise
+    state->p = 1 + state->n + state->num_pairs;
+    state->diag = (state->p > MAX_TERMS);
+    if (state->diag) {
+        state->num_pairs = 0;
+        state->p = 1 + state->n;
+        fprintf (stderr, "libcuzmem: surrogate: %u genes, modeling main effects only\n", state->n);
+    }
+
+    state->max_obs = (unsigned int)ctx->tune_iter_max + 1;
+    state->x = (cuzmem_bitset**)malloc (state->max_obs * sizeof(cuzmem_bitset*));
+    state->y = (double*)malloc (state->max_obs * sizeof(double));
+    state->num_obs = 0;
+
+    state->scale = (trace_time > 0.0) ? trace_time : 1.0;
+    state->best_y = 0.0;
+    state->noise = NOISE_FLOOR * NOISE_FLOOR;
+
+    state->A = (double*)malloc ((state->diag ? 1 : (size_t)state->p) * state->p * sizeof(double));
+    state->w = (double*)calloc (state->p, sizeof(double));
+    state->tmp = (double*)malloc (state->p * sizeof(double));
+
+    state->candidate = bitset_create (state->n);
+
+    env = getenv ("CUZMEM_SURROGATE_SEED");
+    prng_seed (&state->prng, env ? strtoull (env, NULL, 10) : SURROGATE_SEED);
+
+    return state;
+}
+
+
+static void
+surrogate_state_destroy (surrogate_state* state)
+{
+    unsigned int i;
+
+    for (i=0; i<state->num_obs; i++) {
+        bitset_destroy (state->x[i]);
+    }
+    free (state->x);
+    free (state->y);
+    free (state->pair);
+    free (state->A);
+    free (state->w);
+    free (state->tmp);
+    bitset_destroy (state->candidate);
+    free (state);
+}
+
+
+// model terms of a genome
+static void
+features (const surrogate_state* state, const cuzmem_bitset* x, double* phi)
+{
+    unsigned int g, k;
+
+    phi[0] = 1.0;
+    for (g=0; g<state->n; g++) {
+        phi[1 + g] = bitset_get (x, g);
+    }
+    for (k=0; k<state->num_pairs; k++) {
+        phi[1 + state->n + k] = phi[1 + state->pair[2*k]] * phi[1 + state->pair[2*k+1]];
+    }
+}
+
+
+// in place Cholesky factorization A = L L' (lower triangle)
+// returns 0 if A was not positive definite
+static int
+cholesky (double* A, unsigned int p)
+{
+    unsigned int i, j, k;
+    double s;
+
+    for (j=0; j<p; j++) {
+        s = A[j*p + j];
+        for (k=0; k<j; k++) {
+            s -= A[j*p + k] * A[j*p + k];
+        }
+        if (s <= 0.0) {
+            return 0;
+        }
+        A[j*p + j] = sqrt (s);
+        for (i=j+1; i<p; i++) {
+            s = A[i*p + j];
+            for (k=0; k<j; k++) {
+                s -= A[i*p + k] * A[j*p + k];
+            }
+            A[i*p + j] = s / A[j*p + j];
+        }
+    }
+
+    return 1;
+}
+
+
+// solves L z = b in place
+static void
+forward_sub (const double* L, double* b, unsigned int p)
+{
+    unsigned int i, k;
+
+    for (i=0; i<p; i++) {
+        for (k=0; k<i; k++) {
+            b[i] -= L[i*p + k] * b[k];
+        }
+        b[i] /= L[i*p + i];
+    }
+}
+
+
+// solves L' z = b in place
+static void
+backward_sub (const double* L, double* b, unsigned int p)
+{
+    int i;
+    unsigned int k;
+
+    for (i=(int)p-1; i>=0; i--) {
+        for (k=i+1; k<p; k++) {
+            b[i] -= L[k*p + i] * b[k];
+        }
+        b[i] /= L[i*p + i];
+    }
+}
+
+
+// diagonal posterior: precision diagonal & ridge mean by coordinate
+// descent (warm started from the previous fit)
+static void
+surrogate_fit_diag (surrogate_state* state)
+{
+    unsigned int i, k, s, p = state->p;
+    double num, w, *phi = state->tmp;
+    double* r = (double*)malloc ((state->num_obs + 1) * sizeof(double));
+
+    for (i=0; i<p; i++) {
+        state->A[i] = (i == 0) ? 1e-6 : PRIOR_PREC;
+    }
+    for (k=0; k<state->num_obs; k++) {
+        features (state, state->x[k], phi);
+        r[k] = state->y[k];
+        for (i=0; i<p; i++) {
+            state->A[i] += phi[i] / state->noise;     // (phi is 0 or 1)
+            r[k] -= phi[i] * state->w[i];
+        }
+    }
+
+    for (s=0; s<DIAG_SWEEPS; s++) {
+        for (i=0; i<p; i++) {
+            num = 0.0;
+            for (k=0; k<state->num_obs; k++) {
+                if (i == 0 || bitset_get (state->x[k], i-1)) {
+                    num += r[k] + state->w[i];
+                }
+            }
+            w = num / state->noise / state->A[i];
+            for (k=0; k<state->num_obs; k++) {
+                if (i == 0 || bitset_get (state->x[k], i-1)) {
+                    r[k] -= w - state->w[i];
+                }
+            }
+            state->w[i] = w;
+        }
+    }
+
+    free (r);
+}
+
+
+// posterior of the model given all observations
+static void
+surrogate_fit (surrogate_state* state)
+{
+    unsigned int i, j, k, p = state->p;
+    double r, sse, *phi = state->tmp;
+    double* b;
+
+    if (state->diag) {
+        surrogate_fit_diag (state);
+        goto noise;
+    }
+
+    b = (double*)calloc (p, sizeof(double));
+
+    // A = prior + Phi' Phi / noise,  b = Phi' y / noise
+    memset (state->A, 0, (size_t)p * p * sizeof(double));
+    for (k=0; k<state->num_obs; k++) {
+        features (state, state->x[k], phi);
+        for (i=0; i<p; i++) {
+            if (phi[i] == 0.0) {
+                continue;
+            }
+            for (j=0; j<=i; j++) {
+                state->A[i*p + j] += phi[i] * phi[j] / state->noise;
+            }
+            b[i] += phi[i] * state->y[k] / state->noise;
+        }
+    }
+    for (i=0; i<p; i++) {
+        state->A[i*p + i] += (i == 0) ? 1e-6 : PRIOR_PREC;
+    }
+
+    if (!cholesky (state->A, p)) {
+        // can't happen with a positive prior, but don't trust the model
+        memset (state->w, 0, p * sizeof(double));
+        free (b);
+        return;
+    }
+    forward_sub (state->A, b, p);
+    backward_sub (state->A, b, p);
+    memcpy (state->w, b, p * sizeof(double));
+    free (b);
+
+noise:
+    // re-estimate the noise from the residuals
+    sse = 0.0;
+    for (k=0; k<state->num_obs; k++) {
+        features (state, state->x[k], phi);
+        r = state->y[k];
+        for (i=0; i<p; i++) {
+            r -= phi[i] * state->w[i];
+        }
+        sse += r * r;
+    }
+    state->noise = sse / state->num_obs;
+    if (state->noise < NOISE_FLOOR * NOISE_FLOOR) {
+        state->noise = NOISE_FLOOR * NOISE_FLOOR;
+    }
+}
+
+
+// predictive mean & variance of a genome's relative time
+static void
+surrogate_predict (surrogate_state* state, const cuzmem_bitset* x, double* mean, double* var)
+{
+    unsigned int i;
+    double* phi = state->tmp;
+
+    features (state, x, phi);
+    *mean = 0.0;
+    for (i=0; i<state->p; i++) {
+        *mean += phi[i] * state->w[i];
+    }
+
+    *var = state->noise;
+    if (state->diag) {
+        for (i=0; i<state->p; i++) {
+            *var += phi[i] * phi[i] / state->A[i];
+        }
+        return;
+    }
+
+    // phi' A^-1 phi = |L^-1 phi|^2
+    forward_sub (state->A, phi, state->p);
+    for (i=0; i<state->p; i++) {
+        *var += phi[i] * phi[i];
+    }
+}
+
+
+// expected improvement (minimizing) over the best time measured
+static double
+expected_improvement (surrogate_state* state, const cuzmem_bitset* x)
+{
+    double mean, var, s, z;
+
+    surrogate_predict (state, x, &mean, &var);
+    s = sqrt (var);
+    z = (state->best_y - mean) / s;
+
+    return (state->best_y - mean) * 0.5 * erfc (-z / sqrt (2.0))
+            + s * exp (-0.5 * z * z) / SQRT_2PI;
+}
+
+
+static void
+surrogate_observe (CUZMEM_CONTEXT ctx, surrogate_state* state,
+                   const cuzmem_bitset* x, double time)
+{
+    double y = time / state->scale;
+
+    if (state->num_obs == state->max_obs) {
+        return;
+    }
+    state->x[state->num_obs] = bitset_clone (x);
+    state->y[state->num_obs] = y;
+    if (state->num_obs == 0 || y < state->best_y) {
+        state->best_y = y;
+        bitset_copy (ctx->best_plan, x);
+    }
+    state->num_obs++;
+}
+
+
+static int
+already_run (const surrogate_state* state, const cuzmem_bitset* x)
+{
+    unsigned int i;
+
+    for (i=0; i<state->num_obs; i++) {
+        if (bitset_equal (state->x[i], x)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// scores a candidate and keeps it in state->candidate if it is the best yet
+static void
+consider (CUZMEM_CONTEXT ctx, surrogate_state* state, const cuzmem_bitset* x,
+          size_t gpu_mem_min, size_t gpu_mem_max, double* best_ei)
+{
+    double ei;
+    size_t gpu_mem_req = genome_gpu_mem_req (ctx, x);
+
+    if ((gpu_mem_req < gpu_mem_min) || (gpu_mem_req >= gpu_mem_max) || already_run (state, x)) {
+        return;
+    }
+    ei = expected_improvement (state, x);
+    if (ei > *best_ei) {
+        *best_ei = ei;
+        bitset_copy (state->candidate, x);
+    }
+}
+
+
+// picks the next genome to run into state->candidate
+static void
+surrogate_propose (CUZMEM_CONTEXT ctx, surrogate_state* state)
+{
+    unsigned int g, i, k;
+    double best_ei = -1.0;
+    size_t gpu_mem_min, gpu_mem_max;
+    cuzmem_bitset* x = bitset_create (state->n);
+
+    gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
+    surrogate_fit (state);
+
+    // fallback if nothing scores: the best plan again
+    bitset_copy (state->candidate, ctx->best_plan);
+    if (state->n == 0) {
+        bitset_destroy (x);
+        return;
+    }
+
+    // every single flip of the best plan
+    for (g=0; g<state->n; g++) {
+        bitset_copy (x, ctx->best_plan);
+        bitset_flip (x, g);
+        consider (ctx, state, x, gpu_mem_min, gpu_mem_max, &best_ei);
+    }
+
+    // plus some random ones further out
+    for (i=0; i<POOL; i++) {
+        if (prng_uniform (&state->prng) < 0.25) {
+            bitset_random_prng (x, &state->prng);
+        } else {
+            bitset_copy (x, ctx->best_plan);
+            k = 1;
+            while (k < MAX_FLIPS && prng_uniform (&state->prng) < 0.5) {
+                k++;
+            }
+            while (k--) {
+                bitset_flip (x, prng_below (&state->prng, state->n));
+            }
+        }
+        consider (ctx, state, x, gpu_mem_min, gpu_mem_max, &best_ei);
+    }
+
+#if defined (DEBUG)
+    fprintf (stderr, "libcuzmem: surrogate: next EI %f (noise %f)\n",
+            best_ei, sqrt (state->noise));
+#endif
+
+    bitset_destroy (x);
+}
+
+
+typedef struct {
+    unsigned int term;
+    double effect;
+} report_line;
+
+static int
+cmp_effect (const void* a, const void* b)
+{
+    double ea = fabs (((const report_line*)a)->effect);
+    double eb = fabs (((const report_line*)b)->effect);
+    return (ea < eb) - (ea > eb);
+}
+
+
+// writes the fitted effects, biggest first, to ~/.project/plan.sensitivity
+static void
+write_sensitivity (CUZMEM_CONTEXT ctx, surrogate_state* state)
+{
+    unsigned int i, t, p = state->p;
+    char filename[FILENAME_MAX];
+    double* e = state->tmp;
+    report_line* line;
+    FILE* fp;
+
+    surrogate_fit (state);
+
+    if (plan_filename (filename, ctx->project_name, ctx->plan_name, REPORT_EXT)) {
+        return;
+    }
+    fp = fopen (filename, "w");
+    if (fp == NULL) {
+        fprintf (stderr, "libcuzmem: unable to write sensitivity report %s\n", filename);
+        return;
+    }
+
+    line = (report_line*)malloc (p * sizeof(report_line));
+    for (t=1; t<p; t++) {
+        line[t-1].term = t;
+        line[t-1].effect = state->w[t] * state->scale;
+    }
+    qsort (line, p - 1, sizeof(report_line), cmp_effect);
+
+    fprintf (fp, "# libcuzmem sensitivity report: %s/%s\n", ctx->project_name, ctx->plan_name);
+    fprintf (fp, "# %u runs, trace plan %f s, best %f s, noise %f s\n",
+            state->num_obs, state->scale, state->best_y * state->scale,
+            sqrt (state->noise) * state->scale);
+    fprintf (fp, "# effect of gpu global (vs. pinned) memory, negative is faster\n");
+    fprintf (fp, "# term\tgenes\tgold bytes\teffect (s)\tstd dev (s)\n");
+    for (i=0; i<p-1; i++) {
+        t = line[i].term;
+
+        // std dev of the effect: sqrt of A^-1 diagonal
+        memset (e, 0, p * sizeof(double));
+        if (state->diag) {
+            e[t] = 1.0 / state->A[t];
+        } else {
+            e[t] = 1.0;
+            forward_sub (state->A, e, p);
+            backward_sub (state->A, e, p);
+        }
+
+        if (t <= state->n) {
+            fprintf (fp, "gene\t%u\t%lu\t%+e\t%e\n", t-1,
+                    (unsigned long)ctx->gene_size[t-1],
+                    line[i].effect, sqrt (e[t]) * state->scale);
+        } else {
+            unsigned int k = t - 1 - state->n;
+            fprintf (fp, "pair\t%u,%u\t-\t%+e\t%e\n",
+                    state->pair[2*k], state->pair[2*k+1],
+                    line[i].effect, sqrt (e[t]) * state->scale);
+        }
+    }
+
+    free (line);
+    fclose (fp);
+
+    fprintf (stderr, "libcuzmem: sensitivity report written to %s\n", filename);
+}
+
+
+//------------------------------------------------------------------------------
+// SURROGATE TUNER
+//------------------------------------------------------------------------------
+cuzmem_plan*
+cuzmem_tuner_surrogate (enum cuzmem_tuner_action action, void* parm)
+{
+    surrogate_state* state;
+    CUZMEM_CONTEXT ctx = get_context();
+
+    // =========================================================================
+    //  TUNER START
+    // =========================================================================
+    if (CUZMEM_TUNER_START == action) {
+        // the candidate was picked at the end of the previous iteration
+
+        // start timing the iteration
+        ctx->start_time = get_time ();
+
+        // Return value currently has no meaning
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER LOOKUP
+    // =========================================================================
+    else if (CUZMEM_TUNER_LOOKUP == action) {
+        // parm: pointer to size of allocation
+        size_t size = *(size_t*)(parm);
+        int loc;
+        cuzmem_plan* entry = NULL;
+
+        // default 0th tuning iteration handling
+        if (ctx->tune_iter == 0) {
+            return zeroth_lookup_handler (ctx, size);
+        }
+
+        // handle looping allocations & get current entry
+        if (loopy_entry (ctx, &entry, size)) {
+            return loopy_entry_handler (entry, size);
+        }
+
+        RESTORE_STATE (state);
+
+        // assign candidate's location to entry and perform allocation
+        loc = bitset_get (state->candidate, entry->gene);
+        entry->loc = loc;
+        alloc_mem (entry, size);
+
+        // check for environment induced mutation
+        if (entry->loc != loc) {
+            bitset_set (state->candidate, entry->gene, entry->loc);
+        }
+
+        ctx->current_knob++;
+
+        return entry;
+    }
+    // =========================================================================
+    //  TUNER END
+    // =========================================================================
+    else if (CUZMEM_TUNER_END == action) {
+        char* env;
+        double time;
+        cuzmem_plan* entry;
+
+        time = fitness_time (&ctx->fitness);
+
+        if (ctx->tune_iter == 0) {
+            if (zeroth_end_handler (ctx)) {
+                // everything fits in GPU memory, returning ends search
+                return NULL;
+            }
+
+            // surrogate specific: # of iterations & the trace plan is the
+            // 1st observation
+            env = getenv ("CUZMEM_SURROGATE_ITERS");
+            ctx->tune_iter_max = env ? strtoull (env, NULL, 10) : SURROGATE_ITERS;
+
+            state = surrogate_state_create (ctx, time);
+            genome_from_plan (ctx, state->candidate);
+            surrogate_observe (ctx, state, state->candidate, time);
+            SAVE_STATE (state);
+        }
+        else {
+            RESTORE_STATE (state);
+            surrogate_observe (ctx, state, state->candidate, time);
+        }
+
+        // clear out all of our inloop entry's 1st hit flags
+        for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+            entry->first_hit = 1;
+        }
+
+        // always end with this
+        max_iteration_handler (ctx);
+        while (ctx->op_mode != CUZMEM_RUN) {
+            surrogate_propose (ctx, state);
+
+            // measured already?  then observe it without a run & pick again
+            if (lookup_fitness (ctx, state->candidate, &time) == MEMO_MISS) {
+                break;
+            }
+            ctx->tune_iter++;
+            surrogate_observe (ctx, state, state->candidate, time);
+            max_iteration_handler (ctx);
+        }
+
+        if (ctx->op_mode == CUZMEM_RUN) {
+            write_sensitivity (ctx, state);
+            surrogate_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER SAVE / LOAD / DROP (checkpoint)
+    // =========================================================================
+    else if (CUZMEM_TUNER_SAVE == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+        unsigned int i;
+
+        RESTORE_STATE (state);
+        ckpt_put (ck, &state->scale, sizeof(state->scale));
+        ckpt_put (ck, &state->num_obs, sizeof(state->num_obs));
+        for (i=0; i<state->num_obs; i++) {
+            ckpt_put_bitset (ck, state->x[i]);
+        }
+        ckpt_put (ck, state->y, state->num_obs * sizeof(double));
+        ckpt_put (ck, &state->best_y, sizeof(state->best_y));
+        ckpt_put (ck, &state->noise, sizeof(state->noise));
+        ckpt_put_bitset (ck, state->candidate);
+        ckpt_put (ck, &state->prng, sizeof(state->prng));
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_LOAD == action) {
+        cuzmem_ckpt* ck = (cuzmem_ckpt*)parm;
+        unsigned int i, num_obs;
+        double scale;
+
+        // (model terms follow from the gold members, the fit is redone)
+        ckpt_get (ck, &scale, sizeof(scale));
+        state = surrogate_state_create (ctx, scale);
+        ckpt_get (ck, &num_obs, sizeof(num_obs));
+        if (num_obs > state->max_obs) {
+            ck->ok = 0;
+            num_obs = 0;
+        }
+        for (i=0; i<num_obs; i++) {
+            state->x[i] = bitset_create (state->n);
+            ckpt_get_bitset (ck, state->x[i]);
+        }
+        state->num_obs = num_obs;
+        ckpt_get (ck, state->y, num_obs * sizeof(double));
+        ckpt_get (ck, &state->best_y, sizeof(state->best_y));
+        ckpt_get (ck, &state->noise, sizeof(state->noise));
+        ckpt_get_bitset (ck, state->candidate);
+        ckpt_get (ck, &state->prng, sizeof(state->prng));
+        SAVE_STATE (state);
+        return NULL;
+    }
+    else if (CUZMEM_TUNER_DROP == action) {
+        RESTORE_STATE (state);
+        if (state != NULL) {
+            surrogate_state_destroy (state);
+            SAVE_STATE (NULL);
+        }
+        return NULL;
+    }
+    // =========================================================================
+    // TUNER: UNKNOWN ACTION SPECIFIED
+    // =========================================================================
+    else {
+        printf ("libcuzmem: tuner asked to perform unknown action!\n");
+        exit (1);
+        return NULL;
+    }
+    // =========================================================================
+}
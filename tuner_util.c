@@ -22,23 +22,13 @@
 #include <limits.h>
 #include "context.h"
 #include "plans.h"
+#include "bitset.h"
+#include "queue.h"
+#include "tuner_util.h"
 
 //#define DEBUG
 
-// TODO: should be CMake generated
-#define WORD_SIZE 8
-
-// returns a bit mask of n contiguous bits
-unsigned long long
-generate_mask (unsigned int n)
-{
-    unsigned long long tmp = ULLONG_MAX;
-
-    tmp = tmp << (64 - n);
-    tmp = tmp >> (64 - n);
-
-    return tmp;
-}
+#define GPU_MEM_RESERVE 20000000
 
 // returns number of bits required to express n combinations
 unsigned int
@@ -53,23 +43,6 @@ num_bits (unsigned long long n)
     return exp + 1;
 }
 
-// detect if requested malloc is recurring within a single
-// optimization iteration loop
-unsigned int
-detect_inloop (cuzmem_plan** entry, size_t size)
-{
-    while (*entry != NULL) {
-        if (((*entry)->size == size) && ((*entry)->gpu_pointer == NULL)) {
-            // found a malloc/free loop within tuning loop
-            (*entry)->inloop = 1;
-            return 1;
-        }
-        *entry = (*entry)->next;
-    }
-
-    return 0;
-}
-
 // checks if the requested malloc is known to reoccur within
 // a single optimization iteration
 unsigned int
@@ -117,31 +90,43 @@ zeroth_lookup_handler (CUZMEM_CONTEXT ctx, size_t size)
 {
     if (ctx->tune_iter == 0) {
         CUresult ret = CUDA_SUCCESS;
-        cuzmem_plan* entry = ctx->plan;
-        int loopy = detect_inloop (&entry, size);
+        // an entry freed earlier this iteration with the same size means
+        // a malloc/free loop within the tuning loop (cudaFree() keeps
+        // them by size, so this isn't a walk of the whole plan draft)
+        cuzmem_plan* entry = plan_index_pop_inloop (&ctx->trace_free, size);
 
-        if (loopy) {
+        if (entry != NULL) {
+            entry->inloop = 1;
             ret = alloc_mem (entry, size);
             if (ret != CUDA_SUCCESS) {
                 // Note, cudaMalloc() will report a NULL return value
                 // from call_tuner(LOOKUP) as cudaErrorMemoryAllocation
+                plan_index_push_inloop (&ctx->trace_free, entry);
                 entry = NULL;
             }
         } else {
             entry = (cuzmem_plan*) malloc (sizeof(cuzmem_plan));
             entry->id = ctx->current_knob;
+            entry->gene = entry->id;
+            entry->site = ctx->alloc_site;
+            entry->ordinal = 0;
             entry->size = size;
             entry->loc = 1;
             entry->inloop = 0;
             entry->first_hit = 1;
+            entry->gold_member = 0;
+            entry->alloc_stamp = 0;
+            entry->gold_stamp = 0;
             entry->cpu_pointer = NULL;
             entry->gpu_pointer = NULL;
+            entry->kept_gpu_pointer = NULL;
+            entry->kept_cpu_pointer = NULL;
 
             ret = alloc_mem (entry, size);
             if (ret != CUDA_SUCCESS) {
                 // not enough CPU memory: return failure
                 free (entry);
-                entry = NULL;
+                return NULL;
             }
 
             // Insert successful entry into plan draft
@@ -155,6 +140,161 @@ zeroth_lookup_handler (CUZMEM_CONTEXT ctx, size_t size)
     }
 }
 
+// grouping key of a knob (see group_knobs())
+static unsigned long long
+group_key (CUZMEM_CONTEXT ctx, cuzmem_plan* entry)
+{
+    switch (ctx->grouping) {
+    case CUZMEM_GROUP_SITE:
+        return entry->site;
+    case CUZMEM_GROUP_SIZE:
+        // power of 2 size class
+        return (entry->size > 1) ? 64 - __builtin_clzll ((unsigned long long)entry->size - 1) : 0;
+    default:
+        return (unsigned long long)entry->id;
+    }
+}
+
+// assigns knobs to genes (the bits the tuners search over)
+// * CUZMEM_GROUP_NONE: every knob is its own gene
+// * CUZMEM_GROUP_SITE: knobs allocated from the same call site share a gene
+// * CUZMEM_GROUP_SIZE: knobs in the same power of 2 size class share a gene
+// genes are numbered in order of each group's first knob
+void
+group_knobs (CUZMEM_CONTEXT ctx)
+{
+    unsigned int i, capacity = 16;
+    unsigned long long n = ctx->current_knob;
+    unsigned long long key;
+    unsigned long long* keys;
+    int* genes;
+    cuzmem_plan** by_id;
+    cuzmem_plan* entry;
+
+    ctx->num_genes = 0;
+    if (n == 0) {
+        return;
+    }
+
+    // the plan draft is in reverse id order
+    by_id = (cuzmem_plan**)calloc (n, sizeof(cuzmem_plan*));
+    for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+        by_id[entry->id] = entry;
+    }
+
+    // open addressed key -> gene table
+    while (capacity < 2*n) {
+        capacity *= 2;
+    }
+    keys = (unsigned long long*)malloc (capacity * sizeof(unsigned long long));
+    genes = (int*)malloc (capacity * sizeof(int));
+    memset (genes, -1, capacity * sizeof(int));
+
+    for (key=0; key<n; key++) {
+        entry = by_id[key];
+        if (entry == NULL) {
+            continue;
+        }
+        i = (unsigned int)((group_key (ctx, entry) * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+        while (genes[i] != -1 && keys[i] != group_key (ctx, entry)) {
+            i = (i + 1) & (capacity - 1);
+        }
+        if (genes[i] == -1) {
+            keys[i] = group_key (ctx, entry);
+            genes[i] = (int)ctx->num_genes++;
+        }
+        entry->gene = genes[i];
+    }
+
+    if (ctx->grouping != CUZMEM_GROUP_NONE) {
+        fprintf (stderr, "libcuzmem: %llu knobs grouped into %llu genes\n",
+                n, ctx->num_genes);
+    }
+
+    free (by_id);
+    free (keys);
+    free (genes);
+}
+
+
+// numbers each knob within its (call site, size): the plan identifies
+// a knob by site, size & ordinal rather than by allocation order alone
+void
+number_site_ordinals (CUZMEM_CONTEXT ctx)
+{
+    unsigned int i, capacity = 16;
+    unsigned long long id, n = ctx->current_knob;
+    unsigned long long* sites;
+    size_t* sizes;
+    unsigned int* counts;
+    cuzmem_plan** by_id;
+    cuzmem_plan* entry;
+
+    if (n == 0) {
+        return;
+    }
+
+    // the plan draft is in reverse id order
+    by_id = (cuzmem_plan**)calloc (n, sizeof(cuzmem_plan*));
+    for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+        by_id[entry->id] = entry;
+    }
+
+    while (capacity < 2*n) {
+        capacity *= 2;
+    }
+    sites = (unsigned long long*)calloc (capacity, sizeof(unsigned long long));
+    sizes = (size_t*)calloc (capacity, sizeof(size_t));
+    counts = (unsigned int*)calloc (capacity, sizeof(unsigned int));
+
+    for (id=0; id<n; id++) {
+        entry = by_id[id];
+        if (entry == NULL || entry->site == 0) {
+            continue;
+        }
+        i = (unsigned int)(((entry->site ^ ((unsigned long long)entry->size << 1))
+                * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+        while (sites[i] != 0 && (sites[i] != entry->site || sizes[i] != entry->size)) {
+            i = (i + 1) & (capacity - 1);
+        }
+        sites[i] = entry->site;
+        sizes[i] = entry->size;
+        entry->ordinal = counts[i]++;
+    }
+
+    free (by_id);
+    free (sites);
+    free (sizes);
+    free (counts);
+}
+
+
+// completes the 0th iteration's allocation trace (the knobs have their
+// genes now) and writes it out for cuzmem-sim.  The leader of a
+// coordinated tuning session writes it, not its workers.
+static void
+finish_trace (CUZMEM_CONTEXT ctx)
+{
+    char filename[FILENAME_MAX];
+    size_t gpu_mem_min, gpu_mem_max;
+
+    if (!ctx->trace.enabled) {
+        return;
+    }
+
+    gpu_mem_budget (ctx, &gpu_mem_min, &gpu_mem_max);
+    trace_finish (&ctx->trace, ctx->plan, ctx->num_genes,
+                  fitness_time (&ctx->fitness), gpu_mem_max, &ctx->device);
+
+    if (ctx->queue.role != QUEUE_WORKER) {
+        make_project_directory (ctx->project_name);
+        if (!plan_filename (filename, ctx->project_name, ctx->plan_name, TRACE_EXT)) {
+            trace_write (&ctx->trace, filename);
+        }
+    }
+}
+
+
 // standard 0th iteration logic
 // * checks if cpu-pinned memory is necessary at all
 // * if pinned memory is necessary, saves num_knobs (full search space)
@@ -168,7 +308,29 @@ zeroth_end_handler (CUZMEM_CONTEXT ctx)
         unsigned int all_global = 1;
         cuzmem_plan* entry = ctx->plan;
 
+        number_site_ordinals (ctx);
+
+        // settle the gold members: entries that were live when the
+        // largest aggregate allocation was observed by cudaFree()
+        while (entry != NULL) {
+            if (ctx->peak_clock == 0) {
+                entry->gold_member = 0;
+            }
+            else if (entry->gold_stamp == ctx->peak_clock) {
+                entry->gold_member = 1;
+            }
+            else if (entry->gpu_pointer != NULL &&
+                     entry->alloc_stamp <= ctx->peak_clock) {
+                entry->gold_member = 1;
+            }
+            else {
+                entry->gold_member = 0;
+            }
+            entry = entry->next;
+        }
+
         // check all entries for pinned host memory usage
+        entry = ctx->plan;
         while (entry != NULL) {
             if (entry->loc != 1) {
                 all_global = 0;
@@ -183,18 +345,31 @@ zeroth_end_handler (CUZMEM_CONTEXT ctx)
             printf ("libcuzmem: auto-tuning complete.\n");
 #endif
             ctx->op_mode = CUZMEM_RUN;
-            write_plan (ctx->plan, ctx->project_name, ctx->plan_name);
+            write_plan (ctx->plan, ctx->project_name, ctx->plan_name, &ctx->device);
+            finish_trace (ctx);
             return 1;
         }
 
         // if everything didn't fit, size up the search space
         ctx->num_knobs = ctx->current_knob + 1;
-
-        if (ctx->num_knobs > sizeof(unsigned long long) * WORD_SIZE) {
-            fprintf (stderr, "libcuzmem: allocation symbol limit exceeded!\n");
-            exit(0);
+        group_knobs (ctx);
+
+        // gold bytes & gold members per gene, for genome_gpu_mem_req()
+        bitset_destroy (ctx->best_plan);
+        bitset_destroy (ctx->gold_mask);
+        free (ctx->gene_size);
+        ctx->best_plan = bitset_create (ctx->num_genes);
+        ctx->gold_mask = bitset_create (ctx->num_genes);
+        ctx->gene_size = (size_t*)calloc (ctx->num_genes, sizeof(size_t));
+        for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+            if (entry->gold_member) {
+                ctx->gene_size[entry->gene] += entry->size;
+                bitset_set (ctx->gold_mask, entry->gene, 1);
+            }
+            bitset_set (ctx->best_plan, entry->gene, entry->loc);
         }
 
+        finish_trace (ctx);
         return 0;
     }
 }
@@ -271,10 +446,10 @@ max_iteration_handler (CUZMEM_CONTEXT ctx)
 
         // ...and write out the best plan
         while (entry != NULL) {
-            entry->loc = (ctx->best_plan >> entry->id) & 0x0001;
+            entry->loc = bitset_get (ctx->best_plan, entry->gene);
             entry = entry->next;
         }
-        write_plan (ctx->plan, ctx->project_name, ctx->plan_name);
+        write_plan (ctx->plan, ctx->project_name, ctx->plan_name, &ctx->device);
     } else {
         // not finished, so get ready for next tuning iteration
         ctx->current_knob = 0;
@@ -282,6 +457,97 @@ max_iteration_handler (CUZMEM_CONTEXT ctx)
 
 }
 
+// GPU global memory budget for the gold members of a plan draft
+//   min: gpu_mem_percent of the memory that is free (utilization floor)
+//   max: the memory that is free, less a safety margin for the driver
+//        (20 MB, or a 16th of what is free on very small devices)
+void
+gpu_mem_budget (CUZMEM_CONTEXT ctx, size_t* min, size_t* max)
+{
+    CUresult ret;
+    unsigned int gpu_mem_free, gpu_mem_total;
+    size_t reserve = GPU_MEM_RESERVE;
+
+    ret = get_gpu_mem_info (&gpu_mem_free, &gpu_mem_total);
+    if (ret != CUDA_SUCCESS) {
+        fprintf (stderr, "libcuzmem: could not retrieve GPU memory info from CUDA Driver!\n");
+        exit (1);
+    }
+
+    if (reserve > gpu_mem_free / 16) {
+        reserve = gpu_mem_free / 16;
+    }
+    *min = (size_t)((float)gpu_mem_free * (float)ctx->gpu_mem_percent * 0.01f);
+    *max = gpu_mem_free - reserve;
+
+    // a floor above the ceiling would rule out every plan draft
+    if (*min >= *max) {
+        *min = 0;
+    }
+}
+
+// GPU global memory the gold members of a genome would use
+// (i.e. the peak a plan drafted from the genome needs)
+size_t
+genome_gpu_mem_req (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome)
+{
+    return bitset_weighted_sum (genome, ctx->gold_mask, ctx->gene_size);
+}
+
+// sets a genome from the plan's current placement.  returns 1 if no
+// genome describes it: alloc_mem() moved only some members of a gene
+// (the gene then holds its last member's location)
+int
+genome_from_plan (CUZMEM_CONTEXT ctx, cuzmem_bitset* genome)
+{
+    cuzmem_plan* entry;
+    cuzmem_bitset* seen = bitset_create (ctx->num_genes);
+    int split = 0;
+
+    bitset_zero (genome);
+    for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+        if (bitset_get (seen, entry->gene) &&
+            bitset_get (genome, entry->gene) != entry->loc) {
+            split = 1;
+        }
+        bitset_set (seen, entry->gene, 1);
+        bitset_set (genome, entry->gene, entry->loc);
+    }
+    bitset_destroy (seen);
+
+    return split;
+}
+
+// memo_lookup() for the tuners.  When leading a coordinated tuning
+// session, a draft a worker is running is waited for (it then comes
+// back as a hit) and one offered but not taken yet is taken back
+int
+lookup_fitness (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome, double* time)
+{
+    queue_settle (&ctx->queue, &ctx->memo, genome);
+    return memo_lookup (&ctx->memo, genome, time);
+}
+
+// a draft the tuner will look up later: when leading a coordinated
+// tuning session, a worker may run it in the meantime
+void
+offer_draft (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome)
+{
+    queue_offer (&ctx->queue, &ctx->memo, genome);
+}
+
+// fitness of a genome predicted by replaying the 0th iteration's
+// allocation trace (see sim.c).  returns 0 if there is no trace
+int
+predict_fitness (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome, double* time)
+{
+    if (!ctx->trace.complete || ctx->trace.num_genes != ctx->num_genes) {
+        return 0;
+    }
+    *time = sim_predict (&ctx->trace, &ctx->sim, genome, NULL);
+    return 1;
+}
+
 // printf ("%s", binary(n));
 const char*
 binary (unsigned long long x)
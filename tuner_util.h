@@ -19,6 +19,8 @@
 #define _tuner_util_h_
 
 #include "plans.h"
+#include "bitset.h"
+#include "context.h"
 
 
 #if defined __cplusplus
@@ -28,9 +30,6 @@ extern "C" {
 unsigned int
 num_bits (unsigned long long n);
 
-unsigned int
-detect_inloop (cuzmem_plan** entry, size_t size);
-
 unsigned int
 check_inloop (cuzmem_plan** entry, size_t size);
 
@@ -47,6 +46,33 @@ loopy_entry (CUZMEM_CONTEXT ctx, cuzmem_plan** entry, size_t size);
 cuzmem_plan*
 loopy_entry_handler (cuzmem_plan* entry, size_t size);
 
+void
+number_site_ordinals (CUZMEM_CONTEXT ctx);
+
+void
+group_knobs (CUZMEM_CONTEXT ctx);
+
+void
+max_iteration_handler (CUZMEM_CONTEXT ctx);
+
+void
+gpu_mem_budget (CUZMEM_CONTEXT ctx, size_t* min, size_t* max);
+
+size_t
+genome_gpu_mem_req (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome);
+
+int
+genome_from_plan (CUZMEM_CONTEXT ctx, cuzmem_bitset* genome);
+
+int
+lookup_fitness (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome, double* time);
+
+void
+offer_draft (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome);
+
+int
+predict_fitness (CUZMEM_CONTEXT ctx, const cuzmem_bitset* genome, double* time);
+
 const char*
 binary (unsigned long long x);
 
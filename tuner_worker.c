@@ -0,0 +1,174 @@
+/*  This file is part of libcuzmem
+    Copyright (C) 2011  James A. Shackleford
+
+    libcuzmem is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "context.h"
+#include "plans.h"
+#include "bitset.h"
+#include "tuner_util.h"
+#include "queue.h"
+#include "tuner_worker.h"
+
+// -- State Macros -----------------------
+#define SAVE_STATE(state_ptr)            \
+    (ctx->tuner_state = (void*)state_ptr)
+
+#define RESTORE_STATE(state_ptr)         \
+    (state_ptr = ctx->tuner_state)
+// ---------------------------------------
+
+// NOTES
+//
+// * The "tuner" of a worker in a coordinated tuning session (see
+//   queue.c).  It never searches: after the usual trace iteration it
+//   runs whatever candidate it can claim from the leader's queue, writes
+//   back the fitness cuzmem_end() measured for it, and claims the next.
+//
+// * Tuning ends when the leader says so.  The plan is written by the
+//   leader only; a worker just leaves its entries on the final placement.
+//   A worker that loses its leader (or traced different allocations)
+//   stops with the placement it last ran.
+//
+// * Workers don't checkpoint.  One that is restarted traces again and
+//   rejoins the session.
+
+// -- Worker Tuner State -------------------------
+typedef struct worker_state_struct worker_state;
+struct worker_state_struct
+{
+    cuzmem_bitset* genome;      // candidate being run
+};
+// -----------------------------------------------
+
+
+//------------------------------------------------------------------------------
+// WORKER TUNER
+//------------------------------------------------------------------------------
+cuzmem_plan*
+cuzmem_tuner_worker (enum cuzmem_tuner_action action, void* parm)
+{
+    worker_state* state;
+    CUZMEM_CONTEXT ctx = get_context();
+
+    // =========================================================================
+    //  TUNER START
+    // =========================================================================
+    if (CUZMEM_TUNER_START == action) {
+        // the candidate was claimed at the end of the previous iteration
+
+        // start timing the iteration
+        ctx->start_time = get_time ();
+
+        // Return value currently has no meaning
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER LOOKUP
+    // =========================================================================
+    else if (CUZMEM_TUNER_LOOKUP == action) {
+        // parm: pointer to size of allocation
+        size_t size = *(size_t*)(parm);
+        cuzmem_plan* entry = NULL;
+
+        // default 0th tuning iteration handling
+        if (ctx->tune_iter == 0) {
+            return zeroth_lookup_handler (ctx, size);
+        }
+
+        // handle looping allocations & get current entry
+        if (loopy_entry (ctx, &entry, size)) {
+            return loopy_entry_handler (entry, size);
+        }
+
+        RESTORE_STATE (state);
+        entry->loc = bitset_get (state->genome, entry->gene);
+        alloc_mem (entry, size);
+
+        ctx->current_knob++;
+
+        return entry;
+    }
+    // =========================================================================
+    //  TUNER END
+    // =========================================================================
+    else if (CUZMEM_TUNER_END == action) {
+        cuzmem_plan* entry;
+        cuzmem_bitset* realized;
+
+        if (ctx->tune_iter == 0) {
+            if (zeroth_end_handler (ctx)) {
+                // everything fits in GPU memory, returning ends search
+                return NULL;
+            }
+
+            state = (worker_state*)malloc (sizeof(worker_state));
+            state->genome = bitset_create (ctx->num_genes);
+            SAVE_STATE (state);
+        }
+        else {
+            // report the candidate we just ran
+            RESTORE_STATE (state);
+            realized = bitset_create (ctx->num_genes);
+            queue_result (&ctx->queue, genome_from_plan (ctx, realized) ? NULL : realized,
+                          fitness_time (&ctx->fitness));
+            bitset_destroy (realized);
+        }
+
+        // clear out all of our inloop entry's 1st hit flags
+        for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+            entry->first_hit = 1;
+        }
+        ctx->current_knob = 0;
+
+        switch (queue_take (&ctx->queue, ctx->plan, state->genome)) {
+        case QUEUE_CANDIDATE:
+            return NULL;
+        case QUEUE_FINISHED:
+            for (entry = ctx->plan; entry != NULL; entry = entry->next) {
+                entry->loc = bitset_get (state->genome, entry->gene);
+            }
+            break;
+        default:
+            break;
+        }
+
+        ctx->op_mode = CUZMEM_RUN;
+        bitset_destroy (state->genome);
+        free (state);
+        SAVE_STATE (NULL);
+        return NULL;
+    }
+    // =========================================================================
+    //  TUNER SAVE / LOAD / DROP (checkpoint)
+    // =========================================================================
+    else if (CUZMEM_TUNER_SAVE == action ||
+             CUZMEM_TUNER_LOAD == action ||
+             CUZMEM_TUNER_DROP == action) {
+        // workers don't checkpoint (cuzmem_start() turns it off for them)
+        return NULL;
+    }
+    // =========================================================================
+    // TUNER: UNKNOWN ACTION SPECIFIED
+    // =========================================================================
+    else {
+        printf ("libcuzmem: tuner asked to perform unknown action!\n");
+        exit (1);
+        return NULL;
+    }
+    // =========================================================================
+}